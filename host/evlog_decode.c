@@ -0,0 +1,143 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Decode the hex event log (CONFIG_EVLOG_HEX) of a captured monitor log,
+// with the record text of the firmware (main/evlog_text.c).
+//
+// evlog_decode [-s] [file]
+//   -s  print records per site and the button latency instead of the records
+// Reads stdin without a file, e.g. idf.py monitor | tee log.txt, then evlog_decode log.txt.
+// Other lines are ignored. The 32 bit record time is unwrapped per core.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evlog.h"
+
+#define MAX_CORES	2
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Records are little endian like the ESP32
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void decode(const uint8_t *p, EVLOG_RECORD_t *r)
+{
+	r->time = le32(p);
+	r->site = p[4];
+	r->lap = p[5];
+	r->small = (int16_t)(p[6] | (p[7] << 8));
+	r->a = le32(p + 8);
+	r->b = le32(p + 12);
+}
+
+int main(int argc, char **argv)
+{
+	bool summary = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		switch (opt) {
+		case 's':
+			summary = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s] [file]\n", argv[0]);
+			return 1;
+		}
+	}
+	FILE *fp = stdin;
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (fp == NULL) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	uint64_t base[MAX_CORES] = {0};
+	uint32_t last[MAX_CORES] = {0};
+	uint32_t sites[EVLOG_SITES + 1] = {0};
+	uint32_t suppressed = 0, lines = 0, records = 0, bad = 0;
+	uint32_t latencyMin = UINT32_MAX, latencyMax = 0, latencyCount = 0;
+	uint64_t latencySum = 0;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), fp)) {
+		char *at = strstr(line, "EVLOG: @");
+		if (at == NULL) continue;
+		at += strlen("EVLOG: @");
+		int core = hex_nibble(at[0]);
+		if (core < 0 || core >= MAX_CORES || at[1] != ':') {
+			bad++;
+			continue;
+		}
+		lines++;
+		char *hex = at + 2;
+		while (1) {
+			uint8_t bytes[sizeof(EVLOG_RECORD_t)];
+			int i;
+			for (i=0; i<sizeof(bytes); i++) {
+				int hi = hex_nibble(hex[i*2]);
+				int lo = (hi < 0) ? -1 : hex_nibble(hex[i*2+1]);
+				if (lo < 0) break;
+				bytes[i] = (hi << 4) | lo;
+			}
+			// A partial record is a line cut short by the capture
+			if (i != sizeof(bytes)) {
+				if (i != 0) bad++;
+				break;
+			}
+			hex += sizeof(bytes) * 2;
+
+			EVLOG_RECORD_t r;
+			decode(bytes, &r);
+			if (r.time < last[core] && last[core] - r.time > 0x80000000u) base[core] += 1ULL << 32;
+			last[core] = r.time;
+			uint64_t time = base[core] + r.time;
+			records++;
+			sites[(r.site < EVLOG_SITES) ? r.site : EVLOG_SITES]++;
+			if (r.site == EVLOG_SUPPRESSED) suppressed += r.a;
+			if (r.site == EVLOG_BUTTON_LATENCY) {
+				if (r.a < latencyMin) latencyMin = r.a;
+				if (r.a > latencyMax) latencyMax = r.a;
+				latencySum += r.a;
+				latencyCount++;
+			}
+			if (!summary) {
+				char text[EVLOG_TEXT];
+				evlog_format(&r, text, sizeof(text));
+				printf("%d %12.6f %s\n", core, time / 1e6, text);
+			}
+		}
+	}
+
+	if (summary) {
+		printf("lines=%u records=%u suppressed=%u bad=%u\n", lines, records, suppressed, bad);
+		for (int site=0; site<=EVLOG_SITES; site++) {
+			if (sites[site] == 0) continue;
+			printf("  site %2d %-12s %u\n", site, (site < EVLOG_SITES) ? evlog_site_name(site) : "unknown", sites[site]);
+		}
+		if (latencyCount) {
+			printf("button latency min=%uus avg=%uus max=%uus presses=%u\n",
+				latencyMin, (uint32_t)(latencySum / latencyCount), latencyMax, latencyCount);
+		}
+	} else if (bad) {
+		fprintf(stderr, "%u malformed lines or records\n", bad);
+	}
+	if (fp != stdin) fclose(fp);
+	return 0;
+}
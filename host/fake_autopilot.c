@@ -0,0 +1,298 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Stand-in autopilot for testing the rate negotiation without a vehicle.
+// Streams a few messages at PX4-like default rates to the HUD and answers
+// MAV_CMD_SET_MESSAGE_INTERVAL like PX4 does.
+//
+// fake_autopilot [-t host:port] [-p port] [-s sysid] [-l loss]
+//   -t  where to stream to (default 127.0.0.1:14540, the HUD or gcs_host)
+//   -p  local UDP port (default 14580)
+//   -s  sysid (default 1)
+//   -l  percentage of received commands to ignore, to test retries (default 0)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ardupilotmega/mavlink.h>
+
+typedef struct {
+	uint32_t msgid;
+	const char *name;
+	int32_t defaultInterval;	// Microseconds
+	int32_t interval;			// 0 while stopped
+	int64_t next;
+	uint32_t sent;
+} STREAM_t;
+
+static STREAM_t streams[] = {
+	{ MAVLINK_MSG_ID_HEARTBEAT, "HEARTBEAT", 1000000 },
+	{ MAVLINK_MSG_ID_SYS_STATUS, "SYS_STATUS", 200000 },
+	{ MAVLINK_MSG_ID_GPS_RAW_INT, "GPS_RAW_INT", 200000 },
+	{ MAVLINK_MSG_ID_ATTITUDE, "ATTITUDE", 20000 },
+	{ MAVLINK_MSG_ID_GLOBAL_POSITION_INT, "GLOBAL_POSITION_INT", 20000 },
+	{ MAVLINK_MSG_ID_VFR_HUD, "VFR_HUD", 100000 },
+};
+#define NUM_STREAMS (sizeof(streams)/sizeof(streams[0]))
+
+static int fd;
+static struct sockaddr_in target;
+static uint8_t sysid = 1;
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void send_message(const mavlink_message_t *msg)
+{
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len = mavlink_msg_to_send_buffer(buf, msg);
+	sendto(fd, buf, len, 0, (struct sockaddr *)&target, sizeof(target));
+}
+
+static void send_stream(STREAM_t *s, int64_t now)
+{
+	mavlink_message_t msg;
+	double t = now / 1e6;
+	switch (s->msgid) {
+	case MAVLINK_MSG_ID_HEARTBEAT: {
+		mavlink_heartbeat_t hb;
+		memset(&hb, 0, sizeof(hb));
+		hb.type = MAV_TYPE_QUADROTOR;
+		hb.autopilot = MAV_AUTOPILOT_PX4;
+		hb.system_status = MAV_STATE_ACTIVE;
+		hb.mavlink_version = 3;
+		mavlink_msg_heartbeat_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &hb);
+		break;
+	}
+	case MAVLINK_MSG_ID_SYS_STATUS: {
+		mavlink_sys_status_t st;
+		memset(&st, 0, sizeof(st));
+		st.voltage_battery = 12400;
+		st.battery_remaining = 80;
+		mavlink_msg_sys_status_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &st);
+		break;
+	}
+	case MAVLINK_MSG_ID_GPS_RAW_INT: {
+		mavlink_gps_raw_int_t gps;
+		memset(&gps, 0, sizeof(gps));
+		gps.time_usec = now;
+		gps.fix_type = 3;
+		gps.satellites_visible = 12;
+		mavlink_msg_gps_raw_int_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &gps);
+		break;
+	}
+	case MAVLINK_MSG_ID_ATTITUDE: {
+		mavlink_attitude_t att;
+		memset(&att, 0, sizeof(att));
+		att.time_boot_ms = now / 1000;
+		att.roll = 0.2 * sin(t);
+		att.pitch = 0.1 * cos(t);
+		mavlink_msg_attitude_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &att);
+		break;
+	}
+	case MAVLINK_MSG_ID_GLOBAL_POSITION_INT: {
+		mavlink_global_position_int_t pos;
+		memset(&pos, 0, sizeof(pos));
+		pos.time_boot_ms = now / 1000;
+		pos.relative_alt = 10000;
+		mavlink_msg_global_position_int_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &pos);
+		break;
+	}
+	case MAVLINK_MSG_ID_VFR_HUD: {
+		mavlink_vfr_hud_t hud;
+		memset(&hud, 0, sizeof(hud));
+		hud.airspeed = 10 + 5 * sin(t / 4);
+		hud.groundspeed = hud.airspeed;
+		hud.heading = (int)(t * 10) % 360;
+		hud.throttle = 50;
+		hud.alt = 10;
+		mavlink_msg_vfr_hud_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &hud);
+		break;
+	}
+	default:
+		return;
+	}
+	send_message(&msg);
+	s->sent++;
+}
+
+static STREAM_t *find(uint32_t msgid)
+{
+	for (int i=0; i<NUM_STREAMS; i++) {
+		if (streams[i].msgid == msgid) return &streams[i];
+	}
+	return NULL;
+}
+
+// param2: -1 stops, 0 restores the default rate, otherwise the interval in microseconds
+static uint8_t set_interval(uint32_t msgid, float interval, int64_t now)
+{
+	STREAM_t *s = find(msgid);
+	if (s == NULL || s->msgid == MAVLINK_MSG_ID_HEARTBEAT) return MAV_RESULT_UNSUPPORTED;
+	if (interval < 0) {
+		s->interval = 0;
+	} else if (interval == 0) {
+		s->interval = s->defaultInterval;
+	} else {
+		s->interval = interval;
+	}
+	s->next = now;
+	printf("SET_MESSAGE_INTERVAL %s interval=%d\n", s->name, s->interval);
+	return MAV_RESULT_ACCEPTED;
+}
+
+static void handle(const mavlink_message_t *msg, int loss, int64_t now)
+{
+	static int64_t lastGcs = 0;
+	if (msg->msgid == MAVLINK_MSG_ID_HEARTBEAT) {
+		if (now - lastGcs > 3000000) printf("GCS heartbeat sysid=%d compid=%d\n", msg->sysid, msg->compid);
+		lastGcs = now;
+		return;
+	}
+	if (msg->msgid != MAVLINK_MSG_ID_COMMAND_LONG) return;
+
+	mavlink_command_long_t cmd;
+	mavlink_msg_command_long_decode(msg, &cmd);
+	if (cmd.target_system != sysid) return;
+	if (loss > 0 && rand() % 100 < loss) {
+		printf("command %d ignored\n", cmd.command);
+		return;
+	}
+	mavlink_command_ack_t ack;
+	memset(&ack, 0, sizeof(ack));
+	ack.command = cmd.command;
+	ack.result = MAV_RESULT_UNSUPPORTED;
+	ack.target_system = msg->sysid;
+	ack.target_component = msg->compid;
+	if (cmd.command == MAV_CMD_SET_MESSAGE_INTERVAL) {
+		ack.result = set_interval(cmd.param1, cmd.param2, now);
+	}
+	mavlink_message_t reply;
+	mavlink_msg_command_ack_encode(sysid, MAV_COMP_ID_AUTOPILOT1, &reply, &ack);
+	send_message(&reply);
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = "127.0.0.1";
+	int targetPort = 14540;
+	int port = 14580;
+	int loss = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:p:s:l:")) != -1) {
+		switch (opt) {
+		case 't': {
+			char *colon = strchr(optarg, ':');
+			if (colon != NULL) {
+				*colon = 0;
+				targetPort = atoi(colon + 1);
+			}
+			host = optarg;
+			break;
+		}
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 's':
+			sysid = atoi(optarg);
+			break;
+		case 'l':
+			loss = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t host:port] [-p port] [-s sysid] [-l loss]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	memset(&target, 0, sizeof(target));
+	target.sin_family = AF_INET;
+	target.sin_port = htons(targetPort);
+	if (inet_pton(AF_INET, host, &target.sin_addr) != 1) {
+		fprintf(stderr, "%s: not an IPv4 address\n", host);
+		return 1;
+	}
+
+	int64_t start = now_us();
+	for (int i=0; i<NUM_STREAMS; i++) {
+		streams[i].interval = streams[i].defaultInterval;
+		streams[i].next = start;
+	}
+	printf("sysid=%d port=%d streaming to %s:%d\n", sysid, port, host, targetPort);
+
+	mavlink_message_t msg;
+	mavlink_status_t status;
+	int64_t lastPrint = start;
+	while(1) {
+		int64_t now = now_us();
+		int64_t next = now + 100000;
+		for (int i=0; i<NUM_STREAMS; i++) {
+			STREAM_t *s = &streams[i];
+			if (s->interval == 0) continue;
+			if (now >= s->next) {
+				send_stream(s, now);
+				s->next += s->interval;
+				if (s->next < now) s->next = now + s->interval;
+			}
+			if (s->next < next) next = s->next;
+		}
+
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		int64_t wait = next - now_us();
+		if (wait < 0) wait = 0;
+		struct timeval timeout = { .tv_sec = wait / 1000000, .tv_usec = wait % 1000000 };
+		int ret = select(fd + 1, &readfds, NULL, NULL, &timeout);
+		if (ret < 0 && errno != EINTR) {
+			perror("select");
+			return 1;
+		}
+		if (ret > 0) {
+			uint8_t buffer[1500];
+			int len = recv(fd, buffer, sizeof(buffer), 0);
+			for (int i=0; i<len; i++) {
+				if (mavlink_parse_char(MAVLINK_COMM_1, buffer[i], &msg, &status)) handle(&msg, loss, now_us());
+			}
+		}
+
+		now = now_us();
+		if (now - lastPrint >= 1000000) {
+			printf("sent:");
+			for (int i=0; i<NUM_STREAMS; i++) {
+				printf(" %s=%u", streams[i].name, streams[i].sent);
+				streams[i].sent = 0;
+			}
+			printf("\n");
+			fflush(stdout);
+			lastPrint = now;
+		}
+	}
+	return 0;
+}
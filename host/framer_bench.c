@@ -0,0 +1,188 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Compare the bulk framer with the per-byte library parser on a recorded stream.
+//
+// framer_bench [-t] [-n loops] [-c chunk] [-m msgid[,msgid...]] file
+//   -t  file is a tlog (8 byte timestamp before every frame)
+//   -n  passes over the stream (default 100)
+//   -c  bytes per call, like one datagram (default 1472)
+//   -m  message IDs the firmware uses (default 74 = VFR_HUD)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <ardupilotmega/mavlink.h>
+
+#include "framer.h"
+
+#define MAX_WANTED	32
+
+static uint32_t wanted[MAX_WANTED];
+static int numWanted = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_wanted(uint32_t msgid)
+{
+	for (int i=0; i<numWanted; i++) {
+		if (wanted[i] == msgid) return 1;
+	}
+	return 0;
+}
+
+// Read the whole file. For a tlog, drop the timestamps and keep the frames.
+static uint8_t *load(const char *path, int tlog, long *length)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *data = malloc(size);
+	if (data == NULL || fread(data, 1, size, fp) != size) {
+		fprintf(stderr, "%s: read error\n", path);
+		fclose(fp);
+		free(data);
+		return NULL;
+	}
+	fclose(fp);
+
+	if (tlog) {
+		long in = 0, out = 0;
+		while (in + 8 + FRAMER_HEADER_V1 <= size) {
+			uint8_t *p = &data[in + 8];
+			long len;
+			if (p[0] == FRAMER_STX_V2) {
+				len = FRAMER_HEADER_V2 + p[1] + 2 + ((p[2] & 0x01) ? FRAMER_SIGNATURE : 0);
+			} else if (p[0] == FRAMER_STX_V1) {
+				len = FRAMER_HEADER_V1 + p[1] + 2;
+			} else {
+				fprintf(stderr, "%s: no frame at offset %ld\n", path, in + 8);
+				break;
+			}
+			if (in + 8 + len > size) break;
+			memmove(&data[out], p, len);
+			out += len;
+			in += 8 + len;
+		}
+		size = out;
+	}
+	*length = size;
+	return data;
+}
+
+static uint32_t framerFrames;
+
+static void on_frame(const FRAME_t *frame, void *arg)
+{
+	framerFrames++;
+}
+
+int main(int argc, char **argv)
+{
+	int tlog = 0;
+	int loops = 100;
+	int chunk = 1472;
+	int opt;
+	while ((opt = getopt(argc, argv, "tn:c:m:")) != -1) {
+		switch (opt) {
+		case 't':
+			tlog = 1;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'c':
+			chunk = atoi(optarg);
+			break;
+		case 'm':
+			for (char *tok = strtok(optarg, ","); tok && numWanted < MAX_WANTED; tok = strtok(NULL, ",")) {
+				wanted[numWanted++] = atoi(tok);
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t] [-n loops] [-c chunk] [-m msgid,...] file\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || loops <= 0 || chunk <= 0) {
+		fprintf(stderr, "usage: %s [-t] [-n loops] [-c chunk] [-m msgid,...] file\n", argv[0]);
+		return 1;
+	}
+	if (numWanted == 0) wanted[numWanted++] = MAVLINK_MSG_ID_VFR_HUD;
+
+	long length;
+	uint8_t *data = load(argv[optind], tlog, &length);
+	if (data == NULL) return 1;
+
+	// Library parser, one call per byte, message ID checked after the CRC
+	mavlink_message_t rxmsg, message;
+	mavlink_status_t rxstatus, status;
+	memset(&rxstatus, 0, sizeof(rxstatus));
+	uint32_t libFrames = 0, libWanted = 0, libBad = 0;
+	double start = now();
+	for (int loop=0; loop<loops; loop++) {
+		for (long i=0; i<length; i++) {
+			uint8_t ret = mavlink_frame_char_buffer(&rxmsg, &rxstatus, data[i], &message, &status);
+			if (ret == 1) {
+				libFrames++;
+				if (is_wanted(message.msgid)) libWanted++;
+			} else if (ret == 2) {
+				libBad++;
+			}
+		}
+	}
+	double libTime = now() - start;
+
+	// Bulk framer, one call per chunk, CRC only for wanted IDs
+	FRAMER_t framer;
+	FRAMER_CTX_t ctx;
+	framer_init(&framer);
+	framer_ctx_init(&ctx);
+	for (int i=0; i<numWanted; i++) {
+		const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(wanted[i]);
+		if (entry == NULL || !framer_want(&framer, wanted[i], entry->crc_extra)) {
+			fprintf(stderr, "msgid %u not supported\n", wanted[i]);
+			return 1;
+		}
+	}
+	start = now();
+	for (int loop=0; loop<loops; loop++) {
+		for (long i=0; i<length; i+=chunk) {
+			int n = (length - i < chunk) ? length - i : chunk;
+			framer_scan(&framer, &ctx, &data[i], n, on_frame, NULL);
+		}
+	}
+	double framerTime = now() - start;
+
+	double mbytes = (double)length * loops / 1e6;
+	uint32_t messages = framerFrames + ctx.stats.skipped;
+	printf("stream   %ld bytes x %d loops\n", length, loops);
+	printf("library  %8.3f s %8.1f MB/s %8.1f ns/msg frames=%u wanted=%u bad_crc=%u\n",
+		libTime, mbytes / libTime, libTime * 1e9 / (libFrames ? libFrames : 1), libFrames, libWanted, libBad);
+	printf("framer   %8.3f s %8.1f MB/s %8.1f ns/msg frames=%u skipped=%u bad_crc=%u garbage=%u\n",
+		framerTime, mbytes / framerTime, framerTime * 1e9 / (messages ? messages : 1),
+		framerFrames, ctx.stats.skipped, ctx.stats.badCrc, ctx.stats.garbage);
+	printf("speedup  %8.2f\n", libTime / framerTime);
+	if (libWanted != framerFrames) {
+		printf("MISMATCH wanted frames library=%u framer=%u\n", libWanted, framerFrames);
+		return 2;
+	}
+	free(data);
+	return 0;
+}
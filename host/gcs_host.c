@@ -0,0 +1,178 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Run the rate negotiation of the firmware (main/gcs.c) on a PC.
+// Listens like the HUD, prints the rate of every message ID once a second,
+// and switches screens from stdin or on a timer.
+//
+// gcs_host [-p port] [-c seconds]
+//   -p  UDP port to listen on (default 14540)
+//   -c  cycle through the screens every this many seconds (default 0, stdin only)
+// Type 1 to 5 and Enter to switch screens.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ardupilotmega/mavlink.h>
+
+#include "framer.h"
+#include "gcs.h"
+
+static int fd;
+
+// Frames per message ID in the current second
+static uint32_t counts[FRAMER_MAX_MSGID];
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int host_send(uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(port);
+	to.sin_addr.s_addr = addr;
+	return sendto(fd, data, length, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+static void on_header(const FRAME_t *frame, void *arg)
+{
+	if (frame->msgid < FRAMER_MAX_MSGID) counts[frame->msgid]++;
+	gcs_header(frame);
+}
+
+static void on_frame(const FRAME_t *frame, void *arg)
+{
+	struct sockaddr_in *from = arg;
+	gcs_frame(from->sin_addr.s_addr, ntohs(from->sin_port), frame, 0);
+}
+
+static void print_rates(int screen)
+{
+	printf("screen=%d rates:", screen);
+	for (int msgid=0; msgid<FRAMER_MAX_MSGID; msgid++) {
+		if (counts[msgid] != 0) printf(" %d=%u", msgid, counts[msgid]);
+		counts[msgid] = 0;
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	int port = 14540;
+	int cycle = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:c:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			cycle = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-c seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	// Single sender, like one autopilot on the link
+	FRAMER_t framer;
+	FRAMER_CTX_t ctx;
+	framer_init(&framer);
+	framer_ctx_init(&ctx);
+	framer.header = on_header;
+	gcs_init(&framer, host_send);
+
+	int screen = 1;
+	gcs_screen(screen);
+	int64_t start = now_us();
+	int64_t lastPrint = start;
+	int64_t lastReport = start;
+	int64_t lastCycle = start;
+	bool input = true;
+	printf("listening on %d\n", port);
+
+	while(1) {
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		if (input) FD_SET(STDIN_FILENO, &readfds);
+		struct timeval timeout = { .tv_sec = 0, .tv_usec = GCS_POLL_MS * 1000 };
+		int ret = select(fd + 1, &readfds, NULL, NULL, &timeout);
+		if (ret < 0 && errno != EINTR) {
+			perror("select");
+			return 1;
+		}
+
+		if (ret > 0 && FD_ISSET(fd, &readfds)) {
+			uint8_t buffer[1500];
+			struct sockaddr_in from;
+			socklen_t fromLen = sizeof(from);
+			int len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLen);
+			if (len > 0) {
+				framer_scan(&framer, &ctx, buffer, len, on_frame, &from);
+				framer_end(&ctx);
+			}
+		}
+		if (ret > 0 && FD_ISSET(STDIN_FILENO, &readfds)) {
+			char line[32];
+			int s = 0;
+			// Keep running on a timer when stdin is closed
+			if (fgets(line, sizeof(line), stdin) == NULL) {
+				input = false;
+			} else {
+				s = atoi(line);
+			}
+			if (s >= 1 && s <= GCS_SCREENS) {
+				screen = s;
+				gcs_screen(screen);
+			}
+		}
+
+		int64_t now = now_us();
+		if (cycle > 0 && now - lastCycle >= cycle * 1000000LL) {
+			screen = screen % GCS_SCREENS + 1;
+			gcs_screen(screen);
+			lastCycle = now;
+		}
+		gcs_poll(now);
+		if (now - lastPrint >= 1000000) {
+			print_rates(screen);
+			lastPrint = now;
+		}
+		if (now - lastReport >= 10000000) {
+			gcs_report();
+			lastReport = now;
+		}
+	}
+	return 0;
+}
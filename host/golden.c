@@ -0,0 +1,84 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "panel.h"
+#include "golden.h"
+
+bool golden_read(const char *path, uint16_t *frame)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return false;
+	int width, height, max;
+	bool ok = (fscanf(fp, "P6 %d %d %d", &width, &height, &max) == 3)
+		&& width == PANEL_WIDTH && height == PANEL_HEIGHT && max == 255 && fgetc(fp) != EOF;
+	for (int i=0; ok && i<PANEL_WIDTH*PANEL_HEIGHT; i++) {
+		uint8_t rgb[3];
+		if (fread(rgb, sizeof(rgb), 1, fp) != 1) {
+			ok = false;
+			break;
+		}
+		// Exact, panel_write_ppm() expands RGB565 by repeating the high bits
+		frame[i] = ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+	}
+	fclose(fp);
+	return ok;
+}
+
+void golden_compare(const char *name, const uint16_t *expected, GOLDEN_DIFF_t *diff)
+{
+	memset(diff, 0, sizeof(*diff));
+	diff->x0 = PANEL_WIDTH;
+	diff->y0 = PANEL_HEIGHT;
+	for (int y=0; y<PANEL_HEIGHT; y++) {
+		for (int x=0; x<PANEL_WIDTH; x++) {
+			uint16_t want = expected[y * PANEL_WIDTH + x];
+			uint16_t got = panel_pixel(x, y);
+			if (want == got) continue;
+			if (diff->differ < GOLDEN_REPORT_PIXELS) {
+				printf("  %s: (%d,%d) expected %04x got %04x\n", name, x, y, want, got);
+			}
+			diff->differ++;
+			if (x < diff->x0) diff->x0 = x;
+			if (y < diff->y0) diff->y0 = y;
+			if (x > diff->x1) diff->x1 = x;
+			if (y > diff->y1) diff->y1 = y;
+		}
+	}
+	if (diff->differ) {
+		printf("  %s: %u pixels differ in (%d,%d)-(%d,%d)\n", name, diff->differ, diff->x0, diff->y0, diff->x1, diff->y1);
+	}
+}
+
+bool golden_write_diff(const char *path, const uint16_t *expected)
+{
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		perror(path);
+		return false;
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", PANEL_WIDTH, PANEL_HEIGHT);
+	for (int y=0; y<PANEL_HEIGHT; y++) {
+		uint8_t line[PANEL_WIDTH * 3];
+		for (int x=0; x<PANEL_WIDTH; x++) {
+			uint16_t got = panel_pixel(x, y);
+			if (got != expected[y * PANEL_WIDTH + x]) {
+				line[x*3+0] = 255;
+				line[x*3+1] = 0;
+				line[x*3+2] = 0;
+			} else {
+				line[x*3+0] = ((got >> 11) & 0x1f) << 1;
+				line[x*3+1] = ((got >> 5) & 0x3f);
+				line[x*3+2] = (got & 0x1f) << 1;
+			}
+		}
+		fwrite(line, sizeof(line), 1, fp);
+	}
+	return fclose(fp) == 0;
+}
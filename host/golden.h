@@ -0,0 +1,26 @@
+#ifndef HOST_GOLDEN_H_
+#define HOST_GOLDEN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Compare what the panel emulator shows with a stored golden image.
+// Golden images are binary PPM files like panel_write_ppm() writes.
+
+#define GOLDEN_REPORT_PIXELS	8	// Differing pixels listed in the report
+
+typedef struct {
+	uint32_t differ;			// Pixels that differ
+	int x0, y0, x1, y1;			// Box around them
+} GOLDEN_DIFF_t;
+
+// Read a PPM of the panel size into RGB565. false if it is missing or of another size.
+bool golden_read(const char *path, uint16_t *frame);
+
+// Compare the panel with frame. Prints a report of the differences.
+void golden_compare(const char *name, const uint16_t *expected, GOLDEN_DIFF_t *diff);
+
+// Differences in red over the dimmed panel
+bool golden_write_diff(const char *path, const uint16_t *expected);
+
+#endif /* HOST_GOLDEN_H_ */
@@ -0,0 +1,366 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// The TFT task of the firmware (main/m5stack.c) on a PC. It draws through the real
+// ILI9341 driver and fonts into the panel emulator, driven by a script of steps.
+//
+// hud_host [-s script] [-g golden_dir] [-o out_dir] [-u] [step...]
+// Steps are separated by white space, # starts a comment in a script file.
+//   stage=NAME         boot stage done (nvs, spiffs, display, wifi, ip, frame, telemetry)
+//   fail=NAME          boot stage failed
+//   link=down|connecting|up
+//   sysid=N            sysid of the next hud step (default 1)
+//   hud=A,G,ALT,C,H,T  VFR_HUD of airspeed, groundspeed, alt, climb, heading, throttle
+//   left middle right  short button presses, long-left long-middle long-right long presses
+//   wait=MS            let time pass. The Link Health and Latency screens refresh meanwhile.
+//   snap=FILE          write what the panel shows as PPM
+//   stats              SPI traffic since the last stats step, and per primitive since the start
+//   check=NAME         compare the panel with NAME.ppm of the golden directory. A difference
+//                      is reported pixel by pixel and NAME.ppm and NAME.diff.ppm go to out_dir.
+//   cost=BYTES         command and data bytes since the last cost step must not exceed BYTES
+// With -u, check steps write the golden images and cost steps print the bytes they saw.
+// The exit status is 1 when a check or cost step failed.
+// Time is emulated: it passes in wait steps and while the bus is busy.
+// The task starts with nvs and spiffs done unless the script starts with a stage or fail step.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "ili9340.h"
+#include "cmd.h"
+#include "boot.h"
+#include "wifi.h"
+#include "telemetry.h"
+#include "vehicle.h"
+#include "udp_receiver.h"
+#include "rtos.h"
+#include "panel.h"
+#include "golden.h"
+
+// Pins of main/m5stack.c
+#define DC_GPIO			27
+#define RESET_GPIO		33
+#define BL_GPIO			32
+
+#define MAX_STEPS		4096
+
+#ifndef GOLDEN_DIR
+#define GOLDEN_DIR		"golden"
+#endif
+
+static const char *TAG = "HUD_HOST";
+
+OS_QUEUE_t xQueueCmd;
+void tft(void *pvParameters);
+
+static char *steps[MAX_STEPS];
+static int stepCount = 0;
+static int next = 0;
+static int64_t waitUs = 0;
+static jmp_buf done;
+
+static const char *goldenDir = GOLDEN_DIR;
+static const char *outDir = ".";
+static bool update = false;
+static int failed = 0;
+static PANEL_STATS_t statsMark;
+static PANEL_STATS_t costMark;
+
+static int linkState = LINK_DOWN;
+static uint8_t sysid = 1;
+static uint8_t selected = VEHICLE_NONE;
+static TELEMETRY_t telemetry;
+
+// Stand-ins of the modules the TFT task reads
+
+int wifi_link_state(void)
+{
+	return linkState;
+}
+
+uint8_t vehicle_selected(void)
+{
+	return selected;
+}
+
+// One vehicle at a time in a script
+uint8_t vehicle_select_next(void)
+{
+	return selected;
+}
+
+// Telemetry comes from hud steps, not datagrams
+UDP_STATS_t udpStats;
+
+bool telemetry_get(TELEMETRY_t *out)
+{
+	if (selected == VEHICLE_NONE) return false;
+	memcpy(out, &telemetry, sizeof(TELEMETRY_t));
+	return true;
+}
+
+// Drawing takes the bus time of the device on the emulated clock
+void panel_busy(int64_t ns)
+{
+	rtos_advance_ns(ns);
+}
+
+// Script
+
+static void send(uint16_t command, uint16_t press, uint32_t msgid)
+{
+	CMD_t cmdBuf;
+	memset(&cmdBuf, 0, sizeof(cmdBuf));
+	cmdBuf.command = command;
+	cmdBuf.press = press;
+	cmdBuf.msgid = msgid;
+	cmdBuf.time = os_time_us();
+	cmdBuf.received = cmdBuf.time;
+	cmdBuf.queued = cmdBuf.time;
+	if (!os_queue_send(xQueueCmd, &cmdBuf, 0)) {
+		ESP_LOGW(TAG, "xQueueCmd full. command=%d dropped", command);
+	}
+}
+
+static int stage_number(const char *name)
+{
+	for (int stage=0; stage<BOOT_STAGE_MAX; stage++) {
+		if (strcmp(name, boot_stage_name(stage)) == 0) return stage;
+	}
+	return -1;
+}
+
+static void report_stats(void)
+{
+	PANEL_STATS_t s;
+	panel_stats(&s);
+	printf("transactions=%u command=%u data=%u pixels=%u clipped=%u ignored=%u bus=%lldus\n",
+		s.transactions - statsMark.transactions, s.commandBytes - statsMark.commandBytes,
+		s.dataBytes - statsMark.dataBytes, s.pixels - statsMark.pixels, s.clipped - statsMark.clipped,
+		s.ignored - statsMark.ignored, s.busTime - statsMark.busTime);
+	spi_stats_report();
+	statsMark = s;
+}
+
+static void check(const char *name)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s.ppm", goldenDir, name);
+	if (update) {
+		if (!panel_write_ppm(path)) exit(1);
+		printf("check %s written\n", name);
+		return;
+	}
+
+	static uint16_t expected[PANEL_WIDTH * PANEL_HEIGHT];
+	if (!golden_read(path, expected)) {
+		printf("check %s FAILED: no golden image %s\n", name, path);
+		failed++;
+		return;
+	}
+	GOLDEN_DIFF_t diff;
+	golden_compare(name, expected, &diff);
+	if (diff.differ == 0) {
+		printf("check %s ok\n", name);
+		return;
+	}
+	printf("check %s FAILED\n", name);
+	failed++;
+	snprintf(path, sizeof(path), "%s/%s.ppm", outDir, name);
+	panel_write_ppm(path);
+	snprintf(path, sizeof(path), "%s/%s.diff.ppm", outDir, name);
+	golden_write_diff(path, expected);
+}
+
+// A lower cost passes, so the recorded value is only updated on purpose
+static void cost(uint32_t limit)
+{
+	PANEL_STATS_t s;
+	panel_stats(&s);
+	uint32_t bytes = (s.commandBytes - costMark.commandBytes) + (s.dataBytes - costMark.dataBytes);
+	uint32_t transactions = s.transactions - costMark.transactions;
+	costMark = s;
+	if (update) {
+		printf("cost=%u transactions=%u\n", bytes, transactions);
+	} else if (bytes > limit) {
+		printf("cost FAILED: %u bytes, %u more than %u. transactions=%u\n", bytes, bytes - limit, limit, transactions);
+		failed++;
+	} else if (bytes < limit) {
+		printf("cost %u bytes, %u less than %u. transactions=%u\n", bytes, limit - bytes, limit, transactions);
+	} else {
+		printf("cost %u bytes ok. transactions=%u\n", bytes, transactions);
+	}
+}
+
+static void bad_step(const char *step)
+{
+	fprintf(stderr, "bad step: %s\n", step);
+	exit(1);
+}
+
+// Returns true when the step sent a command or set event bits
+static bool run_step(const char *step)
+{
+	const char *value = strchr(step, '=');
+	value = value ? value + 1 : "";
+
+	if (strncmp(step, "stage=", 6) == 0 || strncmp(step, "fail=", 5) == 0) {
+		int stage = stage_number(value);
+		if (stage < 0) bad_step(step);
+		if (step[0] == 's') {
+			boot_stage(stage);
+		} else {
+			boot_fail(stage);
+		}
+		return true;
+	} else if (strncmp(step, "link=", 5) == 0) {
+		if (strcmp(value, "down") == 0) {
+			linkState = LINK_DOWN;
+		} else if (strcmp(value, "connecting") == 0) {
+			linkState = LINK_CONNECTING;
+		} else if (strcmp(value, "up") == 0) {
+			linkState = LINK_UP;
+		} else {
+			bad_step(step);
+		}
+		send(CMD_STATUS, 0, 0);
+		return true;
+	} else if (strncmp(step, "sysid=", 6) == 0) {
+		sysid = atoi(value);
+		return false;
+	} else if (strncmp(step, "hud=", 4) == 0) {
+		mavlink_vfr_hud_t *hud = &telemetry.vfrHud;
+		int heading = hud->heading, throttle = hud->throttle;
+		if (sscanf(value, "%f,%f,%f,%f,%d,%d", &hud->airspeed, &hud->groundspeed, &hud->alt,
+			&hud->climb, &heading, &throttle) < 1) bad_step(step);
+		hud->heading = heading;
+		hud->throttle = throttle;
+		// The first vehicle seen is selected
+		if (selected == VEHICLE_NONE) selected = sysid;
+		send(CMD_MAVLINK, 0, MAVLINK_MSG_ID_VFR_HUD);
+		return true;
+	} else if (strncmp(step, "wait=", 5) == 0) {
+		waitUs = atoll(value) * 1000;
+		return false;
+	} else if (strncmp(step, "snap=", 5) == 0) {
+		if (!panel_write_ppm(value)) exit(1);
+		return false;
+	} else if (strcmp(step, "stats") == 0) {
+		report_stats();
+		return false;
+	} else if (strncmp(step, "check=", 6) == 0) {
+		check(value);
+		return false;
+	} else if (strncmp(step, "cost=", 5) == 0) {
+		cost(strtoul(value, NULL, 10));
+		return false;
+	}
+
+	bool isLong = (strncmp(step, "long-", 5) == 0);
+	const char *button = isLong ? step + 5 : step;
+	uint16_t press = isLong ? BUTTON_PRESS_LONG : BUTTON_PRESS_SHORT;
+	if (strcmp(button, "left") == 0) {
+		send(CMD_BUTTON_LEFT, press, 0);
+	} else if (strcmp(button, "middle") == 0) {
+		send(CMD_BUTTON_MIDDLE, press, 0);
+	} else if (strcmp(button, "right") == 0) {
+		send(CMD_BUTTON_RIGHT, press, 0);
+	} else {
+		bad_step(step);
+	}
+	return true;
+}
+
+// The TFT task waits. Run steps until one of them gives it something to do.
+bool rtos_block(int32_t waitMs)
+{
+	while (1) {
+		if (waitUs > 0) {
+			int64_t timeout = (waitMs == OS_WAIT_FOREVER) ? INT64_MAX : (int64_t)waitMs * 1000;
+			if (timeout < waitUs) {
+				rtos_advance_ns(timeout * 1000);
+				waitUs -= timeout;
+				return false;
+			}
+			rtos_advance_ns(waitUs * 1000);
+			waitUs = 0;
+			continue;
+		}
+		if (next == stepCount) longjmp(done, 1);
+		if (run_step(steps[next++])) return true;
+	}
+}
+
+static void read_script(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+		for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+			if (stepCount == MAX_STEPS) {
+				fprintf(stderr, "%s: more than %d steps\n", path, MAX_STEPS);
+				exit(1);
+			}
+			steps[stepCount++] = strdup(token);
+		}
+	}
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "s:g:o:u")) != -1) {
+		switch (opt) {
+		case 's':
+			read_script(optarg);
+			break;
+		case 'g':
+			goldenDir = optarg;
+			break;
+		case 'o':
+			outDir = optarg;
+			break;
+		case 'u':
+			update = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s script] [-g golden_dir] [-o out_dir] [-u] [step...]\n", argv[0]);
+			return 1;
+		}
+	}
+	for (int i=optind; i<argc && stepCount<MAX_STEPS; i++) steps[stepCount++] = argv[i];
+
+	boot_init();
+	xQueueCmd = os_queue_create(CMD_QUEUE_LENGTH, sizeof(CMD_t));
+	panel_init(DC_GPIO, RESET_GPIO, BL_GPIO);
+
+	// app_main has initialized NVS and mounted SPIFFS by the time the boot screen shows
+	bool bootSteps = (stepCount > 0) && (strncmp(steps[0], "stage=", 6) == 0 || strncmp(steps[0], "fail=", 5) == 0);
+	if (!bootSteps) {
+		rtos_advance_ns(30 * 1000 * 1000LL);
+		boot_stage(BOOT_STAGE_NVS);
+		rtos_advance_ns(90 * 1000 * 1000LL);
+		boot_stage(BOOT_STAGE_SPIFFS);
+	}
+
+	if (setjmp(done) == 0) tft(NULL);
+	report_stats();
+	if (failed) printf("%d steps FAILED\n", failed);
+	return failed ? 1 : 0;
+}
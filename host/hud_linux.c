@@ -0,0 +1,181 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// The whole receive, decode and render pipeline of the firmware on Linux.
+// The UDP and TFT tasks of main run as threads on the POSIX OS layer (os_posix.c)
+// and draw into the panel emulator, so the pipeline can be fed by mav_load or a
+// real autopilot and profiled with perf, valgrind or gprof on a workstation.
+//
+// hud_linux [-f] [-d seconds] [-s file]
+//   -f  draw as fast as the PC can. By default every SPI transaction takes
+//       the time it takes on the device.
+//   -d  stop after this many seconds (default 0, run until q or end of input)
+//   -s  write what the panel shows as PPM on exit
+// Buttons are read from stdin, one per line: l m r for short presses,
+// L M R for long presses, q to quit.
+// The receiver listens on CONFIG_UDP_PORT (14540) like the firmware, and
+// trace_json -u localhost fetches the trace ring from CONFIG_TRACE_PORT (14560).
+// Metrics packets go to metrics_collect on 127.0.0.1:14570.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "os.h"
+#include "cmd.h"
+#include "boot.h"
+#include "wifi.h"
+#include "udp_receiver.h"
+#include "trace.h"
+#include "metrics.h"
+#include "panel.h"
+
+// Pins of main/m5stack.c
+#define DC_GPIO			27
+#define RESET_GPIO		33
+#define BL_GPIO			32
+
+// Bus time is slept off in pieces of at least this
+#define BUSY_SLEEP_NS	(1000 * 1000)
+
+// Task topology of the menuconfig defaults. The OS layer ignores all but the name.
+#define UDP_STACK		4096
+#define UDP_PRIORITY	5
+#define UDP_CORE		0
+#define TFT_STACK		8192
+#define TFT_PRIORITY	3
+#define TFT_CORE		1
+#define TRACE_STACK		3072
+#define TRACE_PRIORITY	1
+#define TRACE_CORE		-1
+#define METRICS_STACK	4096
+#define METRICS_PRIORITY	1
+#define METRICS_CORE	-1
+
+static const char *TAG = "HUD_LINUX";
+
+OS_QUEUE_t xQueueCmd;
+void tft(void *pvParameters);
+
+static bool fast = false;
+static int64_t busyNs = 0;
+
+// The network is up while the PC has one
+
+int wifi_link_state(void)
+{
+	return LINK_UP;
+}
+
+int wifi_rssi(void)
+{
+	return 0;
+}
+
+void wifi_mac(uint8_t mac[6])
+{
+	memset(mac, 0, 6);
+}
+
+// Called by the TFT thread only
+void panel_busy(int64_t ns)
+{
+	if (fast) return;
+	busyNs += ns;
+	if (busyNs < BUSY_SLEEP_NS) return;
+	os_delay_ms(busyNs / 1000000);
+	busyNs %= 1000000;
+}
+
+static void send_press(uint16_t command, uint16_t press)
+{
+	CMD_t cmdBuf;
+	memset(&cmdBuf, 0, sizeof(cmdBuf));
+	cmdBuf.command = command;
+	cmdBuf.press = press;
+	cmdBuf.time = os_time_us();
+	cmdBuf.taskHandle = os_task_current();
+	if (!os_queue_send(xQueueCmd, &cmdBuf, 0)) {
+		ESP_LOGW(TAG, "xQueueCmd full. command=%d dropped", command);
+	}
+}
+
+// Returns on q or at the end of input
+static void buttons(void)
+{
+	char line[64];
+	while (fgets(line, sizeof(line), stdin)) {
+		switch (line[0]) {
+		case 'l': send_press(CMD_BUTTON_LEFT, BUTTON_PRESS_SHORT); break;
+		case 'm': send_press(CMD_BUTTON_MIDDLE, BUTTON_PRESS_SHORT); break;
+		case 'r': send_press(CMD_BUTTON_RIGHT, BUTTON_PRESS_SHORT); break;
+		case 'L': send_press(CMD_BUTTON_LEFT, BUTTON_PRESS_LONG); break;
+		case 'M': send_press(CMD_BUTTON_MIDDLE, BUTTON_PRESS_LONG); break;
+		case 'R': send_press(CMD_BUTTON_RIGHT, BUTTON_PRESS_LONG); break;
+		case 'q': return;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = 0;
+	const char *snap = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "fd:s:")) != -1) {
+		switch (opt) {
+		case 'f':
+			fast = true;
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			snap = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f] [-d seconds] [-s file]\n", argv[0]);
+			return 1;
+		}
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	boot_init();
+	xQueueCmd = os_queue_create(CMD_QUEUE_LENGTH, sizeof(CMD_t));
+	panel_init(DC_GPIO, RESET_GPIO, BL_GPIO);
+
+	// NVS, SPIFFS and the network are those of the PC
+	boot_stage(BOOT_STAGE_NVS);
+	boot_stage(BOOT_STAGE_SPIFFS);
+	boot_stage(BOOT_STAGE_WIFI);
+	boot_stage(BOOT_STAGE_IP);
+
+	if (!os_task_create(receiver, "UDP", UDP_STACK, UDP_PRIORITY, UDP_CORE, NULL) ||
+		!os_task_create(tft, "TFT", TFT_STACK, TFT_PRIORITY, TFT_CORE, NULL) ||
+		!os_task_create(trace, "TRACE", TRACE_STACK, TRACE_PRIORITY, TRACE_CORE, NULL) ||
+		!os_task_create(metrics, "METRICS", METRICS_STACK, METRICS_PRIORITY, METRICS_CORE, NULL)) {
+		ESP_LOGE(TAG, "Cannot start the tasks");
+		return 1;
+	}
+
+	if (seconds > 0) {
+		os_delay_ms(seconds * 1000);
+	} else {
+		buttons();
+	}
+
+	PANEL_STATS_t stats;
+	panel_stats(&stats);
+	printf("transactions=%u command=%u data=%u pixels=%u bus=%lldms datagrams=%u frames=%u\n",
+		stats.transactions, stats.commandBytes, stats.dataBytes, stats.pixels, (long long)stats.busTime / 1000,
+		udpStats.datagrams, udpStats.frames);
+	if (snap && !panel_write_ppm(snap)) return 1;
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_ESP_ERR_H_
+#define HOST_ESP_ERR_H_
+
+// Stand-in for esp_err.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK		0
+#define ESP_FAIL	-1
+
+#define ESP_ERROR_CHECK(x) do { \
+		esp_err_t err_ = (x); \
+		if (err_ != ESP_OK) { \
+			fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d\n", err_, __FILE__, __LINE__); \
+			abort(); \
+		} \
+	} while (0)
+
+#endif /* HOST_ESP_ERR_H_ */
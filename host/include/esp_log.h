@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+
+// Stand-in for esp_log.h, so portable sources of main build on a PC
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...)	printf("E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)	printf("W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)	printf("I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)	do { if (0) printf(format, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, format, ...)	do { if (0) printf(format, ##__VA_ARGS__); } while (0)
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buffer, length, level)	do { } while (0)
+
+#endif /* HOST_ESP_LOG_H_ */
@@ -0,0 +1,8 @@
+#ifndef HOST_ESP_SPIFFS_H_
+#define HOST_ESP_SPIFFS_H_
+
+// Stand-in for esp_spiffs.h. Fonts are read with fopen() from a directory of the PC.
+
+#include "esp_err.h"
+
+#endif /* HOST_ESP_SPIFFS_H_ */
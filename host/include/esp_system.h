@@ -0,0 +1,8 @@
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+// Stand-in for esp_system.h
+
+#include "esp_err.h"
+
+#endif /* HOST_ESP_SYSTEM_H_ */
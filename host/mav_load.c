@@ -0,0 +1,531 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Synthetic MAVLink load for the receive path of the HUD or receiver_host.
+// Each vehicle flies a climb, two circuits and a landing, and streams VFR_HUD,
+// ATTITUDE and GLOBAL_POSITION_INT from it, plus HIGHRES_IMU nobody uses as noise.
+//
+// mav_load [-t host:port] [-p port] [-r hz] [-v vehicles] [-n hz] [-g bytes]
+//          [-k frames] [-l loss] [-o reorder] [-d seconds] [-R factor] [-T seconds]
+//   -t  where to send (default 127.0.0.1:14540)
+//   -p  local UDP port (default 14580)
+//   -r  rate of each telemetry message per vehicle (default 10)
+//   -v  vehicles, sysid 1 to 8 (default 1)
+//   -n  rate of noise messages per vehicle (default 0)
+//   -g  random bytes in front of every datagram (default 0)
+//   -k  at most this many frames per datagram (default 1)
+//   -l  percentage of datagrams not sent (default 0)
+//   -o  percentage of datagrams sent after the next one (default 0)
+//   -d  stop after this many seconds (default 0, run forever)
+//   -R  ramp: multiply -r by this factor every -T seconds (default 5)
+//       until the receiver reports lost frames, then print the rate and stop
+// The HUD sends its receive counters in LINK_NODE_STATUS with its HEARTBEAT,
+// which needs CONFIG_MAVLINK_LINK_STATUS. Rate requests are answered with DENIED.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ardupilotmega/mavlink.h>
+
+#define MAX_VEHICLES	8
+#define DATAGRAM		1472
+#define DROP_THRESHOLD	1.0		// Percent lost above the simulated loss that counts as drops
+
+// Flight profile
+#define HOME_LAT		35.681236
+#define HOME_LON		139.767125
+#define HOME_ALT		40.0		// m above sea level
+#define CRUISE_ALT		60.0		// m above home
+#define CRUISE_SPEED	12.0		// m/s
+#define CIRCUIT_RADIUS	150.0		// m
+#define CLIMB_RATE		3.0			// m/s
+#define GROUND_TIME		10.0		// s on the ground before takeoff and after landing
+#define WIND_SPEED		3.0			// m/s from the north
+
+typedef enum {
+	STREAM_HEARTBEAT = 0,
+	STREAM_VFR_HUD,
+	STREAM_ATTITUDE,
+	STREAM_POSITION,
+	STREAM_NOISE,
+	STREAM_MAX,
+} STREAM_t;
+
+typedef struct {
+	uint8_t sysid;
+	uint8_t seq;				// Per vehicle, as a real autopilot counts
+	double offset;				// Seconds into the profile, so vehicles do not fly in formation
+	int64_t next[STREAM_MAX];
+} VEHICLE_t;
+
+typedef struct {
+	double north, east, up;		// m from home
+	double vn, ve, vu;			// m/s
+	double roll, pitch, yaw;	// rad
+	double yawRate;
+	double airspeed;
+	double throttle;			// Percent
+} STATE_t;
+
+static int fd;
+static struct sockaddr_in target;
+static VEHICLE_t vehicles[MAX_VEHICLES];
+static int numVehicles = 1;
+static int32_t interval[STREAM_MAX];	// Microseconds, 0 when off
+static int packing = 1;
+static int garbage = 0;
+static int loss = 0;
+static int reorder = 0;
+
+// Datagram being filled and one held back to be sent out of order
+static uint8_t datagram[DATAGRAM];
+static int datagramLen = 0;
+static int datagramFrames = 0;
+static uint8_t held[DATAGRAM];
+static int heldLen = 0;
+
+// Counters
+static uint32_t framesSent = 0;		// Put on the wire
+static uint32_t framesDropped = 0;	// Left out by -l
+static uint32_t framesLate = 0;		// Sent out of order by -o. The receiver counts the gap as lost.
+static uint32_t datagramsSent = 0;
+
+// Latest LINK_NODE_STATUS of the receiver
+static bool feedback = false;
+static uint32_t rxReceived = 0;
+static uint32_t rxLost = 0;
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Climb, two circuits against the wind, descent. Repeats.
+static void profile(double t, STATE_t *s)
+{
+	double climbTime = CRUISE_ALT / CLIMB_RATE;
+	double circuitTime = 2 * M_PI * CIRCUIT_RADIUS / CRUISE_SPEED;
+	double period = GROUND_TIME + climbTime + 2 * circuitTime + climbTime + GROUND_TIME;
+	t = fmod(t, period);
+	memset(s, 0, sizeof(STATE_t));
+
+	if (t < GROUND_TIME) return;
+	t -= GROUND_TIME;
+	if (t < climbTime) {
+		s->up = CLIMB_RATE * t;
+		s->vu = CLIMB_RATE;
+		s->pitch = 0.05;
+		s->throttle = 65;
+		return;
+	}
+	t -= climbTime;
+	if (t < 2 * circuitTime) {
+		// Starts at home heading north and turns right around a center to the east
+		double w = CRUISE_SPEED / CIRCUIT_RADIUS;
+		double a = w * t;
+		s->north = CIRCUIT_RADIUS * sin(a);
+		s->east = CIRCUIT_RADIUS * (1 - cos(a));
+		s->up = CRUISE_ALT + 5 * sin(a * 3);
+		s->vn = CRUISE_SPEED * cos(a);
+		s->ve = CRUISE_SPEED * sin(a);
+		s->vu = 15 * w * cos(a * 3);
+		s->yaw = a;
+		s->yawRate = w;
+		s->roll = atan(CRUISE_SPEED * CRUISE_SPEED / (CIRCUIT_RADIUS * 9.81));
+		s->pitch = 0.02 + s->vu / CRUISE_SPEED;
+		// Headwind on the northbound leg
+		s->airspeed = CRUISE_SPEED + WIND_SPEED * cos(a);
+		s->throttle = 50 + 10 * cos(a);
+		return;
+	}
+	t -= 2 * circuitTime;
+	if (t < climbTime) {
+		s->up = CRUISE_ALT - CLIMB_RATE * t;
+		s->vu = -CLIMB_RATE;
+		s->pitch = -0.03;
+		s->throttle = 35;
+	}
+}
+
+static void send_datagram(const uint8_t *data, int length)
+{
+	sendto(fd, data, length, 0, (struct sockaddr *)&target, sizeof(target));
+	datagramsSent++;
+}
+
+static void flush(void)
+{
+	if (datagramLen == 0) return;
+	if (loss > 0 && rand() % 100 < loss) {
+		framesDropped += datagramFrames;
+	} else if (heldLen > 0) {
+		send_datagram(datagram, datagramLen);
+		send_datagram(held, heldLen);
+		framesSent += datagramFrames;
+		heldLen = 0;
+	} else if (reorder > 0 && rand() % 100 < reorder) {
+		memcpy(held, datagram, datagramLen);
+		heldLen = datagramLen;
+		framesSent += datagramFrames;
+		framesLate += datagramFrames;
+	} else {
+		send_datagram(datagram, datagramLen);
+		framesSent += datagramFrames;
+	}
+	datagramLen = 0;
+	datagramFrames = 0;
+}
+
+static void add_frame(const mavlink_message_t *msg)
+{
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len = mavlink_msg_to_send_buffer(buf, msg);
+	if (datagramLen + len > DATAGRAM) flush();
+	if (datagramLen == 0) {
+		for (int i=0; i<garbage && datagramLen < DATAGRAM - len; i++) datagram[datagramLen++] = rand();
+	}
+	memcpy(&datagram[datagramLen], buf, len);
+	datagramLen += len;
+	if (++datagramFrames >= packing) flush();
+}
+
+static void send_stream(VEHICLE_t *v, STREAM_t stream, int64_t now)
+{
+	STATE_t s;
+	double t = now / 1e6 + v->offset;
+	profile(t, &s);
+	// Home of each vehicle 30 m further east
+	double north = s.north;
+	double east = s.east + (v->sysid - 1) * 30;
+	double vn = s.vn, ve = s.ve;
+	double heading = fmod(s.yaw * 180 / M_PI + 360, 360);
+
+	// The encoders take the sequence number of channel 0, so set it per vehicle
+	mavlink_get_channel_status(MAVLINK_COMM_0)->current_tx_seq = v->seq++;
+	mavlink_message_t msg;
+	switch (stream) {
+	case STREAM_HEARTBEAT: {
+		mavlink_heartbeat_t hb;
+		memset(&hb, 0, sizeof(hb));
+		hb.type = MAV_TYPE_QUADROTOR;
+		hb.autopilot = MAV_AUTOPILOT_PX4;
+		hb.system_status = MAV_STATE_ACTIVE;
+		hb.mavlink_version = 3;
+		mavlink_msg_heartbeat_encode(v->sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &hb);
+		break;
+	}
+	case STREAM_VFR_HUD: {
+		mavlink_vfr_hud_t hud;
+		memset(&hud, 0, sizeof(hud));
+		hud.airspeed = s.airspeed;
+		hud.groundspeed = sqrt(vn * vn + ve * ve);
+		hud.heading = heading;
+		hud.throttle = s.throttle;
+		hud.alt = HOME_ALT + s.up;
+		hud.climb = s.vu;
+		mavlink_msg_vfr_hud_encode(v->sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &hud);
+		break;
+	}
+	case STREAM_ATTITUDE: {
+		mavlink_attitude_t att;
+		memset(&att, 0, sizeof(att));
+		att.time_boot_ms = now / 1000;
+		att.roll = s.roll;
+		att.pitch = s.pitch;
+		att.yaw = atan2(sin(s.yaw), cos(s.yaw));
+		att.yawspeed = s.yawRate;
+		mavlink_msg_attitude_encode(v->sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &att);
+		break;
+	}
+	case STREAM_POSITION: {
+		mavlink_global_position_int_t pos;
+		memset(&pos, 0, sizeof(pos));
+		pos.time_boot_ms = now / 1000;
+		pos.lat = (HOME_LAT + north / 111320.0) * 1e7;
+		pos.lon = (HOME_LON + east / (111320.0 * cos(HOME_LAT * M_PI / 180))) * 1e7;
+		pos.alt = (HOME_ALT + s.up) * 1000;
+		pos.relative_alt = s.up * 1000;
+		pos.vx = vn * 100;
+		pos.vy = ve * 100;
+		pos.vz = -s.vu * 100;
+		pos.hdg = heading * 100;
+		mavlink_msg_global_position_int_encode(v->sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &pos);
+		break;
+	}
+	case STREAM_NOISE: {
+		mavlink_highres_imu_t imu;
+		memset(&imu, 0, sizeof(imu));
+		imu.time_usec = now;
+		imu.xacc = (rand() % 200 - 100) / 1000.0;
+		imu.yacc = (rand() % 200 - 100) / 1000.0;
+		imu.zacc = -9.81 + (rand() % 200 - 100) / 1000.0;
+		imu.abs_pressure = 1013.25 - s.up / 8.3;
+		imu.temperature = 25;
+		imu.fields_updated = 0xFFFF;
+		mavlink_msg_highres_imu_encode(v->sysid, MAV_COMP_ID_AUTOPILOT1, &msg, &imu);
+		break;
+	}
+	default:
+		return;
+	}
+	add_frame(&msg);
+}
+
+// Receiver counters, GCS HEARTBEATs and rate requests, which this tool does not follow
+static void handle(const mavlink_message_t *msg)
+{
+	static bool gcsSeen = false;
+	if (msg->msgid == MAVLINK_MSG_ID_HEARTBEAT) {
+		if (!gcsSeen) printf("GCS heartbeat sysid=%d compid=%d\n", msg->sysid, msg->compid);
+		gcsSeen = true;
+		return;
+	}
+	if (msg->msgid == MAVLINK_MSG_ID_LINK_NODE_STATUS) {
+		mavlink_link_node_status_t status;
+		mavlink_msg_link_node_status_decode(msg, &status);
+		rxReceived = status.messages_received;
+		rxLost = status.messages_lost;
+		feedback = true;
+		return;
+	}
+	if (msg->msgid != MAVLINK_MSG_ID_COMMAND_LONG) return;
+	mavlink_command_long_t cmd;
+	mavlink_msg_command_long_decode(msg, &cmd);
+	if (cmd.target_system < 1 || cmd.target_system > numVehicles) return;
+	mavlink_command_ack_t ack;
+	memset(&ack, 0, sizeof(ack));
+	ack.command = cmd.command;
+	ack.result = MAV_RESULT_DENIED;
+	ack.target_system = msg->sysid;
+	ack.target_component = msg->compid;
+	mavlink_message_t reply;
+	mavlink_msg_command_ack_encode(cmd.target_system, MAV_COMP_ID_AUTOPILOT1, &reply, &ack);
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len = mavlink_msg_to_send_buffer(buf, &reply);
+	sendto(fd, buf, len, 0, (struct sockaddr *)&target, sizeof(target));
+}
+
+static void set_rate(double hz, double noiseHz)
+{
+	interval[STREAM_HEARTBEAT] = 1000000;
+	interval[STREAM_VFR_HUD] = 1e6 / hz;
+	interval[STREAM_ATTITUDE] = 1e6 / hz;
+	interval[STREAM_POSITION] = 1e6 / hz;
+	interval[STREAM_NOISE] = (noiseHz > 0) ? 1e6 / noiseHz : 0;
+}
+
+// Messages per second on the link for the current intervals
+static double offered(void)
+{
+	double rate = 0;
+	for (int i=0; i<STREAM_MAX; i++) {
+		if (interval[i] > 0) rate += 1e6 / interval[i];
+	}
+	return rate * numVehicles;
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = "127.0.0.1";
+	int targetPort = 14540;
+	int port = 14580;
+	double hz = 10;
+	double noiseHz = 0;
+	int duration = 0;
+	double ramp = 0;
+	int step = 5;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:p:r:v:n:g:k:l:o:d:R:T:")) != -1) {
+		switch (opt) {
+		case 't': {
+			char *colon = strchr(optarg, ':');
+			if (colon != NULL) {
+				*colon = 0;
+				targetPort = atoi(colon + 1);
+			}
+			host = optarg;
+			break;
+		}
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			hz = atof(optarg);
+			break;
+		case 'v':
+			numVehicles = atoi(optarg);
+			break;
+		case 'n':
+			noiseHz = atof(optarg);
+			break;
+		case 'g':
+			garbage = atoi(optarg);
+			break;
+		case 'k':
+			packing = atoi(optarg);
+			break;
+		case 'l':
+			loss = atoi(optarg);
+			break;
+		case 'o':
+			reorder = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'R':
+			ramp = atof(optarg);
+			break;
+		case 'T':
+			step = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t host:port] [-p port] [-r hz] [-v vehicles] [-n hz] [-g bytes]\n"
+				"       [-k frames] [-l loss] [-o reorder] [-d seconds] [-R factor] [-T seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (numVehicles < 1 || numVehicles > MAX_VEHICLES || hz <= 0 || packing < 1 || step < 1 || (ramp != 0 && ramp <= 1)) {
+		fprintf(stderr, "-v 1 to %d, -r above 0, -k and -T at least 1, -R above 1\n", MAX_VEHICLES);
+		return 1;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	memset(&target, 0, sizeof(target));
+	target.sin_family = AF_INET;
+	target.sin_port = htons(targetPort);
+	if (inet_pton(AF_INET, host, &target.sin_addr) != 1) {
+		fprintf(stderr, "%s: not an IPv4 address\n", host);
+		return 1;
+	}
+
+	set_rate(hz, noiseHz);
+	int64_t start = now_us();
+	for (int i=0; i<numVehicles; i++) {
+		vehicles[i].sysid = i + 1;
+		vehicles[i].offset = i * 20;
+		for (int j=0; j<STREAM_MAX; j++) vehicles[i].next[j] = start;
+	}
+	printf("%d vehicles, %.0f msgs/s to %s:%d\n", numVehicles, offered(), host, targetPort);
+
+	mavlink_message_t msg;
+	mavlink_status_t status;
+	int64_t lastPrint = start;
+	int64_t stepStart = start;
+	uint32_t printSent = 0, printDatagrams = 0;
+	// Counters at the start of the ramp step
+	bool stepValid = false;
+	uint32_t stepReceived = 0, stepLost = 0, stepSent = 0, stepDropped = 0, stepLate = 0;
+	double cleanRate = 0;
+	while(1) {
+		int64_t now = now_us();
+		int64_t next = now + 100000;
+		for (int i=0; i<numVehicles; i++) {
+			VEHICLE_t *v = &vehicles[i];
+			for (int j=0; j<STREAM_MAX; j++) {
+				if (interval[j] == 0) continue;
+				if (now >= v->next[j]) {
+					send_stream(v, j, now);
+					v->next[j] += interval[j];
+					if (v->next[j] < now) v->next[j] = now + interval[j];
+				}
+				if (v->next[j] < next) next = v->next[j];
+			}
+		}
+		// Frames due together share datagrams up to -k, nothing waits for the next round
+		flush();
+
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		int64_t wait = next - now_us();
+		if (wait < 0) wait = 0;
+		struct timeval timeout = { .tv_sec = wait / 1000000, .tv_usec = wait % 1000000 };
+		int ret = select(fd + 1, &readfds, NULL, NULL, &timeout);
+		if (ret < 0 && errno != EINTR) {
+			perror("select");
+			return 1;
+		}
+		if (ret > 0) {
+			uint8_t buffer[1500];
+			int len = recv(fd, buffer, sizeof(buffer), 0);
+			for (int i=0; i<len; i++) {
+				if (mavlink_parse_char(MAVLINK_COMM_1, buffer[i], &msg, &status)) handle(&msg);
+			}
+		}
+
+		now = now_us();
+		if (now - lastPrint >= 1000000) {
+			printf("sent msgs/s=%u datagrams/s=%u", framesSent - printSent, datagramsSent - printDatagrams);
+			if (feedback) printf(" receiver received=%u lost=%u", rxReceived, rxLost);
+			printf("\n");
+			fflush(stdout);
+			printSent = framesSent;
+			printDatagrams = datagramsSent;
+			lastPrint = now;
+		}
+		if (duration > 0 && now - start >= duration * 1000000LL) break;
+
+		if (ramp > 0 && now - stepStart >= step * 1000000LL) {
+			if (!feedback) {
+				printf("no LINK_NODE_STATUS from the receiver. Enable CONFIG_MAVLINK_LINK_STATUS\n");
+			} else if (stepValid && (rxReceived < stepReceived || rxLost < stepLost)) {
+				// The counters only go down when the receiver restarted
+				printf("receiver restarted. Step %.0f msgs/s counted again\n", offered());
+			} else if (stepValid) {
+				uint32_t received = rxReceived - stepReceived;
+				uint32_t lost = rxLost - stepLost;
+				uint32_t sent = framesSent - stepSent;
+				uint32_t dropped = framesDropped - stepDropped;
+				uint32_t late = framesLate - stepLate;
+				double lostPercent = (received + lost) ? lost * 100.0 / (received + lost) : 0;
+				double simulated = (sent + dropped) ? (dropped + late) * 100.0 / (sent + dropped) : 0;
+				printf("step %.0f msgs/s: received=%u lost=%.2f%% (simulated %.2f%%)\n",
+					offered(), received, lostPercent, simulated);
+				if (received == 0 || lostPercent > simulated + DROP_THRESHOLD) {
+					printf("drops begin at %.0f msgs/s, last clean step %.0f msgs/s\n", offered(), cleanRate);
+					break;
+				}
+				cleanRate = offered();
+				hz *= ramp;
+				noiseHz *= ramp;
+				set_rate(hz, noiseHz);
+			}
+			// Counting for the new rate starts here. The counters lag by up to a second.
+			stepValid = feedback;
+			stepReceived = rxReceived;
+			stepLost = rxLost;
+			stepSent = framesSent;
+			stepDropped = framesDropped;
+			stepLate = framesLate;
+			stepStart = now;
+		}
+	}
+	flush();
+	if (heldLen > 0) send_datagram(held, heldLen);
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Collector of the metrics packets of any number of HUD units (CONFIG_METRICS).
+//
+// metrics_collect [-p port] [-c file] [-q]
+//   -p  UDP port to listen on (default 14570)
+//   -c  append every packet as a CSV row to file. The header goes into a new file.
+//   -q  do not print the packets
+// A unit is named by its MAC. A gap in its sequence numbers is reported as lost packets.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define DEFAULT_PORT	14570
+#define MAX_UNITS		64
+
+typedef struct {
+	uint8_t mac[6];
+	uint32_t sequence;
+	uint32_t packets;
+	uint32_t lost;
+} UNIT_t;
+
+static UNIT_t units[MAX_UNITS];
+static int unitCount = 0;
+
+// Packets are little endian like the ESP32
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+#define U32(p, field)	le32((p) + offsetof(METRICS_PACKET_t, field))
+#define U16(p, field)	le16((p) + offsetof(METRICS_PACKET_t, field))
+#define U8(p, field)	(p)[offsetof(METRICS_PACKET_t, field)]
+
+static UNIT_t *unit(const uint8_t *mac)
+{
+	for (int i=0; i<unitCount; i++) {
+		if (memcmp(units[i].mac, mac, 6) == 0) return &units[i];
+	}
+	if (unitCount == MAX_UNITS) return NULL;
+	UNIT_t *u = &units[unitCount++];
+	memcpy(u->mac, mac, 6);
+	return u;
+}
+
+// Percent, or - when the unit does not know it
+static const char *percent(uint8_t value, char *text)
+{
+	if (value == METRICS_UNKNOWN) return "-";
+	sprintf(text, "%u", value);
+	return text;
+}
+
+static const char *stack(uint16_t value, char *text)
+{
+	if (value == METRICS_NO_STACK) return "-";
+	sprintf(text, "%u", value);
+	return text;
+}
+
+static const char *csvHeader =
+	"time,addr,mac,sequence,lost_packets,uptime_ms,interval_ms,fps,messages,"
+	"latency_p50_us,latency_p95_us,latency_p99_us,latency_max_us,"
+	"datagrams,bad_crc,truncated,oversized,lost,heap_free,heap_min,rssi,link,spi,"
+	"idle0,idle1,cpu_udp,cpu_tft,cpu_button,stack_udp,stack_tft,stack_button\n";
+
+static void print(FILE *out, bool csv, const char *time, const char *addr, const char *mac, const UNIT_t *u, const uint8_t *p)
+{
+	char t[METRICS_CORES + 2 * METRICS_TASKS + 1][8];
+	const char *idle0 = percent(U8(p, idle[0]), t[0]);
+	const char *idle1 = percent(U8(p, idle[1]), t[1]);
+	const char *spi = percent(U8(p, spi), t[2]);
+	const char *cpu[METRICS_TASKS];
+	const char *stacks[METRICS_TASKS];
+	for (int task=0; task<METRICS_TASKS; task++) {
+		cpu[task] = percent(p[offsetof(METRICS_PACKET_t, cpu) + task], t[3 + task]);
+		stacks[task] = stack(le16(p + offsetof(METRICS_PACKET_t, stackFree) + task * 2), t[3 + METRICS_TASKS + task]);
+	}
+	double fps = U16(p, fps) / 10.0;
+	int rssi = (int8_t)U8(p, rssi);
+
+	if (csv) {
+		fprintf(out, "%s,%s,%s,%u,%u,%u,%u,%.1f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%d,%u,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+			time, addr, mac, U32(p, sequence), u->lost, U32(p, uptime), U16(p, interval), fps, U16(p, messages),
+			U32(p, latency[METRICS_P50]), U32(p, latency[METRICS_P95]), U32(p, latency[METRICS_P99]), U32(p, latency[METRICS_MAX]),
+			U32(p, datagrams), U32(p, badCrc), U32(p, truncated), U32(p, oversized), U32(p, lost),
+			U32(p, heapFree), U32(p, heapMin), rssi, U8(p, link), spi,
+			idle0, idle1, cpu[0], cpu[1], cpu[2], stacks[0], stacks[1], stacks[2]);
+		return;
+	}
+	fprintf(out, "%s %s %s #%u up=%us fps=%.1f msg=%u/s latency=%u/%u/%u/%uus rssi=%d heap=%u/%u "
+		"idle=%s/%s%% cpu=%s/%s/%s%% spi=%s%% stack=%s/%s/%s crc=%u trunc=%u over=%u lost=%u packets_lost=%u\n",
+		time, addr, mac, U32(p, sequence), U32(p, uptime) / 1000, fps, U16(p, messages),
+		U32(p, latency[METRICS_P50]), U32(p, latency[METRICS_P95]), U32(p, latency[METRICS_P99]), U32(p, latency[METRICS_MAX]),
+		rssi, U32(p, heapFree), U32(p, heapMin), idle0, idle1, cpu[0], cpu[1], cpu[2], spi,
+		stacks[0], stacks[1], stacks[2], U32(p, badCrc), U32(p, truncated), U32(p, oversized), U32(p, lost), u->lost);
+}
+
+int main(int argc, char **argv)
+{
+	int port = DEFAULT_PORT;
+	const char *csvName = NULL;
+	bool quiet = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:c:q")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			csvName = optarg;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-c file] [-q]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *csv = NULL;
+	if (csvName) {
+		csv = fopen(csvName, "a");
+		if (csv == NULL) {
+			perror(csvName);
+			return 1;
+		}
+		if (ftell(csv) == 0) fputs(csvHeader, csv);
+		fflush(csv);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	fprintf(stderr, "Listening on port %d\n", port);
+
+	uint8_t buffer[1500];
+	while (1) {
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		int n = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLen);
+		if (n < 0) {
+			perror("recvfrom");
+			return 1;
+		}
+		char source[32];
+		snprintf(source, sizeof(source), "%s:%u", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+		if (n < 8 || le32(buffer) != METRICS_MAGIC) {
+			fprintf(stderr, "%s: %d bytes that are not a metrics packet\n", source, n);
+			continue;
+		}
+		if (U16(buffer, version) != METRICS_VERSION || U16(buffer, size) != n || n != sizeof(METRICS_PACKET_t)) {
+			fprintf(stderr, "%s: version %u of %d bytes. This collector reads version %d of %zu bytes.\n",
+				source, U16(buffer, version), n, METRICS_VERSION, sizeof(METRICS_PACKET_t));
+			continue;
+		}
+
+		const uint8_t *m = buffer + offsetof(METRICS_PACKET_t, mac);
+		char mac[18];
+		sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+		UNIT_t *u = unit(m);
+		if (u == NULL) {
+			fprintf(stderr, "%s: more than %d units\n", source, MAX_UNITS);
+			continue;
+		}
+		// A sequence number that goes back is a restart of the unit
+		uint32_t sequence = U32(buffer, sequence);
+		if (u->packets != 0 && sequence > u->sequence + 1) u->lost += sequence - u->sequence - 1;
+		u->sequence = sequence;
+		u->packets++;
+
+		char now[32];
+		time_t t = time(NULL);
+		strftime(now, sizeof(now), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+		if (!quiet) print(stdout, false, now, source, mac, u, buffer);
+		if (csv) {
+			print(csv, true, now, source, mac, u, buffer);
+			fflush(csv);
+		}
+	}
+}
@@ -0,0 +1,434 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// OS layer of main/os.h on Linux: pthreads, CLOCK_MONOTONIC and BSD sockets.
+// Priorities and cores are ignored. Every task is a thread the kernel schedules.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "trace.h"
+
+static const char *TAG = "OS";
+
+struct OS_QUEUE {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint32_t length;
+	uint32_t size;
+	uint32_t count;
+	uint32_t head;
+	uint8_t *items;
+};
+
+struct OS_EVENT {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint32_t bits;
+};
+
+struct OS_TIMER {
+	timer_t id;
+	OS_TASK_FUNCTION_t function;
+	void *arg;
+	char name[16];
+};
+
+typedef struct {
+	OS_TASK_FUNCTION_t function;
+	void *arg;
+	char name[16];
+} TASK_START_t;
+
+static __thread const char *taskName = "main";
+
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+static int64_t start;
+
+static int64_t monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// One microsecond before the first call, so times are never 0
+static void start_clock(void)
+{
+	start = monotonic_us() - 1;
+}
+
+// Since the first call, like esp_timer_get_time() since boot
+int64_t os_time_us(void)
+{
+	pthread_once(&startOnce, start_clock);
+	return monotonic_us() - start;
+}
+
+void os_delay_ms(uint32_t ms)
+{
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+	TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_DELAY, ms);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+	TRACE(TRACE_WAIT_END, TRACE_WAIT_DELAY, 1);
+}
+
+// Nanoseconds of CLOCK_MONOTONIC. One clock for every thread, so one core.
+uint32_t os_cycles(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint32_t os_cycles_per_us(void)
+{
+	return 1000;
+}
+
+int os_core(void)
+{
+	return 0;
+}
+
+static void *task_start(void *arg)
+{
+	TASK_START_t task = *(TASK_START_t *)arg;
+	free(arg);
+	taskName = task.name;
+	pthread_setname_np(pthread_self(), task.name);
+	task.function(task.arg);
+	return NULL;
+}
+
+void *os_task_create(OS_TASK_FUNCTION_t function, const char *name, uint32_t stack, int priority, int core, void *arg)
+{
+	TASK_START_t *task = malloc(sizeof(TASK_START_t));
+	if (task == NULL) return NULL;
+	task->function = function;
+	task->arg = arg;
+	snprintf(task->name, sizeof(task->name), "%s", name);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, task_start, task) != 0) {
+		free(task);
+		return NULL;
+	}
+	pthread_detach(thread);
+	return (void *)thread;
+}
+
+void *os_task_current(void)
+{
+	return (void *)pthread_self();
+}
+
+const char *os_task_name(void)
+{
+	return taskName;
+}
+
+// Timed waits run on CLOCK_MONOTONIC, so a change of the wall clock does not move them
+static void cond_init(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// Absolute CLOCK_MONOTONIC deadline for pthread_cond_timedwait()
+static struct timespec deadline(int32_t waitMs)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += waitMs / 1000;
+	ts.tv_nsec += (waitMs % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return ts;
+}
+
+// Wait for a change until the deadline. False when it has passed.
+static bool wait_change(pthread_cond_t *changed, pthread_mutex_t *lock, int32_t waitMs, const struct timespec *until)
+{
+	if (waitMs == 0) return false;
+	if (waitMs == OS_WAIT_FOREVER) return pthread_cond_wait(changed, lock) == 0;
+	return pthread_cond_timedwait(changed, lock, until) != ETIMEDOUT;
+}
+
+OS_QUEUE_t os_queue_create(uint32_t length, uint32_t itemSize)
+{
+	OS_QUEUE_t q = calloc(1, sizeof(*q));
+	if (q == NULL) return NULL;
+	q->items = calloc(length, itemSize);
+	if (q->items == NULL) {
+		free(q);
+		return NULL;
+	}
+	pthread_mutex_init(&q->lock, NULL);
+	cond_init(&q->changed);
+	q->length = length;
+	q->size = itemSize;
+	return q;
+}
+
+// Trace records are written outside the queue lock, like on the device
+static bool queue_send(OS_QUEUE_t queue, const void *item, int32_t waitMs, uint32_t *count)
+{
+	struct timespec until = deadline(waitMs > 0 ? waitMs : 0);
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->length) {
+		if (!wait_change(&queue->changed, &queue->lock, waitMs, &until)) {
+			*count = queue->count;
+			pthread_mutex_unlock(&queue->lock);
+			return false;
+		}
+	}
+	uint32_t tail = (queue->head + queue->count) % queue->length;
+	memcpy(queue->items + tail * queue->size, item, queue->size);
+	queue->count++;
+	*count = queue->count;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+	return true;
+}
+
+bool os_queue_send(OS_QUEUE_t queue, const void *item, int32_t waitMs)
+{
+	uint32_t count;
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_QUEUE_SEND, waitMs);
+	bool sent = queue_send(queue, item, waitMs, &count);
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_QUEUE_SEND, sent);
+	TRACE(TRACE_QUEUE_SEND, sent, count);
+	return sent;
+}
+
+static bool queue_receive(OS_QUEUE_t queue, void *item, int32_t waitMs)
+{
+	struct timespec until = deadline(waitMs > 0 ? waitMs : 0);
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0) {
+		if (!wait_change(&queue->changed, &queue->lock, waitMs, &until)) {
+			pthread_mutex_unlock(&queue->lock);
+			return false;
+		}
+	}
+	memcpy(item, queue->items + queue->head * queue->size, queue->size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+	return true;
+}
+
+bool os_queue_receive(OS_QUEUE_t queue, void *item, int32_t waitMs)
+{
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_QUEUE_RECEIVE, waitMs);
+	bool received = queue_receive(queue, item, waitMs);
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_QUEUE_RECEIVE, received);
+	return received;
+}
+
+uint32_t os_queue_waiting(OS_QUEUE_t queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	uint32_t count = queue->count;
+	pthread_mutex_unlock(&queue->lock);
+	return count;
+}
+
+OS_EVENT_t os_event_create(void)
+{
+	OS_EVENT_t e = calloc(1, sizeof(*e));
+	if (e == NULL) return NULL;
+	pthread_mutex_init(&e->lock, NULL);
+	cond_init(&e->changed);
+	return e;
+}
+
+void os_event_set(OS_EVENT_t event, uint32_t bits)
+{
+	pthread_mutex_lock(&event->lock);
+	event->bits |= bits;
+	pthread_cond_broadcast(&event->changed);
+	pthread_mutex_unlock(&event->lock);
+}
+
+void os_event_clear(OS_EVENT_t event, uint32_t bits)
+{
+	pthread_mutex_lock(&event->lock);
+	event->bits &= ~bits;
+	pthread_mutex_unlock(&event->lock);
+}
+
+uint32_t os_event_get(OS_EVENT_t event)
+{
+	pthread_mutex_lock(&event->lock);
+	uint32_t bits = event->bits;
+	pthread_mutex_unlock(&event->lock);
+	return bits;
+}
+
+uint32_t os_event_wait(OS_EVENT_t event, uint32_t bits, int32_t waitMs)
+{
+	struct timespec until = deadline(waitMs > 0 ? waitMs : 0);
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_EVENT, waitMs);
+	pthread_mutex_lock(&event->lock);
+	while ((event->bits & bits) != bits) {
+		if (!wait_change(&event->changed, &event->lock, waitMs, &until)) break;
+	}
+	uint32_t result = event->bits;
+	pthread_mutex_unlock(&event->lock);
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_EVENT, (result & bits) == bits);
+	return result;
+}
+
+// Every expiry runs the function in a new thread, like a task of its own
+static void timer_notify(union sigval value)
+{
+	OS_TIMER_t timer = value.sival_ptr;
+	taskName = timer->name;
+	timer->function(timer->arg);
+}
+
+OS_TIMER_t os_timer_create(const char *name, OS_TASK_FUNCTION_t function, void *arg)
+{
+	OS_TIMER_t timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) return NULL;
+	timer->function = function;
+	timer->arg = arg;
+	snprintf(timer->name, sizeof(timer->name), "%s", name);
+	struct sigevent event = {
+		.sigev_notify = SIGEV_THREAD,
+		.sigev_notify_function = timer_notify,
+		.sigev_value.sival_ptr = timer,
+	};
+	if (timer_create(CLOCK_MONOTONIC, &event, &timer->id) != 0) {
+		ESP_LOGE(TAG, "timer_create %s errno=%d", name, errno);
+		free(timer);
+		return NULL;
+	}
+	return timer;
+}
+
+bool os_timer_start(OS_TIMER_t timer, uint32_t ms, bool periodic)
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = ms / 1000;
+	spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	// A zero it_value would disarm the timer
+	if (ms == 0) spec.it_value.tv_nsec = 1;
+	if (periodic) spec.it_interval = spec.it_value;
+	return timer_settime(timer->id, 0, &spec, NULL) == 0;
+}
+
+void os_timer_stop(OS_TIMER_t timer)
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	timer_settime(timer->id, 0, &spec, NULL);
+}
+
+// The kernel keeps no run time of threads in one place, and stacks grow
+bool os_stats(OS_STATS_t *out)
+{
+	return false;
+}
+
+// malloc takes what it needs from the kernel
+uint32_t os_heap_free(void)
+{
+	return 0;
+}
+
+uint32_t os_heap_min_free(void)
+{
+	return 0;
+}
+
+int os_udp_open(uint16_t port, int32_t timeoutMs)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) {
+		ESP_LOGE(TAG, "socket: %s", strerror(errno));
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ESP_LOGE(TAG, "bind port=%d: %s", port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (timeoutMs > 0) {
+		struct timeval timeout = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+			ESP_LOGE(TAG, "SO_RCVTIMEO: %s", strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+int os_udp_receive(int fd, uint8_t *buffer, int size, uint32_t *addr, uint16_t *port)
+{
+	struct sockaddr_in from;
+	socklen_t fromLen = sizeof(from);
+	TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_UDP, 0);
+	int ret = recvfrom(fd, buffer, size, 0, (struct sockaddr *)&from, &fromLen);
+	TRACE(TRACE_WAIT_END, TRACE_WAIT_UDP, ret >= 0);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return OS_UDP_TIMEOUT;
+		ESP_LOGW(TAG, "recvfrom: %s", strerror(errno));
+		return -1;
+	}
+	*addr = from.sin_addr.s_addr;
+	*port = ntohs(from.sin_port);
+	return ret;
+}
+
+int os_udp_send(int fd, uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(port);
+	to.sin_addr.s_addr = addr;
+	return sendto(fd, data, length, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+uint32_t os_udp_address(const char *text)
+{
+	struct in_addr addr;
+	if (!inet_aton(text, &addr)) return 0;
+	return addr.s_addr;
+}
+
+void os_udp_close(int fd)
+{
+	close(fd);
+}
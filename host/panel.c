@@ -0,0 +1,314 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// ILI9341 emulator, and the SPI and GPIO calls of main/ili9340.c on a PC.
+#include <stdio.h>
+#include <string.h>
+
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+
+#include "panel.h"
+
+// ILI9341 commands the emulator decodes
+#define CMD_SWRESET		0x01
+#define CMD_SLPIN		0x10
+#define CMD_SLPOUT		0x11
+#define CMD_INVOFF		0x20
+#define CMD_INVON		0x21
+#define CMD_DISPOFF		0x28
+#define CMD_DISPON		0x29
+#define CMD_CASET		0x2A
+#define CMD_PASET		0x2B
+#define CMD_RAMWR		0x2C
+#define CMD_VSCRDEF		0x33
+#define CMD_VSCRSADD	0x37
+#define CMD_RAMWRC		0x3C
+
+#define PARAMS			8
+
+static uint16_t gram[PANEL_HEIGHT][PANEL_WIDTH];
+static PANEL_STATS_t stats;
+
+// Pins
+static int dcPin = -1;
+static int resetPin = -1;
+static int blPin = -1;
+static int dc = 0;
+static bool backlight = true;
+
+// Command decoder
+static uint8_t command = 0;
+static uint8_t params[PARAMS];
+static int paramCount = 0;
+
+// Registers
+static uint16_t xs = 0, xe = PANEL_WIDTH-1, ys = 0, ye = PANEL_HEIGHT-1;
+static uint16_t tfa = 0, vsa = PANEL_HEIGHT, bfa = 0, vsp = 0;
+static bool sleeping = true;
+static bool displayOn = false;
+static bool inverted = false;
+
+// Memory write pointer. A pixel takes two data bytes, high byte first.
+static uint16_t wx = 0, wy = 0;
+static int highByte = -1;
+
+// Bus time
+static int64_t busNs = 0;
+static int clockHz = SPI_MASTER_FREQ_40M;
+
+static void reset_registers(void)
+{
+	command = 0;
+	paramCount = 0;
+	xs = 0; xe = PANEL_WIDTH-1; ys = 0; ye = PANEL_HEIGHT-1;
+	tfa = 0; vsa = PANEL_HEIGHT; bfa = 0; vsp = 0;
+	sleeping = true;
+	displayOn = false;
+	inverted = false;
+	wx = 0; wy = 0;
+	highByte = -1;
+}
+
+void panel_init(int dcGpio, int resetGpio, int blGpio)
+{
+	dcPin = dcGpio;
+	resetPin = resetGpio;
+	blPin = blGpio;
+	backlight = (blGpio < 0);
+	reset_registers();
+	memset(gram, 0, sizeof(gram));
+	memset(&stats, 0, sizeof(stats));
+	busNs = 0;
+}
+
+void panel_stats(PANEL_STATS_t *out)
+{
+	*out = stats;
+}
+
+void panel_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	busNs = 0;
+}
+
+static uint16_t word(int index)
+{
+	return (params[index] << 8) | params[index+1];
+}
+
+static void write_pixel(uint16_t color)
+{
+	if (wx < PANEL_WIDTH && wy < PANEL_HEIGHT) {
+		gram[wy][wx] = color;
+		stats.pixels++;
+	} else {
+		stats.clipped++;
+	}
+	// Column first, then page. The window wraps like the controller does.
+	if (wx < xe) {
+		wx++;
+	} else {
+		wx = xs;
+		wy = (wy < ye) ? wy + 1 : ys;
+	}
+}
+
+static void command_byte(uint8_t byte)
+{
+	command = byte;
+	paramCount = 0;
+	highByte = -1;
+	switch (command) {
+	case CMD_SWRESET:
+		reset_registers();
+		break;
+	case CMD_SLPIN:
+		sleeping = true;
+		break;
+	case CMD_SLPOUT:
+		sleeping = false;
+		break;
+	case CMD_INVOFF:
+		inverted = false;
+		break;
+	case CMD_INVON:
+		inverted = true;
+		break;
+	case CMD_DISPOFF:
+		displayOn = false;
+		break;
+	case CMD_DISPON:
+		displayOn = true;
+		break;
+	case CMD_RAMWR:
+		wx = xs;
+		wy = ys;
+		break;
+	case CMD_CASET:
+	case CMD_PASET:
+	case CMD_VSCRDEF:
+	case CMD_VSCRSADD:
+	case CMD_RAMWRC:
+		break;
+	default:
+		stats.ignored++;
+		break;
+	}
+}
+
+static void data_byte(uint8_t byte)
+{
+	if (command == CMD_RAMWR || command == CMD_RAMWRC) {
+		if (highByte < 0) {
+			highByte = byte;
+		} else {
+			write_pixel((highByte << 8) | byte);
+			highByte = -1;
+		}
+		return;
+	}
+	if (paramCount < PARAMS) params[paramCount] = byte;
+	paramCount++;
+	switch (command) {
+	case CMD_CASET:
+		if (paramCount == 4) {
+			xs = word(0);
+			xe = word(2);
+		}
+		break;
+	case CMD_PASET:
+		if (paramCount == 4) {
+			ys = word(0);
+			ye = word(2);
+		}
+		break;
+	case CMD_VSCRDEF:
+		if (paramCount == 6) {
+			tfa = word(0);
+			vsa = word(2);
+			bfa = word(4);
+		}
+		break;
+	case CMD_VSCRSADD:
+		if (paramCount == 2) vsp = word(0);
+		break;
+	}
+}
+
+uint16_t panel_pixel(int x, int y)
+{
+	if (x < 0 || x >= PANEL_WIDTH || y < 0 || y >= PANEL_HEIGHT) return 0;
+	if (!backlight || !displayOn || sleeping) return 0;
+
+	// Vertical scrolling runs along the page axis. The driver defines the area for
+	// the 320 lines of an upright ILI9341, so it is clipped to the lines there are.
+	int top = (tfa < PANEL_HEIGHT) ? tfa : PANEL_HEIGHT;
+	int area = vsa;
+	if (top + area > PANEL_HEIGHT - bfa) area = PANEL_HEIGHT - bfa - top;
+	int row = y;
+	if (area > 0 && y >= top && y < top + area) {
+		int start = (vsp >= top && vsp < top + area) ? vsp - top : 0;
+		row = top + (y - top + start) % area;
+	}
+	uint16_t color = gram[row][x];
+	return inverted ? ~color : color;
+}
+
+void panel_frame(uint16_t *out)
+{
+	for (int y=0; y<PANEL_HEIGHT; y++) {
+		for (int x=0; x<PANEL_WIDTH; x++) *out++ = panel_pixel(x, y);
+	}
+}
+
+// Binary PPM, RGB565 expanded to 8 bits per channel
+bool panel_write_ppm(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		perror(path);
+		return false;
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", PANEL_WIDTH, PANEL_HEIGHT);
+	for (int y=0; y<PANEL_HEIGHT; y++) {
+		uint8_t line[PANEL_WIDTH * 3];
+		for (int x=0; x<PANEL_WIDTH; x++) {
+			uint16_t color = panel_pixel(x, y);
+			uint8_t r = (color >> 11) & 0x1f;
+			uint8_t g = (color >> 5) & 0x3f;
+			uint8_t b = color & 0x1f;
+			line[x*3+0] = (r << 3) | (r >> 2);
+			line[x*3+1] = (g << 2) | (g >> 4);
+			line[x*3+2] = (b << 3) | (b >> 2);
+		}
+		fwrite(line, sizeof(line), 1, fp);
+	}
+	return fclose(fp) == 0;
+}
+
+// ESP-IDF calls of main/ili9340.c
+
+void gpio_pad_select_gpio(uint8_t gpio_num)
+{
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+	if (gpio_num == dcPin) dc = level;
+	if (gpio_num == blPin) backlight = level;
+	// Hardware reset while RESET is low
+	if (gpio_num == resetPin && level == 0) reset_registers();
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *bus_config, int dma_chan)
+{
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle)
+{
+	clockHz = dev_config->clock_speed_hz;
+	*handle = (spi_device_handle_t)&stats;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+	const uint8_t *tx = trans_desc->tx_buffer;
+	size_t bytes = trans_desc->length / 8;
+	for (size_t i=0; i<bytes; i++) {
+		if (dc) {
+			data_byte(tx[i]);
+		} else {
+			command_byte(tx[i]);
+		}
+	}
+	stats.transactions++;
+	if (dc) {
+		stats.dataBytes += bytes;
+	} else {
+		stats.commandBytes += bytes;
+	}
+	int64_t ns = (int64_t)trans_desc->length * 1000000000 / clockHz + PANEL_TRANSACTION_NS;
+	panel_busy(ns);
+	busNs += ns;
+	stats.busTime = busNs / 1000;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+	return spi_device_transmit(handle, trans_desc);
+}
@@ -0,0 +1,42 @@
+#ifndef HOST_PANEL_H_
+#define HOST_PANEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ILI9341 emulator behind the stand-ins of driver/spi_master.h and driver/gpio.h.
+// The command stream of main/ili9340.c is decoded into an emulated GRAM the way
+// the M5Stack addresses it: CASET is x 0 to 319, PASET is y 0 to 239.
+// Each transaction is reported to the tool with the time it takes on the bus,
+// so a tool can move an emulated clock or wait like the device would.
+
+#define PANEL_WIDTH			320
+#define PANEL_HEIGHT		240
+#define PANEL_TRANSACTION_NS	10000	// spi_device_transmit() besides the transfer, about this on the ESP32
+
+typedef struct {
+	uint32_t transactions;
+	uint32_t commandBytes;		// Sent with DC low
+	uint32_t dataBytes;			// Sent with DC high: parameters and pixels
+	uint32_t pixels;			// Pixels written into GRAM
+	uint32_t clipped;			// Pixels written outside GRAM
+	uint32_t ignored;			// Commands the emulator has no model for (power, gamma, ...)
+	int64_t busTime;			// Microseconds on the bus, overhead included
+} PANEL_STATS_t;
+
+// Provided by the tool. The bus was busy for ns.
+void panel_busy(int64_t ns);
+
+// Pins of the DC, RESET and backlight lines, as passed to spi_master_init(). -1 if not used.
+void panel_init(int dc, int reset, int bl);
+
+// Counters since panel_init() or the last panel_stats_reset()
+void panel_stats(PANEL_STATS_t *out);
+void panel_stats_reset(void);
+
+// What the glass shows: scrolling, inversion, display off and backlight applied. RGB565.
+uint16_t panel_pixel(int x, int y);
+void panel_frame(uint16_t *out);	// PANEL_WIDTH * PANEL_HEIGHT pixels, row by row
+bool panel_write_ppm(const char *path);
+
+#endif /* HOST_PANEL_H_ */
@@ -0,0 +1,179 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Receive path of the firmware on a PC: framer, link health and the ground station
+// side (main/framer.c, health.c, gcs.c). A target for mav_load without a device.
+//
+// receiver_host [-p port] [-b bytes] [-w us]
+//   -p  UDP port to listen on (default 14540)
+//   -b  socket receive buffer (default 5760, four datagrams like the lwIP mailbox)
+//   -w  extra work per datagram in microseconds, to stand in for a slower CPU
+// The receive counters go back to the sender in LINK_NODE_STATUS once a second.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ardupilotmega/mavlink.h>
+
+#include "framer.h"
+#include "health.h"
+#include "gcs.h"
+
+static int fd;
+static uint32_t frames;
+
+// Messages the HUD decodes
+static const uint32_t used[] = {
+	MAVLINK_MSG_ID_VFR_HUD,
+	MAVLINK_MSG_ID_ATTITUDE,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_SYS_STATUS,
+};
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int host_send(uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(port);
+	to.sin_addr.s_addr = addr;
+	return sendto(fd, data, length, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+static void on_header(const FRAME_t *frame, void *arg)
+{
+	health_frame(frame, arg);
+	gcs_header(frame);
+}
+
+static void on_frame(const FRAME_t *frame, void *arg)
+{
+	// The first vehicle stays selected, like the HUD without a button press
+	static uint8_t selected = 0;
+	if (selected == 0 && frame->msgid == MAVLINK_MSG_ID_HEARTBEAT && frame->compid == MAV_COMP_ID_AUTOPILOT1) {
+		selected = frame->sysid;
+	}
+	struct sockaddr_in *from = arg;
+	if (gcs_frame(from->sin_addr.s_addr, ntohs(from->sin_port), frame, selected)) return;
+	frames++;
+}
+
+int main(int argc, char **argv)
+{
+	int port = 14540;
+	int rcvbuf = 5760;
+	int work = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:b:w:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'b':
+			rcvbuf = atoi(optarg);
+			break;
+		case 'w':
+			work = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-b bytes] [-w us]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	// Linux doubles the value and has a minimum, so read back what we got
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	socklen_t optLen = sizeof(rcvbuf);
+	getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optLen);
+
+	// Single parser context, like one sender on the link
+	FRAMER_t framer;
+	FRAMER_CTX_t ctx;
+	framer_init(&framer);
+	framer_ctx_init(&ctx);
+	framer.header = on_header;
+	framer.badCrc = health_bad_crc;
+	for (int i=0; i<sizeof(used)/sizeof(used[0]); i++) {
+		const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(used[i]);
+		if (entry != NULL) framer_want(&framer, used[i], entry->crc_extra);
+	}
+	gcs_init(&framer, host_send);
+	gcs_screen(1);
+	printf("listening on %d rcvbuf=%d work=%dus\n", port, rcvbuf, work);
+
+	int64_t lastPoll = 0;
+	int64_t lastPrint = now_us();
+	uint32_t datagrams = 0;
+	while(1) {
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		struct timeval timeout = { .tv_sec = 0, .tv_usec = GCS_POLL_MS * 1000 };
+		int ret = select(fd + 1, &readfds, NULL, NULL, &timeout);
+		if (ret < 0 && errno != EINTR) {
+			perror("select");
+			return 1;
+		}
+
+		if (ret > 0) {
+			uint8_t buffer[1500];
+			struct sockaddr_in from;
+			socklen_t fromLen = sizeof(from);
+			int len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLen);
+			if (len > 0) {
+				int64_t start = now_us();
+				health_time(start);
+				framer_scan(&framer, &ctx, buffer, len, on_frame, &from);
+				framer_end(&ctx);
+				datagrams++;
+				while (now_us() - start < work);
+			}
+		}
+
+		int64_t now = now_us();
+		if (now - lastPoll >= GCS_POLL_MS * 1000) {
+			gcs_poll(now);
+			lastPoll = now;
+		}
+		if (now - lastPrint >= 1000000) {
+			uint32_t received, lost;
+			health_totals(&received, &lost);
+			printf("datagrams/s=%u frames/s=%u received=%u lost=%u bad_crc=%u garbage=%u\n",
+				datagrams, frames, received, lost, ctx.stats.badCrc, ctx.stats.garbage);
+			fflush(stdout);
+			datagrams = 0;
+			frames = 0;
+			lastPrint = now;
+		}
+	}
+	return 0;
+}
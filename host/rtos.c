@@ -0,0 +1,255 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// OS layer of main/os.h for one task on a PC, with an emulated clock
+#include <stdlib.h>
+#include <string.h>
+
+#include "os.h"
+#include "rtos.h"
+
+struct OS_QUEUE {
+	uint32_t length;
+	uint32_t size;
+	uint32_t count;
+	uint32_t head;
+	uint8_t *items;
+};
+
+struct OS_EVENT {
+	uint32_t bits;
+};
+
+struct OS_TIMER {
+	OS_TASK_FUNCTION_t function;
+	void *arg;
+	int64_t due;		// Emulated ns, or -1 while stopped
+	int64_t period;		// 0 for one-shot
+	struct OS_TIMER *next;
+};
+
+static int64_t nowNs = 0;
+static struct OS_TIMER *timers = NULL;
+
+int64_t rtos_now_ns(void)
+{
+	return nowNs;
+}
+
+static struct OS_TIMER *next_due(int64_t until)
+{
+	struct OS_TIMER *first = NULL;
+	for (struct OS_TIMER *t = timers; t != NULL; t = t->next) {
+		if (t->due >= 0 && t->due <= until && (first == NULL || t->due < first->due)) first = t;
+	}
+	return first;
+}
+
+// Timers that fall due on the way run at their own time, as if their task
+// had preempted the emulated one
+void rtos_advance_ns(int64_t ns)
+{
+	static bool firing = false;
+	int64_t until = nowNs + ns;
+	struct OS_TIMER *t;
+	while (!firing && (t = next_due(until)) != NULL) {
+		nowNs = t->due;
+		t->due = (t->period > 0) ? t->due + t->period : -1;
+		firing = true;
+		t->function(t->arg);
+		firing = false;
+	}
+	if (until > nowNs) nowNs = until;
+}
+
+// Rounded up to whole ticks like the firmware
+static int32_t tick_ms(int32_t ms)
+{
+	if (ms < 0) return OS_WAIT_FOREVER;
+	return (ms + RTOS_TICK_MS - 1) / RTOS_TICK_MS * RTOS_TICK_MS;
+}
+
+int64_t os_time_us(void)
+{
+	return nowNs / 1000;
+}
+
+void os_delay_ms(uint32_t ms)
+{
+	rtos_advance_ns((int64_t)tick_ms(ms) * 1000 * 1000);
+}
+
+// Emulated nanoseconds
+uint32_t os_cycles(void)
+{
+	return nowNs;
+}
+
+uint32_t os_cycles_per_us(void)
+{
+	return 1000;
+}
+
+int os_core(void)
+{
+	return 0;
+}
+
+// There is only the task the tool runs
+void *os_task_create(OS_TASK_FUNCTION_t function, const char *name, uint32_t stack, int priority, int core, void *arg)
+{
+	return NULL;
+}
+
+void *os_task_current(void)
+{
+	return NULL;
+}
+
+const char *os_task_name(void)
+{
+	return "host";
+}
+
+OS_QUEUE_t os_queue_create(uint32_t length, uint32_t itemSize)
+{
+	OS_QUEUE_t q = calloc(1, sizeof(*q));
+	if (q == NULL) return NULL;
+	q->length = length;
+	q->size = itemSize;
+	q->items = calloc(length, itemSize);
+	if (q->items == NULL) {
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+// No other task empties the queue, so a full queue stays full
+bool os_queue_send(OS_QUEUE_t queue, const void *item, int32_t waitMs)
+{
+	if (queue->count == queue->length) {
+		if (waitMs != OS_WAIT_FOREVER) os_delay_ms(waitMs);
+		return false;
+	}
+	uint32_t tail = (queue->head + queue->count) % queue->length;
+	memcpy(queue->items + tail * queue->size, item, queue->size);
+	queue->count++;
+	return true;
+}
+
+bool os_queue_receive(OS_QUEUE_t queue, void *item, int32_t waitMs)
+{
+	while (queue->count == 0) {
+		if (!rtos_block(tick_ms(waitMs)) && queue->count == 0 && waitMs != OS_WAIT_FOREVER) return false;
+	}
+	memcpy(item, queue->items + queue->head * queue->size, queue->size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	return true;
+}
+
+uint32_t os_queue_waiting(OS_QUEUE_t queue)
+{
+	return queue->count;
+}
+
+OS_EVENT_t os_event_create(void)
+{
+	return calloc(1, sizeof(struct OS_EVENT));
+}
+
+void os_event_set(OS_EVENT_t event, uint32_t bits)
+{
+	event->bits |= bits;
+}
+
+void os_event_clear(OS_EVENT_t event, uint32_t bits)
+{
+	event->bits &= ~bits;
+}
+
+uint32_t os_event_get(OS_EVENT_t event)
+{
+	return event->bits;
+}
+
+uint32_t os_event_wait(OS_EVENT_t event, uint32_t bits, int32_t waitMs)
+{
+	while ((event->bits & bits) != bits) {
+		if (!rtos_block(tick_ms(waitMs)) && waitMs != OS_WAIT_FOREVER) break;
+	}
+	return event->bits;
+}
+
+// Nothing to receive from
+int os_udp_open(uint16_t port, int32_t timeoutMs)
+{
+	return -1;
+}
+
+int os_udp_receive(int fd, uint8_t *buffer, int size, uint32_t *addr, uint16_t *port)
+{
+	return -1;
+}
+
+int os_udp_send(int fd, uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	return -1;
+}
+
+uint32_t os_udp_address(const char *text)
+{
+	return 0;
+}
+
+void os_udp_close(int fd)
+{
+}
+
+OS_TIMER_t os_timer_create(const char *name, OS_TASK_FUNCTION_t function, void *arg)
+{
+	OS_TIMER_t timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) return NULL;
+	timer->function = function;
+	timer->arg = arg;
+	timer->due = -1;
+	timer->next = timers;
+	timers = timer;
+	return timer;
+}
+
+bool os_timer_start(OS_TIMER_t timer, uint32_t ms, bool periodic)
+{
+	int64_t ns = (int64_t)ms * 1000 * 1000;
+	// A period of 0 would fire forever at one instant
+	if (ns == 0) ns = 1;
+	timer->due = nowNs + ns;
+	timer->period = periodic ? ns : 0;
+	return true;
+}
+
+void os_timer_stop(OS_TIMER_t timer)
+{
+	timer->due = -1;
+}
+
+// The emulated task has no run time of its own
+bool os_stats(OS_STATS_t *out)
+{
+	return false;
+}
+
+uint32_t os_heap_free(void)
+{
+	return 0;
+}
+
+uint32_t os_heap_min_free(void)
+{
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_RTOS_H_
+#define HOST_RTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "os.h"
+
+// OS layer (main/os.h) for host tools that run one task of main.
+// Nothing runs beside the task, so where it would block the tool is asked
+// to make something happen, and time is an emulated clock that only moves
+// when the task waits or the panel emulator is busy.
+// Waits are whole ticks of the firmware (CONFIG_FREERTOS_HZ=100).
+
+#define RTOS_TICK_MS	10
+
+// Provided by the tool. Called when the task would block for up to waitMs.
+// Send to a queue or set event bits and return true, or let the time pass and return false.
+// A tool ends the task from here, e.g. with longjmp() when its script is over.
+bool rtos_block(int32_t waitMs);
+
+int64_t rtos_now_ns(void);
+void rtos_advance_ns(int64_t ns);
+
+#endif /* HOST_RTOS_H_ */
@@ -0,0 +1,164 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Turn a dump of the tlog partition into a tlog file.
+//
+// tlog_extract [-l] [-s session] partition.bin [out.tlog]
+//   -l  list the sessions in the dump
+//   -s  session to extract (default the newest)
+// The output defaults to session-<n>.tlog. Read the partition with
+//   parttool.py read_partition --partition-name tlog --output partition.bin
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "recorder.h"
+
+typedef struct {
+	uint32_t session;
+	uint32_t seq;
+	long offset;
+	uint16_t used;
+} BLOCK_t;
+
+static int compare(const void *a, const void *b)
+{
+	const BLOCK_t *x = a, *y = b;
+	if (x->session != y->session) return x->session < y->session ? -1 : 1;
+	if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+	return 0;
+}
+
+static uint64_t timestamp(const uint8_t *p)
+{
+	uint64_t t = 0;
+	for (int i=0; i<8; i++) t = (t << 8) | p[i];
+	return t;
+}
+
+int main(int argc, char **argv)
+{
+	int list = 0;
+	long wanted = -1;
+	int opt;
+	while ((opt = getopt(argc, argv, "ls:")) != -1) {
+		switch (opt) {
+		case 'l':
+			list = 1;
+			break;
+		case 's':
+			wanted = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l] [-s session] partition.bin [out.tlog]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-l] [-s session] partition.bin [out.tlog]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *image = malloc(size);
+	if (image == NULL || size < 0 || fread(image, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", argv[optind]);
+		return 1;
+	}
+	fclose(fp);
+
+	int numBlocks = 0;
+	BLOCK_t *blocks = malloc(sizeof(BLOCK_t) * (size / RECORDER_BLOCK + 1));
+	for (long offset=0; offset + RECORDER_BLOCK <= size; offset += RECORDER_BLOCK) {
+		RECORDER_BLOCK_t header;
+		memcpy(&header, &image[offset], sizeof(header));
+		if (header.magic != RECORDER_MAGIC || header.used > RECORDER_DATA) continue;
+		blocks[numBlocks].session = header.session;
+		blocks[numBlocks].seq = header.seq;
+		blocks[numBlocks].offset = offset;
+		blocks[numBlocks].used = header.used;
+		numBlocks++;
+	}
+	if (numBlocks == 0) {
+		fprintf(stderr, "%s: no recording\n", argv[optind]);
+		return 1;
+	}
+	qsort(blocks, numBlocks, sizeof(BLOCK_t), compare);
+
+	if (list) {
+		for (int i=0; i<numBlocks; ) {
+			int j = i;
+			long bytes = 0;
+			while (j < numBlocks && blocks[j].session == blocks[i].session) bytes += blocks[j++].used;
+			// Blocks of an older session may have been reused by a newer one
+			uint32_t missing = blocks[j-1].seq + 1 - (j - i);
+			printf("session %u blocks=%d bytes=%ld missing=%u\n", blocks[i].session, j - i, bytes, missing);
+			i = j;
+		}
+		return 0;
+	}
+
+	uint32_t session = (wanted < 0) ? blocks[numBlocks-1].session : wanted;
+	int found = 0;
+	for (int i=0; i<numBlocks; i++) {
+		if (blocks[i].session == session) found++;
+	}
+	if (found == 0) {
+		fprintf(stderr, "session %u not found\n", session);
+		return 1;
+	}
+
+	char name[32];
+	const char *out = (optind + 1 < argc) ? argv[optind+1] : name;
+	snprintf(name, sizeof(name), "session-%u.tlog", session);
+	FILE *op = fopen(out, "wb");
+	if (op == NULL) {
+		perror(out);
+		return 1;
+	}
+
+	// Every block holds whole records, so a gap only loses the records in the lost blocks
+	long records = 0, bytes = 0;
+	uint64_t first = 0, last = 0;
+	int32_t expected = -1;
+	for (int i=0; i<numBlocks; i++) {
+		if (blocks[i].session != session) continue;
+		if (expected >= 0 && blocks[i].seq != (uint32_t)expected) {
+			fprintf(stderr, "blocks %d to %u missing\n", expected, blocks[i].seq - 1);
+		}
+		expected = blocks[i].seq + 1;
+		const uint8_t *data = &image[blocks[i].offset + sizeof(RECORDER_BLOCK_t)];
+		for (int pos=0; pos + 8 < blocks[i].used; ) {
+			const uint8_t *frame = &data[pos + 8];
+			int length;
+			if (frame[0] == FRAMER_STX_V2) {
+				length = FRAMER_HEADER_V2 + frame[1] + 2 + ((frame[2] & 0x01) ? FRAMER_SIGNATURE : 0);
+			} else {
+				length = FRAMER_HEADER_V1 + frame[1] + 2;
+			}
+			if (first == 0) first = timestamp(&data[pos]);
+			last = timestamp(&data[pos]);
+			pos += 8 + length;
+			records++;
+		}
+		fwrite(data, 1, blocks[i].used, op);
+		bytes += blocks[i].used;
+	}
+	fclose(op);
+	printf("session %u: %ld records, %ld bytes, %.1f s -> %s\n", session, records, bytes, (last - first) / 1e6, out);
+	free(blocks);
+	free(image);
+	return 0;
+}
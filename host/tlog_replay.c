@@ -0,0 +1,191 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Replay a tlog, or a dump of the tlog partition, with the firmware replay code.
+//
+// tlog_replay [-s speed] [-j seconds] [-u host:port] [-m msgid,...] [-i] file
+//   -s  1 is real time, 10 ten times faster, 0 as fast as possible
+//       (default 1 with -u, else 0)
+//   -j  start this many seconds into the recording
+//   -u  send the frames as datagrams to the HUD instead of parsing them here
+//   -m  message IDs to parse here (default 74 = VFR_HUD)
+//   -i  print the seek index
+// Frames due together go out in one datagram of up to 1472 bytes, like on the device.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <ardupilotmega/mavlink.h>
+
+#include "framer.h"
+#include "replay.h"
+
+#define DATAGRAM	1472
+#define MAX_WANTED	32
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool file_read(void *ctx, uint32_t offset, void *out, uint32_t length)
+{
+	FILE *fp = ctx;
+	if (fseek(fp, offset, SEEK_SET) != 0) return false;
+	return fread(out, 1, length, fp) == length;
+}
+
+static uint32_t parsed;
+
+static void on_frame(const FRAME_t *frame, void *arg)
+{
+	parsed++;
+}
+
+int main(int argc, char **argv)
+{
+	double speed = -1;
+	double jump = 0;
+	char *target = NULL;
+	bool index = false;
+	uint32_t wanted[MAX_WANTED];
+	int numWanted = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:j:u:m:i")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'j':
+			jump = atof(optarg);
+			break;
+		case 'u':
+			target = optarg;
+			break;
+		case 'm':
+			for (char *tok = strtok(optarg, ","); tok && numWanted < MAX_WANTED; tok = strtok(NULL, ",")) {
+				wanted[numWanted++] = atoi(tok);
+			}
+			break;
+		case 'i':
+			index = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s speed] [-j seconds] [-u host:port] [-m msgid,...] [-i] file\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-s speed] [-j seconds] [-u host:port] [-m msgid,...] [-i] file\n", argv[0]);
+		return 1;
+	}
+	if (speed < 0) speed = target ? 1 : 0;
+	if (numWanted == 0) wanted[numWanted++] = MAVLINK_MSG_ID_VFR_HUD;
+
+	FILE *fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+
+	static REPLAY_t replay;
+	if (!replay_open(&replay, file_read, fp, size)) return 1;
+	if (index) {
+		for (int i=0; i<replay.numMarks; i++) {
+			printf("%8.1f s  pos 0x%08x\n", (replay.marks[i].stamp - replay.first) / 1e6, replay.marks[i].pos);
+		}
+	}
+	replay.speed = speed * 100;
+	replay_seek(&replay, jump * 1e6);
+
+	// Either a socket to the HUD or the framer of the firmware
+	int fd = -1;
+	struct sockaddr_in to;
+	FRAMER_t framer;
+	FRAMER_CTX_t ctx;
+	if (target) {
+		char *colon = strrchr(target, ':');
+		struct hostent *host = NULL;
+		if (colon) {
+			*colon = '\0';
+			host = gethostbyname(target);
+		}
+		if (host == NULL) {
+			fprintf(stderr, "-u %s: expected host:port\n", target);
+			return 1;
+		}
+		memset(&to, 0, sizeof(to));
+		to.sin_family = AF_INET;
+		to.sin_port = htons(atoi(colon + 1));
+		memcpy(&to.sin_addr, host->h_addr_list[0], sizeof(to.sin_addr));
+		fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	} else {
+		framer_init(&framer);
+		framer_ctx_init(&ctx);
+		for (int i=0; i<numWanted; i++) {
+			const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(wanted[i]);
+			if (entry == NULL || !framer_want(&framer, wanted[i], entry->crc_extra)) {
+				fprintf(stderr, "msgid %u not supported\n", wanted[i]);
+				return 1;
+			}
+		}
+	}
+
+	uint8_t buffer[DATAGRAM];
+	uint8_t frame[FRAMER_MAX_FRAME];
+	int length = 0;
+	uint32_t frames = 0, datagrams = 0;
+	int64_t busy = 0;
+	int64_t start = now_us();
+	int64_t mark = start;
+	while (1) {
+		uint64_t stamp;
+		int n = replay_next(&replay, frame, &stamp);
+		int64_t wait = (n > 0) ? replay_wait(&replay, stamp, now_us()) : 0;
+		if (length > 0 && (n == 0 || wait > 0 || length + n > DATAGRAM)) {
+			int64_t t = now_us();
+			if (target) {
+				sendto(fd, buffer, length, 0, (struct sockaddr *)&to, sizeof(to));
+			} else {
+				framer_scan(&framer, &ctx, buffer, length, on_frame, NULL);
+			}
+			busy += now_us() - t;
+			datagrams++;
+			length = 0;
+		}
+		if (n == 0) break;
+		if (wait > 0) usleep(wait);
+		memcpy(&buffer[length], frame, n);
+		length += n;
+		frames++;
+
+		if (speed != 0 && now_us() - mark >= 1000000) {
+			mark = now_us();
+			printf("at %.1f s frames=%u\n", (stamp - replay.first) / 1e6, frames);
+			fflush(stdout);
+		}
+	}
+
+	double elapsed = (now_us() - start) / 1e6;
+	printf("frames=%u datagrams=%u in %.3f s, %.0f frames/s\n", frames, datagrams, elapsed, frames / elapsed);
+	if (!target) {
+		printf("framer   %.1f ns/msg parsed=%u skipped=%u bad_crc=%u garbage=%u\n",
+			busy * 1e3 / (frames ? frames : 1), parsed, ctx.stats.skipped, ctx.stats.badCrc, ctx.stats.garbage);
+	}
+	replay_close(&replay);
+	fclose(fp);
+	return 0;
+}
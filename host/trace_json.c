@@ -0,0 +1,326 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Trace ring of the firmware (CONFIG_TRACE) to Chrome trace JSON, for
+// chrome://tracing or ui.perfetto.dev. Every task is a track.
+//
+// trace_json [-u host[:port]] [-o file] [file]
+//   -u  ask the TRACE task of host for its ring (default port 14560)
+//   -o  write the JSON to file instead of stdout
+// Without -u the hex dump of a captured monitor log is read from file or stdin,
+// e.g. after a latency trigger. The last dump in the log is converted.
+// The cycles of each core are turned into microseconds with the TRACE_SYNC
+// records of that core, so the two cores share one time line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "trace.h"
+#include "ili9340.h"
+
+#define DEFAULT_PORT	"14560"
+#define MAX_DUMP		(sizeof(TRACE_HEADER_t) + TRACE_TASKS * TRACE_NAME + 65536 * sizeof(TRACE_RECORD_t))
+#define FETCH_TIMEOUT_S	3
+#define CORES			2
+
+// In the order of SPI_PRIM_t
+static const char *primNames[] = {
+	"other", "pixel", "multipixels", "fillrect", "fillscreen", "line", "rect", "rectangle",
+	"triangle", "circle", "fillcircle", "roundrect", "arrow", "fillarrow", "char", "string",
+};
+_Static_assert(sizeof(primNames)/sizeof(primNames[0]) == SPI_PRIMS, "primNames must follow SPI_PRIM_t");
+
+static const char *waitNames[TRACE_WAITS] = {
+	"wait delay", "wait queue send", "wait queue receive", "wait event", "wait udp",
+};
+
+static uint8_t dump[MAX_DUMP];
+static uint32_t dumpLength = 0;
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Dumps are little endian like the ESP32
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void store(uint32_t offset, const uint8_t *data, uint32_t length)
+{
+	if (offset + length > sizeof(dump)) return;
+	memcpy(&dump[offset], data, length);
+	if (offset + length > dumpLength) dumpLength = offset + length;
+}
+
+// Size of the whole dump once its header is in, else 0
+static uint32_t dump_size(void)
+{
+	if (dumpLength < sizeof(TRACE_HEADER_t)) return 0;
+	return sizeof(TRACE_HEADER_t) + le16(dump + 6) * TRACE_NAME + le32(dump + 8) * sizeof(TRACE_RECORD_t);
+}
+
+// Lines like "I (123) TRACE: #1024:0a1b..."
+static bool read_log(FILE *fp)
+{
+	char line[1024];
+	int dumps = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		char *at = strstr(line, "TRACE: #");
+		if (at == NULL) continue;
+		char *hex;
+		uint32_t offset = strtoul(at + strlen("TRACE: #"), &hex, 10);
+		if (*hex != ':') continue;
+		hex++;
+		// Offset 0 starts the next dump
+		if (offset == 0) {
+			dumpLength = 0;
+			dumps++;
+		}
+		uint8_t bytes[sizeof(line) / 2];
+		uint32_t length = 0;
+		while (1) {
+			int hi = hex_nibble(hex[length*2]);
+			int lo = (hi < 0) ? -1 : hex_nibble(hex[length*2+1]);
+			if (lo < 0) break;
+			bytes[length++] = (hi << 4) | lo;
+		}
+		store(offset, bytes, length);
+	}
+	if (dumps == 0) {
+		fprintf(stderr, "No trace dump in the log\n");
+		return false;
+	}
+	return true;
+}
+
+// Every datagram of the answer starts with the offset of its bytes
+static bool fetch(const char *target)
+{
+	char host[256];
+	snprintf(host, sizeof(host), "%s", target);
+	const char *port = DEFAULT_PORT;
+	char *colon = strchr(host, ':');
+	if (colon) {
+		*colon = 0;
+		port = colon + 1;
+	}
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+	struct addrinfo *ai;
+	int err = getaddrinfo(host, port, &hints, &ai);
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", target, gai_strerror(err));
+		return false;
+	}
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct timeval timeout = { .tv_sec = FETCH_TIMEOUT_S };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	sendto(fd, "trace", 5, 0, ai->ai_addr, ai->ai_addrlen);
+	freeaddrinfo(ai);
+
+	uint32_t received = 0;
+	uint8_t buffer[4 + TRACE_CHUNK];
+	while (dump_size() == 0 || received < dump_size()) {
+		int n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n < 0) {
+			fprintf(stderr, "%s: got %u of %u bytes\n", target, received, dump_size());
+			close(fd);
+			return false;
+		}
+		if (n < 4) continue;
+		store(le32(buffer), buffer + 4, n - 4);
+		received += n - 4;
+	}
+	close(fd);
+	return true;
+}
+
+typedef struct {
+	bool synced;
+	uint32_t cycles;	// Of the last TRACE_SYNC
+	int64_t us;
+} ANCHOR_t;
+
+int main(int argc, char **argv)
+{
+	const char *target = NULL;
+	const char *output = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "u:o:")) != -1) {
+		switch (opt) {
+		case 'u':
+			target = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-u host[:port]] [-o file] [file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (target) {
+		if (!fetch(target)) return 1;
+	} else {
+		FILE *fp = stdin;
+		if (optind < argc) {
+			fp = fopen(argv[optind], "r");
+			if (fp == NULL) {
+				perror(argv[optind]);
+				return 1;
+			}
+		}
+		if (!read_log(fp)) return 1;
+	}
+
+	uint32_t size = dump_size();
+	if (size == 0 || le32(dump) != TRACE_MAGIC || le16(dump + 4) != TRACE_VERSION) {
+		fprintf(stderr, "Not a trace dump of version %d\n", TRACE_VERSION);
+		return 1;
+	}
+	if (dumpLength < size) {
+		fprintf(stderr, "Dump cut short: %u of %u bytes\n", dumpLength, size);
+		return 1;
+	}
+	int tasks = le16(dump + 6);
+	uint32_t count = le32(dump + 8);
+	double cyclesPerUs = le32(dump + 12);
+	const char *names = (const char *)dump + sizeof(TRACE_HEADER_t);
+	const uint8_t *records = dump + sizeof(TRACE_HEADER_t) + tasks * TRACE_NAME;
+
+	// The first TRACE_SYNC of a core also places the records before it.
+	// Sync times are the low 32 bits of esp_timer and are unwrapped.
+	ANCHOR_t anchors[CORES] = {0};
+	int64_t syncBase = 0;
+	uint32_t syncLast = 0;
+	bool syncSeen = false;
+	double *times = malloc(count * sizeof(double));
+	for (int pass=0; pass<2; pass++) {
+		for (uint32_t i=0; i<count; i++) {
+			const uint8_t *r = records + i * sizeof(TRACE_RECORD_t);
+			uint32_t cycles = le32(r);
+			int core = (r[5] & TRACE_CORE_BIT) ? 1 : 0;
+			ANCHOR_t *a = &anchors[core];
+			if (r[4] == TRACE_SYNC && (pass == 1 || !a->synced)) {
+				uint32_t us = le32(r + 8);
+				if (syncSeen && us < syncLast && syncLast - us > 0x80000000u) syncBase += 1LL << 32;
+				syncLast = us;
+				syncSeen = true;
+				a->synced = true;
+				a->cycles = cycles;
+				a->us = syncBase + us;
+			}
+			if (pass == 0) continue;
+			if (!a->synced) {
+				// A core without a sync keeps its own time line
+				a->synced = true;
+				a->cycles = cycles;
+				a->us = 0;
+			}
+			times[i] = a->us + (int32_t)(cycles - a->cycles) / cyclesPerUs;
+		}
+		// The second pass unwraps the sync times again from the start
+		syncBase = 0;
+		syncSeen = false;
+	}
+	double start = 0;
+	for (uint32_t i=0; i<count; i++) {
+		if (i == 0 || times[i] < start) start = times[i];
+	}
+
+	FILE *out = stdout;
+	if (output) {
+		out = fopen(output, "w");
+		if (out == NULL) {
+			perror(output);
+			return 1;
+		}
+	}
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"HUD\"}}");
+	bool used[256] = {0};
+	for (uint32_t i=0; i<count; i++) used[(records + i * sizeof(TRACE_RECORD_t))[5] & ~TRACE_CORE_BIT] = true;
+	for (int t=0; t<tasks; t++) {
+		if (!used[t]) continue;
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%.*s\"}}",
+			t, TRACE_NAME, names + t * TRACE_NAME);
+	}
+
+	uint32_t events = 0;
+	for (uint32_t i=0; i<count; i++) {
+		const uint8_t *r = records + i * sizeof(TRACE_RECORD_t);
+		uint8_t event = r[4];
+		int task = r[5] & ~TRACE_CORE_BIT;
+		int core = (r[5] & TRACE_CORE_BIT) ? 1 : 0;
+		uint16_t small = le16(r + 6);
+		uint32_t arg = le32(r + 8);
+		double ts = times[i] - start;
+		char head[128];
+		snprintf(head, sizeof(head), ",\n{\"pid\":1,\"tid\":%d,\"ts\":%.3f", task, ts);
+
+		switch (event) {
+		case TRACE_WAIT_BEGIN:
+		case TRACE_WAIT_END:
+			fprintf(out, "%s,\"ph\":\"%s\",\"cat\":\"wait\",\"name\":\"%s\",\"args\":{\"%s\":%u,\"core\":%d}}", head,
+				event == TRACE_WAIT_BEGIN ? "B" : "E", small < TRACE_WAITS ? waitNames[small] : "wait",
+				event == TRACE_WAIT_BEGIN ? "ms" : "ok", arg, core);
+			break;
+		case TRACE_QUEUE_SEND:
+			fprintf(out, "%s,\"ph\":\"i\",\"s\":\"t\",\"cat\":\"queue\",\"name\":\"queue send\",\"args\":{\"sent\":%u,\"depth\":%u}}",
+				head, small, arg);
+			break;
+		case TRACE_DATAGRAM_BEGIN:
+		case TRACE_DATAGRAM_END:
+			fprintf(out, "%s,\"ph\":\"%s\",\"cat\":\"udp\",\"name\":\"datagram\",\"args\":{\"%s\":%u}}", head,
+				event == TRACE_DATAGRAM_BEGIN ? "B" : "E", event == TRACE_DATAGRAM_BEGIN ? "bytes" : "frames", arg);
+			break;
+		case TRACE_DECODE_BEGIN:
+		case TRACE_DECODE_END:
+			fprintf(out, "%s,\"ph\":\"%s\",\"cat\":\"decode\",\"name\":\"decode #%u\",\"args\":{\"sysid\":%u}}", head,
+				event == TRACE_DECODE_BEGIN ? "B" : "E", arg, small);
+			break;
+		case TRACE_DRAW_BEGIN:
+		case TRACE_DRAW_END:
+			fprintf(out, "%s,\"ph\":\"%s\",\"cat\":\"draw\",\"name\":\"%s\"}", head,
+				event == TRACE_DRAW_BEGIN ? "B" : "E", small < SPI_PRIMS ? primNames[small] : "draw");
+			break;
+		case TRACE_SPI_BEGIN:
+		case TRACE_SPI_END:
+			fprintf(out, "%s,\"ph\":\"%s\",\"cat\":\"spi\",\"name\":\"%s\",\"args\":{\"bytes\":%u}}", head,
+				event == TRACE_SPI_BEGIN ? "B" : "E", small ? "spi data" : "spi command", arg);
+			break;
+		case TRACE_TRIGGER:
+			fprintf(out, "%s,\"ph\":\"i\",\"s\":\"g\",\"cat\":\"trigger\",\"name\":\"latency trigger\",\"args\":{\"us\":%u}}",
+				head, arg);
+			break;
+		default:
+			continue;
+		}
+		events++;
+	}
+	fprintf(out, "\n]}\n");
+	if (out != stdout) fclose(out);
+	fprintf(stderr, "records=%u events=%u span=%.1fms\n", count, events,
+		count ? (times[count-1] - start) / 1000 : 0.0);
+	free(times);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "boot.h"
+#include "cmd.h"
+
+extern OS_QUEUE_t xQueueCmd;
+
+static const char *TAG = "BOOT";
+
+static const char *stageName[BOOT_STAGE_MAX] = {
+	"nvs", "spiffs", "display", "wifi", "ip", "frame", "telemetry"
+};
+
+// Event bits. Bit n is set when stage n is done, bit n+BOOT_STAGE_MAX when it failed.
+#define DONE_BIT(stage)	(1 << (stage))
+#define FAIL_BIT(stage)	(1 << ((stage) + BOOT_STAGE_MAX))
+static OS_EVENT_t xEventBoot;
+
+// os_time_us() when each stage was reached, 0 if not yet
+static int64_t stageTime[BOOT_STAGE_MAX];
+
+void boot_init(void) {
+	xEventBoot = os_event_create();
+	assert( xEventBoot );
+}
+
+// Tell the TFT task to refresh the boot screen
+static void boot_notify(void) {
+	if (xQueueCmd == NULL) return;
+	CMD_t cmdBuf;
+	cmdBuf.command = CMD_STATUS;
+	cmdBuf.time = os_time_us();
+	cmdBuf.taskHandle = os_task_current();
+	os_queue_send(xQueueCmd, &cmdBuf, 0);
+}
+
+// Record the first time a stage is reached
+void boot_stage(int stage) {
+	if (stageTime[stage] != 0) return;
+	stageTime[stage] = os_time_us();
+	os_event_clear(xEventBoot, FAIL_BIT(stage));
+	os_event_set(xEventBoot, DONE_BIT(stage));
+	ESP_LOGI(TAG, "%s %lldms", stageName[stage], stageTime[stage] / 1000);
+	boot_notify();
+}
+
+void boot_fail(int stage) {
+	if (stageTime[stage] != 0) return;
+	os_event_set(xEventBoot, FAIL_BIT(stage));
+	ESP_LOGW(TAG, "%s failed", stageName[stage]);
+	boot_notify();
+}
+
+bool boot_wait(int stage, int32_t waitMs) {
+	uint32_t bits = os_event_wait(xEventBoot, DONE_BIT(stage), waitMs);
+	return (bits & DONE_BIT(stage)) != 0;
+}
+
+bool boot_done(int stage) {
+	return stageTime[stage] != 0;
+}
+
+bool boot_failed(int stage) {
+	return (os_event_get(xEventBoot) & FAIL_BIT(stage)) != 0;
+}
+
+int64_t boot_time(int stage) {
+	return stageTime[stage];
+}
+
+const char * boot_stage_name(int stage) {
+	return stageName[stage];
+}
+
+void boot_report(void) {
+	ESP_LOGI(TAG, "Startup timing");
+	for (int stage=0; stage<BOOT_STAGE_MAX; stage++) {
+		if (stageTime[stage]) {
+			ESP_LOGI(TAG, "%-10s %6lldms", stageName[stage], stageTime[stage] / 1000);
+		} else if (boot_failed(stage)) {
+			ESP_LOGI(TAG, "%-10s failed", stageName[stage]);
+		} else {
+			ESP_LOGI(TAG, "%-10s -", stageName[stage]);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef MAIN_BOOT_H_
+#define MAIN_BOOT_H_
+
+// Startup stages in the order they are shown on the boot screen
+#define BOOT_STAGE_NVS			0
+#define BOOT_STAGE_SPIFFS		1
+#define BOOT_STAGE_DISPLAY		2	// Boot screen drawn (time to first pixel)
+#define BOOT_STAGE_WIFI			3	// Associated with the AP
+#define BOOT_STAGE_IP			4	// Got an IP address
+#define BOOT_STAGE_FRAME		5	// First VFR_HUD decoded
+#define BOOT_STAGE_TELEMETRY	6	// First VFR_HUD drawn (time to first telemetry frame)
+#define BOOT_STAGE_MAX			7
+
+void boot_init(void);
+void boot_stage(int stage);
+void boot_fail(int stage);
+bool boot_wait(int stage, int32_t waitMs);
+bool boot_done(int stage);
+bool boot_failed(int stage);
+int64_t boot_time(int stage);
+const char * boot_stage_name(int stage);
+void boot_report(void);
+
+#endif /* MAIN_BOOT_H_ */
@@ -0,0 +1,165 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "driver/gpio.h"
+
+#include "os.h"
+#include "button.h"
+#include "cmd.h"
+#include "evlog.h"
+
+extern OS_QUEUE_t xQueueCmd;
+extern QueueHandle_t xQueueButton;
+
+typedef struct {
+	gpio_num_t gpio;
+	uint16_t command;
+	const char *name;
+	OS_TIMER_t debounce;
+	OS_TIMER_t hold;
+	bool bouncing;
+	bool pressed;
+	bool held;
+	int64_t edge;
+} BUTTON_t;
+
+static BUTTON_t buttons[] = {
+	{ GPIO_INPUT_A, CMD_BUTTON_LEFT, "LEFT" },
+	{ GPIO_INPUT_B, CMD_BUTTON_MIDDLE, "MIDDLE" },
+	{ GPIO_INPUT_C, CMD_BUTTON_RIGHT, "RIGHT" },
+};
+#define NUM_BUTTONS (sizeof(buttons)/sizeof(buttons[0]))
+
+// Only timestamp the edge here. Debounce and gesture detection run in the button task.
+static void IRAM_ATTR gpio_isr_handler(void *arg)
+{
+	BUTTON_EVENT_t event;
+	event.index = (uint32_t)arg;
+	event.type = EVENT_EDGE;
+	event.time = esp_timer_get_time();
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	xQueueSendFromISR(xQueueButton, &event, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
+
+static void post_timer_event(void *arg, uint8_t type)
+{
+	BUTTON_EVENT_t event;
+	event.index = (uint32_t)arg;
+	event.type = type;
+	event.time = esp_timer_get_time();
+	xQueueSend(xQueueButton, &event, 0);
+}
+
+static void debounce_callback(void *arg)
+{
+	post_timer_event(arg, EVENT_SETTLED);
+}
+
+static void hold_callback(void *arg)
+{
+	post_timer_event(arg, EVENT_HOLD);
+}
+
+static void send_press(BUTTON_t *b, uint16_t press, int64_t time)
+{
+	CMD_t cmdBuf;
+	cmdBuf.command = b->command;
+	cmdBuf.press = press;
+	cmdBuf.time = time;
+	cmdBuf.taskHandle = os_task_current();
+	if (!os_queue_send(xQueueCmd, &cmdBuf, 0)) {
+		EVLOG(EVLOG_BUTTON_DROPPED, b->command, press, 0);
+	} else {
+		EVLOG(EVLOG_BUTTON, b->command, press, 0);
+	}
+}
+
+// Button Monitoring
+// All three buttons share one task which sleeps until an edge or a timer arrives.
+// A short press is reported on release, a long press once the button has been held
+// for CONFIG_BUTTON_LONG_PRESS_MS, and then a repeat every CONFIG_BUTTON_REPEAT_MS.
+void button(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetTaskName(0), "Start");
+
+	// set the GPIO as a input with interrupt on both edges
+	// GPIO37-39 are input only and have external pull-ups on M5Stack
+	uint64_t pin_bit_mask = 0;
+	for (int i=0; i<NUM_BUTTONS; i++) pin_bit_mask |= (1ULL << buttons[i].gpio);
+	gpio_config_t io_conf = {
+		.pin_bit_mask = pin_bit_mask,
+		.mode = GPIO_MODE_INPUT,
+		.pull_up_en = GPIO_PULLUP_DISABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type = GPIO_INTR_ANYEDGE,
+	};
+	ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+	esp_err_t ret = gpio_install_isr_service(0);
+	if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) ESP_ERROR_CHECK(ret);
+
+	for (int i=0; i<NUM_BUTTONS; i++) {
+		BUTTON_t *b = &buttons[i];
+		b->debounce = os_timer_create("debounce", debounce_callback, (void *)i);
+		b->hold = os_timer_create("hold", hold_callback, (void *)i);
+		configASSERT(b->debounce != NULL && b->hold != NULL);
+		b->pressed = (gpio_get_level(b->gpio) == 0);
+		ESP_ERROR_CHECK(gpio_isr_handler_add(b->gpio, gpio_isr_handler, (void *)i));
+	}
+
+	BUTTON_EVENT_t event;
+	while(1) {
+		xQueueReceive(xQueueButton, &event, portMAX_DELAY);
+		BUTTON_t *b = &buttons[event.index];
+
+		if (event.type == EVENT_EDGE) {
+			// Every edge restarts the debounce window. Keep the first edge as the press time.
+			if (!b->bouncing) {
+				b->bouncing = true;
+				b->edge = event.time;
+			}
+			os_timer_start(b->debounce, BUTTON_DEBOUNCE_MS, false);
+
+		} else if (event.type == EVENT_SETTLED) {
+			b->bouncing = false;
+			bool pressed = (gpio_get_level(b->gpio) == 0);
+			// GPIO36/39 can see spurious edges while WiFi is active. Level did not change.
+			if (pressed == b->pressed) continue;
+			b->pressed = pressed;
+			if (pressed) {
+				b->held = false;
+				os_timer_start(b->hold, BUTTON_LONG_MS, false);
+			} else {
+				os_timer_stop(b->hold);
+				if (!b->held) send_press(b, BUTTON_PRESS_SHORT, b->edge);
+			}
+
+		} else if (event.type == EVENT_HOLD) {
+			if (!b->pressed) continue;
+			if (!b->held) {
+				b->held = true;
+				send_press(b, BUTTON_PRESS_LONG, event.time);
+				if (BUTTON_REPEAT_MS > 0) os_timer_start(b->hold, BUTTON_REPEAT_MS, true);
+			} else {
+				send_press(b, BUTTON_PRESS_REPEAT, event.time);
+			}
+		}
+	}
+}
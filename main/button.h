@@ -0,0 +1,28 @@
+#ifndef MAIN_BUTTON_H_
+#define MAIN_BUTTON_H_
+
+// for M5Stack
+#define GPIO_INPUT_A	GPIO_NUM_39
+#define GPIO_INPUT_B	GPIO_NUM_38
+#define GPIO_INPUT_C	GPIO_NUM_37
+
+#define BUTTON_DEBOUNCE_MS	CONFIG_BUTTON_DEBOUNCE_MS
+#define BUTTON_LONG_MS		CONFIG_BUTTON_LONG_PRESS_MS
+#define BUTTON_REPEAT_MS	CONFIG_BUTTON_REPEAT_MS
+
+#define BUTTON_QUEUE_LENGTH	16
+
+#define EVENT_EDGE		1	// GPIO edge seen by the ISR
+#define EVENT_SETTLED	2	// Debounce timer expired
+#define EVENT_HOLD		3	// Long press / repeat timer expired
+
+// for Queue
+typedef struct {
+	uint8_t index;
+	uint8_t type;
+	int64_t time;
+} BUTTON_EVENT_t;
+
+void button(void *pvParameters);
+
+#endif /* MAIN_BUTTON_H_ */
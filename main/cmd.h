@@ -2,15 +2,22 @@
 #define CMD_BUTTON_MIDDLE	200
 #define CMD_BUTTON_RIGHT	300
 #define CMD_MAVLINK			400
+#define CMD_STATUS			500
+#define CMD_REFRESH			600
+
+#define BUTTON_PRESS_SHORT	1
+#define BUTTON_PRESS_LONG	2
+#define BUTTON_PRESS_REPEAT	3
+
+#define CMD_QUEUE_LENGTH	10
 
 // for Queue
 typedef struct {
 	uint16_t command;
-	float airspeed; /*< Current airspeed in m/s*/
-	float groundspeed; /*< Current ground speed in m/s*/
-	float alt; /*< Current altitude (MSL), in meters*/
-	float climb; /*< Current climb rate in meters/second*/
-	int16_t heading; /*< Current heading in degrees, in compass units (0..360, 0=north)*/
-	uint16_t throttle; /*< Current throttle setting in integer percent, 0 to 100*/
-	TaskHandle_t taskHandle;
+	uint16_t press; /*< BUTTON_PRESS_xxx for button commands*/
+	uint32_t msgid; /*< MAVLink message whose telemetry slot was updated, for CMD_MAVLINK*/
+	int64_t time; /*< os_time_us() when the event happened*/
+	int64_t received; /*< when the datagram of the frame was received, for CMD_MAVLINK*/
+	int64_t queued; /*< when the command was sent to xQueueCmd, for CMD_MAVLINK*/
+	void *taskHandle; /*< os_task_current() of the sender*/
 } CMD_t;
@@ -0,0 +1,103 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "dispatch.h"
+
+static const char *TAG = "DISPATCH";
+
+// Handlers and a message ID to handler index map (0 = none, n = handlers[n-1]).
+// The enable flag of each ID is the wanted bit of the framer, so disabled IDs
+// are stepped over right after the header and never reach this table.
+static DISPATCH_t handlers[DISPATCH_MAX];
+static uint8_t numHandlers = 0;
+static uint8_t handlerIndex[FRAMER_MAX_MSGID];
+static FRAMER_t *_framer;
+
+// Slots are written by the receive path and read by the TFT task
+static OS_LOCK_t slotLock = OS_LOCK_INITIALIZER;
+
+void dispatch_init(FRAMER_t *framer)
+{
+	_framer = framer;
+	// Handlers registered before the framer existed keep their enable flag
+	for (int i=0; i<numHandlers; i++) {
+		if (handlers[i].enabled) framer_want(_framer, handlers[i].msgid, handlers[i].crcExtra);
+	}
+}
+
+bool dispatch_register(uint32_t msgid, uint8_t crcExtra, uint16_t offset, uint16_t size, DISPATCH_HANDLER handler)
+{
+	if (msgid >= FRAMER_MAX_MSGID || handlerIndex[msgid] != 0 || numHandlers >= DISPATCH_MAX) {
+		ESP_LOGE(TAG, "Can't register msgid=%d", msgid);
+		return false;
+	}
+	DISPATCH_t *d = &handlers[numHandlers++];
+	d->msgid = msgid;
+	d->crcExtra = crcExtra;
+	d->enabled = false;
+	d->offset = offset;
+	d->size = size;
+	d->handler = handler;
+	d->count = 0;
+	handlerIndex[msgid] = numHandlers;
+	return true;
+}
+
+void dispatch_enable(uint32_t msgid, bool enable)
+{
+	if (msgid >= FRAMER_MAX_MSGID || handlerIndex[msgid] == 0) return;
+	DISPATCH_t *d = &handlers[handlerIndex[msgid]-1];
+	d->enabled = enable;
+	if (_framer == NULL) return;
+	if (enable) {
+		framer_want(_framer, msgid, d->crcExtra);
+	} else {
+		framer_unwant(_framer, msgid);
+	}
+}
+
+bool dispatch_enabled(uint32_t msgid)
+{
+	if (msgid >= FRAMER_MAX_MSGID || handlerIndex[msgid] == 0) return false;
+	return handlers[handlerIndex[msgid]-1].enabled;
+}
+
+// Decode a wanted frame into its slot and run the handler
+void dispatch_frame(const FRAME_t *frame, void *state)
+{
+	if (frame->msgid >= FRAMER_MAX_MSGID || handlerIndex[frame->msgid] == 0) return;
+	DISPATCH_t *d = &handlers[handlerIndex[frame->msgid]-1];
+	d->count++;
+	dispatch_lock();
+	framer_decode(frame, (uint8_t *)state + d->offset, d->size);
+	dispatch_unlock();
+	if (d->handler) d->handler(frame, state);
+}
+
+void dispatch_lock(void)
+{
+	os_lock(&slotLock);
+}
+
+void dispatch_unlock(void)
+{
+	os_unlock(&slotLock);
+}
+
+void dispatch_report(void)
+{
+	for (int i=0; i<numHandlers; i++) {
+		ESP_LOGI(TAG, "msgid=%-4d %-8s count=%u", handlers[i].msgid,
+			handlers[i].enabled ? "enabled" : "disabled", handlers[i].count);
+	}
+}
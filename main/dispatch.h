@@ -0,0 +1,31 @@
+#ifndef MAIN_DISPATCH_H_
+#define MAIN_DISPATCH_H_
+
+#include "framer.h"
+
+// Handlers that can be registered
+#define DISPATCH_MAX	16
+
+// Called after the payload was decoded into its slot. state is the state block given to dispatch_frame().
+typedef void (*DISPATCH_HANDLER)(const FRAME_t *frame, void *state);
+
+typedef struct {
+	uint32_t msgid;
+	uint8_t crcExtra;
+	bool enabled;
+	uint16_t offset;	// Slot position in the state block
+	uint16_t size;		// sizeof(mavlink_xxx_t)
+	DISPATCH_HANDLER handler;
+	uint32_t count;
+} DISPATCH_t;
+
+void dispatch_init(FRAMER_t *framer);
+bool dispatch_register(uint32_t msgid, uint8_t crcExtra, uint16_t offset, uint16_t size, DISPATCH_HANDLER handler);
+void dispatch_enable(uint32_t msgid, bool enable);
+bool dispatch_enabled(uint32_t msgid);
+void dispatch_frame(const FRAME_t *frame, void *state);
+void dispatch_lock(void);
+void dispatch_unlock(void);
+void dispatch_report(void);
+
+#endif /* MAIN_DISPATCH_H_ */
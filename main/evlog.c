@@ -0,0 +1,194 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#if CONFIG_EVLOG
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "evlog.h"
+
+static const char *TAG = "EVLOG";
+
+// Every rate limited call site, for the drain task. Sites beyond EVLOG_LIMITS
+// still report at their next window.
+static EVLOG_LIMIT_t *limits[EVLOG_LIMITS];
+static uint32_t numLimits = 0;
+
+#if CONFIG_EVLOG
+_Static_assert((EVLOG_RING & (EVLOG_RING - 1)) == 0, "CONFIG_EVLOG_RING must be a power of two");
+
+// Multiple producers, one consumer. Producers claim a slot by moving head with a
+// compare and swap, fill it and then store the lap of the slot. The drain task only
+// takes records whose lap matches, so a slot still being written stops it.
+// head and tail are free running and wrap through the unsigned range.
+typedef struct {
+	EVLOG_RECORD_t records[EVLOG_RING];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;	// Records that did not fit
+} EVLOG_RING_t;
+
+static EVLOG_RING_t rings[portNUM_PROCESSORS];
+
+// Never 0 in the first lap, so the zeroed ring holds no complete record
+static inline uint8_t lap(uint32_t pos)
+{
+	return (pos / EVLOG_RING) + 1;
+}
+
+// Any task or ISR. Never waits. A record that does not fit is dropped and counted.
+void evlog_put(uint8_t site, int16_t small, uint32_t a, uint32_t b)
+{
+	EVLOG_RING_t *ring = &rings[xPortGetCoreID()];
+	uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	do {
+		if (pos - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= EVLOG_RING) {
+			__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	EVLOG_RECORD_t *r = &ring->records[pos & (EVLOG_RING - 1)];
+	r->time = os_time_us();
+	r->site = site;
+	r->small = small;
+	r->a = a;
+	r->b = b;
+	__atomic_store_n(&r->lap, lap(pos), __ATOMIC_RELEASE);
+}
+
+#if CONFIG_EVLOG_HEX
+#define EVLOG_OUTPUT	"hex"
+
+static void hex_flush(int core, char *line, int *length)
+{
+	if (*length == 0) return;
+	ESP_LOGI(TAG, "@%d:%s", core, line);
+	*length = 0;
+}
+#else
+#define EVLOG_OUTPUT	"text"
+#endif
+
+// Take every complete record of one ring. A record is copied out and its slot
+// freed before the slow output, so producers get the space back at once.
+static void drain(int core)
+{
+	EVLOG_RING_t *ring = &rings[core];
+	uint32_t pos = ring->tail;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+#if CONFIG_EVLOG_HEX
+	static char line[EVLOG_HEX_RECORDS * sizeof(EVLOG_RECORD_t) * 2 + 1];
+	int length = 0;
+#endif
+	while (pos != head) {
+		EVLOG_RECORD_t *slot = &ring->records[pos & (EVLOG_RING - 1)];
+		if (__atomic_load_n(&slot->lap, __ATOMIC_ACQUIRE) != lap(pos)) break;
+		EVLOG_RECORD_t record = *slot;
+		pos++;
+		__atomic_store_n(&ring->tail, pos, __ATOMIC_RELEASE);
+
+#if CONFIG_EVLOG_HEX
+		const uint8_t *bytes = (const uint8_t *)&record;
+		for (int i=0; i<sizeof(record); i++) {
+			length += sprintf(&line[length], "%02x", bytes[i]);
+		}
+		if (length == sizeof(line) - 1) hex_flush(core, line, &length);
+#else
+		char text[EVLOG_TEXT];
+		evlog_format(&record, text, sizeof(text));
+		ESP_LOGI(TAG, "%d %10u %s", core, record.time, text);
+#endif
+	}
+#if CONFIG_EVLOG_HEX
+	hex_flush(core, line, &length);
+#endif
+}
+
+// A site that went quiet has no next window to report what it held back.
+// A count may go out a window early, but never twice.
+static void flush_limits(int64_t now)
+{
+	uint32_t n = __atomic_load_n(&numLimits, __ATOMIC_RELAXED);
+	if (n > EVLOG_LIMITS) n = EVLOG_LIMITS;
+	for (uint32_t i=0; i<n; i++) {
+		EVLOG_LIMIT_t *limit = __atomic_load_n(&limits[i], __ATOMIC_ACQUIRE);
+		if (limit == NULL || now - limit->window < 1000000) continue;
+		uint32_t held = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+		if (held) evlog_put(EVLOG_SUPPRESSED, limit->site, held, 0);
+	}
+}
+
+// Drain task. Lowest priority, so the log only uses idle time.
+void evlog(void *pvParameters)
+{
+	ESP_LOGI(TAG, "Start. ring=%d records per core output=%s", EVLOG_RING, EVLOG_OUTPUT);
+	uint32_t dropped[portNUM_PROCESSORS] = {0};
+	int64_t lastReport = 0;
+	while (1) {
+		os_delay_ms(EVLOG_DRAIN_MS);
+		int64_t now = os_time_us();
+		flush_limits(now);
+		for (int core=0; core<portNUM_PROCESSORS; core++) drain(core);
+
+		if (now - lastReport < EVLOG_REPORT_US) continue;
+		lastReport = now;
+		for (int core=0; core<portNUM_PROCESSORS; core++) {
+			uint32_t d = __atomic_load_n(&rings[core].dropped, __ATOMIC_RELAXED);
+			if (d == dropped[core]) continue;
+			ESP_LOGW(TAG, "core %d dropped=%u. Ring full between drains", core, d);
+			dropped[core] = d;
+		}
+	}
+}
+
+#else
+
+// Without the ring every record is formatted and logged by the caller
+void evlog_put(uint8_t site, int16_t small, uint32_t a, uint32_t b)
+{
+	EVLOG_RECORD_t record = { .site = site, .small = small, .a = a, .b = b };
+	char text[EVLOG_TEXT];
+	evlog_format(&record, text, sizeof(text));
+	ESP_LOGI(TAG, "%s", text);
+}
+
+#endif
+
+static void limit_register(EVLOG_LIMIT_t *limit, uint8_t site)
+{
+	limit->site = site;
+	limit->registered = true;
+	uint32_t i = __atomic_fetch_add(&numLimits, 1, __ATOMIC_RELAXED);
+	if (i < EVLOG_LIMITS) __atomic_store_n(&limits[i], limit, __ATOMIC_RELEASE);
+}
+
+// Called by one task per site. A new window first reports what the last one held back.
+bool evlog_allow(EVLOG_LIMIT_t *limit, uint8_t site, uint32_t perSecond)
+{
+	if (!limit->registered) limit_register(limit, site);
+	int64_t now = os_time_us();
+	if (now - limit->window >= 1000000) {
+		uint32_t held = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+		if (held) evlog_put(EVLOG_SUPPRESSED, site, held, 0);
+		limit->window = now;
+		limit->count = 0;
+	}
+	if (limit->count < perSecond) {
+		limit->count++;
+		return true;
+	}
+	__atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+	return false;
+}
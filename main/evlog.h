@@ -0,0 +1,80 @@
+#ifndef MAIN_EVLOG_H_
+#define MAIN_EVLOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Event log.
+// Hot paths write fixed size binary records into a lock-free ring of the core they run on.
+// A low priority task formats them later, so a log line costs about a microsecond
+// where the UART would block the caller for as long as it takes to send the text.
+
+#define EVLOG_RING			CONFIG_EVLOG_RING	// Records per core. Power of two.
+#define EVLOG_DRAIN_MS		100
+#define EVLOG_REPORT_US		(10 * 1000 * 1000)	// Drop counters at most this often
+#define EVLOG_HEX_RECORDS	16					// Records per line of the hex output
+#define EVLOG_TEXT			96
+#define EVLOG_LIMITS		16					// Rate limited call sites the drain task flushes
+
+typedef enum {
+	EVLOG_SUPPRESSED = 0,	// small=site a=records a rate limit held back
+	EVLOG_VFR_HUD,			// small=sysid a=airspeed b=groundspeed
+	EVLOG_VFR_HUD_ALT,		// small=heading a=alt b=climb
+	EVLOG_BUTTON,			// small=command a=press
+	EVLOG_BUTTON_DROPPED,	// small=command a=press. xQueueCmd was full.
+	EVLOG_BUTTON_LATENCY,	// small=command a=press-to-screen us b=max us
+	EVLOG_BUTTON_LATENCY_AVG,	// small=presses a=min us b=average us
+	EVLOG_SITES,
+} EVLOG_SITE_t;
+
+// 16 bytes. lap is written last and tells the drain task the record is complete.
+typedef struct {
+	uint32_t time;		// esp_timer_get_time(), low 32 bits. Wraps after 71 minutes.
+	uint8_t site;
+	uint8_t lap;
+	int16_t small;
+	uint32_t a;
+	uint32_t b;
+} EVLOG_RECORD_t;
+
+_Static_assert(sizeof(EVLOG_RECORD_t) == 16, "EVLOG_RECORD_t must stay 16 bytes");
+
+// Rate limit of one call site. At most perSecond records per second,
+// the rest are counted and reported in one EVLOG_SUPPRESSED record, by the
+// next window of the site or by the drain task once the site has gone quiet.
+typedef struct {
+	int64_t window;
+	uint32_t count;
+	uint32_t suppressed;	// Taken with an atomic exchange by the site and the drain task
+	uint8_t site;
+	bool registered;
+} EVLOG_LIMIT_t;
+
+// float arguments travel as their bit pattern
+static inline uint32_t evlog_float(float f)
+{
+	union { float f; uint32_t u; } v = { .f = f };
+	return v.u;
+}
+
+static inline float evlog_to_float(uint32_t u)
+{
+	union { float f; uint32_t u; } v = { .u = u };
+	return v.f;
+}
+
+#define EVLOG(site, small, a, b)	evlog_put(site, small, a, b)
+#define EVLOG_LIMIT(site, perSecond, small, a, b) do { \
+		static EVLOG_LIMIT_t evlogLimit_; \
+		if (evlog_allow(&evlogLimit_, site, perSecond)) evlog_put(site, small, a, b); \
+	} while (0)
+
+void evlog_put(uint8_t site, int16_t small, uint32_t a, uint32_t b);
+bool evlog_allow(EVLOG_LIMIT_t *limit, uint8_t site, uint32_t perSecond);
+void evlog(void *pvParameters);
+
+// Portable, shared with host/evlog_decode.c
+const char *evlog_site_name(uint8_t site);
+int evlog_format(const EVLOG_RECORD_t *record, char *out, int size);
+
+#endif /* MAIN_EVLOG_H_ */
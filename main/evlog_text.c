@@ -0,0 +1,52 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// Text of the event log records. No ESP-IDF calls, so the host decoder shares it.
+#include <stdio.h>
+
+#include "evlog.h"
+
+static const char *names[EVLOG_SITES] = {
+	[EVLOG_SUPPRESSED] = "SUPPRESSED",
+	[EVLOG_VFR_HUD] = "VFR_HUD",
+	[EVLOG_VFR_HUD_ALT] = "VFR_HUD_ALT",
+	[EVLOG_BUTTON] = "BUTTON",
+	[EVLOG_BUTTON_DROPPED] = "BUTTON_DROPPED",
+	[EVLOG_BUTTON_LATENCY] = "BUTTON_LATENCY",
+	[EVLOG_BUTTON_LATENCY_AVG] = "BUTTON_LATENCY_AVG",
+};
+
+const char *evlog_site_name(uint8_t site)
+{
+	if (site >= EVLOG_SITES || names[site] == NULL) return "?";
+	return names[site];
+}
+
+// Format the arguments of a record without its time. Returns the length like snprintf.
+int evlog_format(const EVLOG_RECORD_t *r, char *out, int size)
+{
+	switch (r->site) {
+	case EVLOG_SUPPRESSED:
+		return snprintf(out, size, "SUPPRESSED:%s records=%u", evlog_site_name(r->small), r->a);
+	case EVLOG_VFR_HUD:
+		return snprintf(out, size, "VFR_HUD:sysid=%d airspeed=%f groundspeed=%f", r->small,
+			evlog_to_float(r->a), evlog_to_float(r->b));
+	case EVLOG_VFR_HUD_ALT:
+		return snprintf(out, size, "VFR_HUD:heading=%d alt=%f climb=%f", r->small,
+			evlog_to_float(r->a), evlog_to_float(r->b));
+	case EVLOG_BUTTON:
+		return snprintf(out, size, "BUTTON:command=%d press=%u", r->small, r->a);
+	case EVLOG_BUTTON_DROPPED:
+		return snprintf(out, size, "BUTTON:command=%d press=%u dropped. xQueueCmd full", r->small, r->a);
+	case EVLOG_BUTTON_LATENCY:
+		return snprintf(out, size, "BUTTON:command=%d latency=%uus max=%uus", r->small, r->a, r->b);
+	case EVLOG_BUTTON_LATENCY_AVG:
+		return snprintf(out, size, "BUTTON:presses=%d min=%uus avg=%uus", r->small, r->a, r->b);
+	default:
+		return snprintf(out, size, "site%u small=%d a=0x%08x b=0x%08x", r->site, r->small, r->a, r->b);
+	}
+}
@@ -0,0 +1,223 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "framer.h"
+
+// X.25 CRC (CRC-16/MCRF4XX) used by MAVLink, one table lookup per byte
+static const uint16_t crcTable[256] = {
+	0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+	0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+	0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+	0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+	0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+	0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+	0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+	0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+	0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+	0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+	0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+	0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+	0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+	0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+	0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+	0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+	0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+	0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+	0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+	0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+	0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+	0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+	0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+	0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+	0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+	0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+	0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+	0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+	0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+	0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+	0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78,
+};
+
+uint16_t framer_crc(uint16_t crc, const uint8_t *data, int length)
+{
+	for (int i=0; i<length; i++) {
+		crc = (crc >> 8) ^ crcTable[(crc ^ data[i]) & 0xff];
+	}
+	return crc;
+}
+
+void framer_init(FRAMER_t *f)
+{
+	memset(f, 0, sizeof(FRAMER_t));
+}
+
+void framer_ctx_init(FRAMER_CTX_t *ctx)
+{
+	memset(ctx, 0, sizeof(FRAMER_CTX_t));
+}
+
+bool framer_want(FRAMER_t *f, uint32_t msgid, uint8_t crcExtra)
+{
+	if (msgid >= FRAMER_MAX_MSGID) return false;
+	f->wanted[msgid >> 3] |= (1 << (msgid & 7));
+	f->crcExtra[msgid] = crcExtra;
+	return true;
+}
+
+void framer_unwant(FRAMER_t *f, uint32_t msgid)
+{
+	if (msgid >= FRAMER_MAX_MSGID) return;
+	f->wanted[msgid >> 3] &= ~(1 << (msgid & 7));
+}
+
+bool framer_wanted(const FRAMER_t *f, uint32_t msgid)
+{
+	if (msgid >= FRAMER_MAX_MSGID) return false;
+	return (f->wanted[msgid >> 3] & (1 << (msgid & 7))) != 0;
+}
+
+// Bytes needed for the frame starting at buf[0].
+// Returns the header size while the header is incomplete, 0 if buf[0] is not a valid start.
+static int frame_need(const uint8_t *buf, int avail)
+{
+	if (buf[0] == FRAMER_STX_V2) {
+		if (avail < FRAMER_HEADER_V2) return FRAMER_HEADER_V2;
+		// Only the signed flag is defined. Anything else is a false STX.
+		if (buf[2] & ~0x01) return 0;
+		return FRAMER_HEADER_V2 + buf[1] + 2 + ((buf[2] & 0x01) ? FRAMER_SIGNATURE : 0);
+	}
+	if (buf[0] == FRAMER_STX_V1) {
+		if (avail < FRAMER_HEADER_V1) return FRAMER_HEADER_V1;
+		return FRAMER_HEADER_V1 + buf[1] + 2;
+	}
+	return 0;
+}
+
+// Deliver every complete frame in buf.
+// Returns the offset of an incomplete frame at the end, or length if there is none.
+static int scan_buffer(const FRAMER_t *f, FRAMER_CTX_t *ctx, const uint8_t *buf, int length, FRAMER_CALLBACK callback, void *arg)
+{
+	int i = 0;
+	while (i < length) {
+		const uint8_t *p = &buf[i];
+		int avail = length - i;
+		int need = frame_need(p, avail);
+		if (need == 0) {
+			ctx->stats.garbage++;
+			i++;
+			continue;
+		}
+		if (avail < need) return i;
+
+		FRAME_t frame;
+		int header;
+		if (p[0] == FRAMER_STX_V2) {
+			header = FRAMER_HEADER_V2;
+			frame.seq = p[4];
+			frame.sysid = p[5];
+			frame.compid = p[6];
+			frame.msgid = p[7] | (p[8] << 8) | ((uint32_t)p[9] << 16);
+		} else {
+			header = FRAMER_HEADER_V1;
+			frame.seq = p[2];
+			frame.sysid = p[3];
+			frame.compid = p[4];
+			frame.msgid = p[5];
+		}
+		frame.frame = p;
+		frame.length = need;
+		frame.magic = p[0];
+		frame.payload = p + header;
+		frame.payloadLen = p[1];
+		frame.checked = false;
+
+		// Unwanted IDs are stepped over by length without touching the payload.
+		// Nothing checks their header, so the next STX or the end of the buffer
+		// must follow. Otherwise this was a false STX inside other bytes.
+		if (!framer_wanted(f, frame.msgid)) {
+			if (need < avail && p[need] != FRAMER_STX_V2 && p[need] != FRAMER_STX_V1) {
+				ctx->stats.garbage++;
+				i++;
+				continue;
+			}
+			ctx->stats.skipped++;
+			if (f->header) f->header(&frame, arg);
+			i += need;
+			continue;
+		}
+
+		// CRC covers everything after STX up to the payload end, then CRC_EXTRA
+		int crcEnd = header + p[1];
+		uint16_t crc = framer_crc(0xffff, p + 1, crcEnd - 1);
+		crc = framer_crc(crc, &f->crcExtra[frame.msgid], 1);
+		if (crc != (p[crcEnd] | (p[crcEnd+1] << 8))) {
+			// Resynchronize on the next byte. This may have been a false STX.
+			ctx->stats.badCrc++;
+			if (f->badCrc) f->badCrc(&frame, arg);
+			i++;
+			continue;
+		}
+
+		ctx->stats.frames++;
+		frame.checked = true;
+		if (f->header) f->header(&frame, arg);
+		callback(&frame, arg);
+		i += need;
+	}
+	return length;
+}
+
+// Scan a buffer. A frame cut at the end is kept and completed by the next call,
+// so a stream may be fed in arbitrary pieces such as a pbuf chain.
+void framer_scan(const FRAMER_t *f, FRAMER_CTX_t *ctx, const uint8_t *data, int length, FRAMER_CALLBACK callback, void *arg)
+{
+	int pos = 0;
+
+	// Complete the carried frame with the head of this buffer
+	while (ctx->carryLen > 0 && pos < length) {
+		int need = frame_need(ctx->carry, ctx->carryLen);
+		if (need > ctx->carryLen) {
+			int n = need - ctx->carryLen;
+			if (n > length - pos) n = length - pos;
+			memcpy(&ctx->carry[ctx->carryLen], &data[pos], n);
+			ctx->carryLen += n;
+			pos += n;
+			// The header may now give the real length
+			if (frame_need(ctx->carry, ctx->carryLen) > ctx->carryLen) continue;
+		}
+		int used = scan_buffer(f, ctx, ctx->carry, ctx->carryLen, callback, arg);
+		memmove(ctx->carry, &ctx->carry[used], ctx->carryLen - used);
+		ctx->carryLen -= used;
+	}
+
+	if (pos < length) {
+		int used = scan_buffer(f, ctx, &data[pos], length - pos, callback, arg);
+		memcpy(ctx->carry, &data[pos + used], length - pos - used);
+		ctx->carryLen = length - pos - used;
+	}
+}
+
+// End of a datagram. Drops a carried partial frame and returns true if there was one.
+bool framer_end(FRAMER_CTX_t *ctx)
+{
+	bool partial = (ctx->carryLen > 0);
+	ctx->carryLen = 0;
+	return partial;
+}
+
+// Copy a payload into its mavlink_xxx_t struct.
+// The wire format is the packed little-endian struct with trailing zeros trimmed,
+// which is what the library decoders do on little-endian targets.
+void framer_decode(const FRAME_t *frame, void *out, size_t size)
+{
+	size_t len = frame->payloadLen < size ? frame->payloadLen : size;
+	memcpy(out, frame->payload, len);
+	memset((uint8_t *)out + len, 0, size - len);
+}
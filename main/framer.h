@@ -0,0 +1,76 @@
+#ifndef MAIN_FRAMER_H_
+#define MAIN_FRAMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bulk MAVLink framer.
+// Scans a whole buffer for frames, looks at the message ID first and runs the CRC
+// only for the IDs registered with framer_want(). No ESP-IDF dependencies.
+
+#define FRAMER_STX_V1		0xFE
+#define FRAMER_STX_V2		0xFD
+#define FRAMER_HEADER_V1	6	// STX len seq sysid compid msgid
+#define FRAMER_HEADER_V2	10	// STX len incompat compat seq sysid compid msgid[3]
+#define FRAMER_SIGNATURE	13
+#define FRAMER_MAX_FRAME	(FRAMER_HEADER_V2 + 255 + 2 + FRAMER_SIGNATURE)
+
+// Message IDs that can be registered. Larger IDs are always skipped.
+#define FRAMER_MAX_MSGID	512
+
+// Zero copy view of one frame. Points into the scanned buffer and is only
+// valid inside the callback.
+typedef struct {
+	const uint8_t *frame;	// STX
+	uint16_t length;	// Whole frame including CRC and signature
+	uint8_t magic;
+	uint8_t seq;
+	uint8_t sysid;
+	uint8_t compid;
+	uint32_t msgid;
+	const uint8_t *payload;
+	uint8_t payloadLen;	// As sent. MAVLink 2 trims trailing zero bytes.
+	bool checked;		// CRC verified. Skipped frames are not.
+} FRAME_t;
+
+typedef void (*FRAMER_CALLBACK)(const FRAME_t *frame, void *arg);
+
+typedef struct {
+	uint32_t frames;	// Wanted frames with a good CRC
+	uint32_t skipped;	// Frames of unwanted message IDs followed by an STX or the end, not CRC checked
+	uint32_t badCrc;	// Wanted frames with a bad CRC
+	uint32_t garbage;	// Bytes outside any frame
+} FRAMER_STATS_t;
+
+// Wanted message IDs. Shared by every stream.
+typedef struct {
+	uint8_t wanted[FRAMER_MAX_MSGID/8];
+	uint8_t crcExtra[FRAMER_MAX_MSGID];
+	// Optional hooks for link statistics. header sees every frame with a good CRC
+	// and every skipped frame, whose header is not CRC checked but is followed by
+	// the next STX or the end of the buffer. badCrc sees the header of a wanted
+	// frame that failed the CRC.
+	FRAMER_CALLBACK header;
+	FRAMER_CALLBACK badCrc;
+} FRAMER_t;
+
+// Parser context of one stream
+typedef struct {
+	// Start of a frame that continues in the next buffer
+	uint8_t carry[FRAMER_MAX_FRAME];
+	uint16_t carryLen;
+	FRAMER_STATS_t stats;
+} FRAMER_CTX_t;
+
+void framer_init(FRAMER_t *f);
+bool framer_want(FRAMER_t *f, uint32_t msgid, uint8_t crcExtra);
+void framer_unwant(FRAMER_t *f, uint32_t msgid);
+bool framer_wanted(const FRAMER_t *f, uint32_t msgid);
+void framer_ctx_init(FRAMER_CTX_t *ctx);
+void framer_scan(const FRAMER_t *f, FRAMER_CTX_t *ctx, const uint8_t *data, int length, FRAMER_CALLBACK callback, void *arg);
+bool framer_end(FRAMER_CTX_t *ctx);
+void framer_decode(const FRAME_t *frame, void *out, size_t size);
+uint16_t framer_crc(uint16_t crc, const uint8_t *data, int length);
+
+#endif /* MAIN_FRAMER_H_ */
@@ -0,0 +1,372 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include <ardupilotmega/mavlink.h>
+
+#include "os.h"
+#include "framer.h"
+#include "health.h"
+#include "gcs.h"
+
+static const char *TAG = "GCS";
+
+// Messages of one screen and the rate in Hz
+typedef struct {
+	uint32_t msgid;
+	uint8_t hz;
+} GCS_RATE_t;
+
+// General Info shows text, Heading and Speed animate the VFR_HUD needles.
+// Link Health and Latency keep VFR_HUD slow so the vehicle stays in the table.
+static const GCS_RATE_t general[] = {
+	{ MAVLINK_MSG_ID_VFR_HUD, 2 },
+#if CONFIG_TELEMETRY_ATTITUDE
+	{ MAVLINK_MSG_ID_ATTITUDE, 2 },
+#endif
+#if CONFIG_TELEMETRY_GPS
+	{ MAVLINK_MSG_ID_GPS_RAW_INT, 1 },
+#endif
+#if CONFIG_TELEMETRY_BATTERY
+	{ MAVLINK_MSG_ID_SYS_STATUS, 1 },
+#endif
+};
+static const GCS_RATE_t hud[] = {
+	{ MAVLINK_MSG_ID_VFR_HUD, CONFIG_MAVLINK_HUD_RATE },
+};
+static const GCS_RATE_t health[] = {
+	{ MAVLINK_MSG_ID_VFR_HUD, 1 },
+};
+
+static const struct {
+	const GCS_RATE_t *rates;
+	int count;
+} screens[GCS_SCREENS] = {
+	{ general, sizeof(general)/sizeof(general[0]) },
+	{ hud, sizeof(hud)/sizeof(hud[0]) },
+	{ hud, sizeof(hud)/sizeof(hud[0]) },
+	{ health, sizeof(health)/sizeof(health[0]) },
+	{ health, sizeof(health)/sizeof(health[0]) },
+};
+
+// Interval requested for one message ID
+typedef struct {
+	uint32_t msgid;
+	int32_t interval;	// Microseconds or GCS_INTERVAL_STOP
+	bool done;			// Acknowledged or given up
+	uint8_t tries;
+	int64_t sent;
+} GCS_MSG_t;
+
+static GCS_MSG_t msgs[GCS_MESSAGES];
+static int numMsgs = 0;
+static int outstanding = -1;	// Entry waiting for its COMMAND_ACK
+
+static GCS_SEND sendFunc;
+static GCS_STATS_t stats;
+
+// The autopilot. Written by the receive path and copied by gcs_poll() under
+// targetLock, so an address is never sent to with the port or sysid of another.
+typedef struct {
+	uint32_t addr;
+	uint16_t port;
+	uint8_t sysid;
+} GCS_TARGET_t;
+
+static OS_LOCK_t targetLock = OS_LOCK_INITIALIZER;
+static GCS_TARGET_t target;
+static bool targetChanged = false;
+
+// Written by the receive path, read by gcs_poll(). Single words only,
+// so the two sides need no lock even when they run in different tasks.
+static volatile uint32_t targetHeartbeats = 0;
+static volatile bool ackSeen = false;
+static volatile uint8_t ackResult;
+static volatile int requestedScreen = 1;
+
+// Message IDs the autopilot sends on this link. Only kept with CONFIG_MAVLINK_STOP_UNUSED.
+static volatile uint8_t seen[FRAMER_MAX_MSGID/8];
+
+// Owned by gcs_poll()
+static GCS_TARGET_t polled;		// Copy of target for this poll
+static int activeScreen = 0;
+static uint32_t heartbeatsHeard = 0;
+static int64_t lastHeard = 0;
+static bool lost = true;
+static int64_t lastHeartbeat = 0;
+
+// HEARTBEAT and COMMAND_ACK must pass the framer. The receive path hands them
+// to gcs_frame() instead of the telemetry dispatcher.
+void gcs_init(FRAMER_t *framer, GCS_SEND send)
+{
+	sendFunc = send;
+	framer_want(framer, MAVLINK_MSG_ID_HEARTBEAT, MAVLINK_MSG_ID_HEARTBEAT_CRC);
+	framer_want(framer, MAVLINK_MSG_ID_COMMAND_ACK, MAVLINK_MSG_ID_COMMAND_ACK_CRC);
+	ESP_LOGI(TAG, "sysid=%d compid=%d", CONFIG_MAVLINK_GCS_SYSID, GCS_COMPID);
+}
+
+// Called by the receive path for every allowed frame. Learns the address of the
+// autopilot from its HEARTBEAT and picks up the COMMAND_ACK of our requests.
+// Returns true when the frame was consumed.
+bool gcs_frame(uint32_t addr, uint16_t port, const FRAME_t *frame, uint8_t selected)
+{
+	if (frame->msgid == MAVLINK_MSG_ID_HEARTBEAT) {
+		if (frame->compid != MAV_COMP_ID_AUTOPILOT1) return true;
+		// Follow the vehicle on the screen. Take the first one until there is one.
+		if (selected != 0 && frame->sysid != selected) return true;
+		// Only the receive path writes target, so it reads it without the lock
+		if (frame->sysid != target.sysid || addr != target.addr || port != target.port) {
+			os_lock(&targetLock);
+			target.addr = addr;
+			target.port = port;
+			target.sysid = frame->sysid;
+			targetChanged = true;
+			os_unlock(&targetLock);
+		}
+		targetHeartbeats++;
+		return true;
+	}
+
+	if (frame->msgid == MAVLINK_MSG_ID_COMMAND_ACK) {
+		if (frame->sysid != target.sysid) return true;
+		mavlink_command_ack_t ack;
+		framer_decode(frame, &ack, sizeof(ack));
+		if (ack.command != MAV_CMD_SET_MESSAGE_INTERVAL) return true;
+		// MAVLink 1 has no target fields. Otherwise skip the answers to other ground stations.
+		if (ack.target_system != 0 && ack.target_system != CONFIG_MAVLINK_GCS_SYSID) return true;
+		ackResult = ack.result;
+		ackSeen = true;
+		return true;
+	}
+	return false;
+}
+
+// Framer header hook. Sees every frame, also the skipped ones.
+void gcs_header(const FRAME_t *frame)
+{
+#if CONFIG_MAVLINK_STOP_UNUSED
+	if (frame->sysid != target.sysid || frame->compid != MAV_COMP_ID_AUTOPILOT1) return;
+	if (frame->msgid >= FRAMER_MAX_MSGID) return;
+	seen[frame->msgid/8] |= 1 << (frame->msgid % 8);
+#endif
+}
+
+// Called by the TFT task. The requests are sent by gcs_poll().
+void gcs_screen(int screen)
+{
+	if (screen < 1 || screen > GCS_SCREENS) return;
+	requestedScreen = screen;
+}
+
+static void send_message(const mavlink_message_t *msg)
+{
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	uint16_t len = mavlink_msg_to_send_buffer(buf, msg);
+	if (sendFunc(polled.addr, polled.port, buf, len) != len) stats.sendErrors++;
+}
+
+static void send_heartbeat(void)
+{
+	mavlink_message_t msg;
+	mavlink_msg_heartbeat_pack(CONFIG_MAVLINK_GCS_SYSID, GCS_COMPID, &msg,
+		MAV_TYPE_GCS, MAV_AUTOPILOT_INVALID, 0, 0, MAV_STATE_ACTIVE);
+	send_message(&msg);
+	stats.heartbeats++;
+}
+
+#if CONFIG_MAVLINK_LINK_STATUS
+// Receive counters for the sender, with every HEARTBEAT. A load generator
+// finds the message rate at which frames start to get lost from them.
+static void send_link_status(int64_t now)
+{
+	mavlink_link_node_status_t status;
+	memset(&status, 0, sizeof(status));
+	status.timestamp = now / 1000;
+	status.messages_sent = stats.heartbeats + stats.commands;
+	health_totals(&status.messages_received, &status.messages_lost);
+	mavlink_message_t msg;
+	mavlink_msg_link_node_status_encode(CONFIG_MAVLINK_GCS_SYSID, GCS_COMPID, &msg, &status);
+	send_message(&msg);
+}
+#endif
+
+static void send_interval(GCS_MSG_t *m, int64_t now)
+{
+	mavlink_message_t msg;
+	mavlink_msg_command_long_pack(CONFIG_MAVLINK_GCS_SYSID, GCS_COMPID, &msg,
+		polled.sysid, MAV_COMP_ID_AUTOPILOT1, MAV_CMD_SET_MESSAGE_INTERVAL, m->tries,
+		m->msgid, m->interval, 0, 0, 0, 0, 0);
+	ackSeen = false;
+	send_message(&msg);
+	m->tries++;
+	m->sent = now;
+	stats.commands++;
+	ESP_LOGD(TAG, "SET_MESSAGE_INTERVAL msgid=%u interval=%d try=%d", m->msgid, m->interval, m->tries);
+}
+
+static GCS_MSG_t *find(uint32_t msgid)
+{
+	for (int i=0; i<numMsgs; i++) {
+		if (msgs[i].msgid == msgid) return &msgs[i];
+	}
+	return NULL;
+}
+
+// Set the interval of msgid. Sent again only when it changed.
+static void request(uint32_t msgid, int32_t interval)
+{
+	GCS_MSG_t *m = find(msgid);
+	if (m == NULL) {
+		if (numMsgs == GCS_MESSAGES) {
+			static bool full = false;
+			if (!full) ESP_LOGW(TAG, "No entry for msgid %u. Increase GCS_MESSAGES", msgid);
+			full = true;
+			return;
+		}
+		m = &msgs[numMsgs++];
+		m->msgid = msgid;
+	} else if (m->interval == interval) {
+		return;
+	}
+	m->interval = interval;
+	m->done = false;
+	m->tries = 0;
+	if (outstanding == m - msgs) outstanding = -1;
+}
+
+// Everything not on the new screen is stopped
+static void apply_screen(int screen)
+{
+	for (int i=0; i<numMsgs; i++) {
+		bool needed = false;
+		for (int j=0; j<screens[screen-1].count; j++) {
+			if (screens[screen-1].rates[j].msgid == msgs[i].msgid) needed = true;
+		}
+		if (!needed) request(msgs[i].msgid, GCS_INTERVAL_STOP);
+	}
+	for (int j=0; j<screens[screen-1].count; j++) {
+		request(screens[screen-1].rates[j].msgid, 1000000 / screens[screen-1].rates[j].hz);
+	}
+	activeScreen = screen;
+	ESP_LOGI(TAG, "screen=%d messages=%d", screen, screens[screen-1].count);
+}
+
+// An autopilot that was restarted or replaced has forgotten every interval
+static void request_again(void)
+{
+	for (int i=0; i<numMsgs; i++) {
+		msgs[i].done = false;
+		msgs[i].tries = 0;
+	}
+	outstanding = -1;
+	memset((uint8_t *)seen, 0, sizeof(seen));
+}
+
+#if CONFIG_MAVLINK_STOP_UNUSED
+// Stop every message of the autopilot that no screen uses
+static void stop_unused(void)
+{
+	for (uint32_t msgid=0; msgid<FRAMER_MAX_MSGID; msgid++) {
+		if ((seen[msgid/8] & (1 << (msgid % 8))) == 0) continue;
+		if (msgid == MAVLINK_MSG_ID_HEARTBEAT || msgid == MAVLINK_MSG_ID_COMMAND_ACK) continue;
+		if (find(msgid) != NULL) continue;
+		request(msgid, GCS_INTERVAL_STOP);
+	}
+}
+#endif
+
+// Called every GCS_POLL_MS by the task that owns the send path.
+// One request is in flight at a time, because COMMAND_ACK does not tell the message ID.
+void gcs_poll(int64_t now)
+{
+	os_lock(&targetLock);
+	polled = target;
+	bool changed = targetChanged;
+	targetChanged = false;
+	os_unlock(&targetLock);
+	if (polled.sysid == 0) return;
+
+	if (changed) {
+		uint8_t *b = (uint8_t *)&polled.addr;
+		ESP_LOGI(TAG, "autopilot sysid=%d at %d.%d.%d.%d:%d", polled.sysid, b[0], b[1], b[2], b[3], polled.port);
+		request_again();
+	}
+	if (targetHeartbeats != heartbeatsHeard) {
+		heartbeatsHeard = targetHeartbeats;
+		lastHeard = now;
+		if (lost) {
+			lost = false;
+			request_again();
+		}
+	} else if (!lost && now - lastHeard > GCS_TARGET_LOST_US) {
+		lost = true;
+		ESP_LOGW(TAG, "autopilot sysid=%d lost", polled.sysid);
+	}
+
+	if (now - lastHeartbeat >= GCS_HEARTBEAT_US) {
+		send_heartbeat();
+#if CONFIG_MAVLINK_LINK_STATUS
+		send_link_status(now);
+#endif
+		lastHeartbeat = now;
+	}
+	if (lost) return;
+
+	if (requestedScreen != activeScreen) apply_screen(requestedScreen);
+#if CONFIG_MAVLINK_STOP_UNUSED
+	stop_unused();
+#endif
+
+	if (outstanding >= 0) {
+		GCS_MSG_t *m = &msgs[outstanding];
+		if (ackSeen) {
+			ackSeen = false;
+			m->done = true;
+			outstanding = -1;
+			if (ackResult == MAV_RESULT_ACCEPTED) {
+				stats.accepted++;
+			} else {
+				stats.rejected++;
+				ESP_LOGW(TAG, "msgid=%u interval=%d rejected result=%d", m->msgid, m->interval, ackResult);
+			}
+		} else if (now - m->sent >= GCS_RETRY_US) {
+			if (m->tries < GCS_TRIES) {
+				send_interval(m, now);
+			} else {
+				m->done = true;
+				outstanding = -1;
+				stats.timeouts++;
+				ESP_LOGW(TAG, "msgid=%u interval=%d no COMMAND_ACK", m->msgid, m->interval);
+			}
+		}
+	}
+	if (outstanding < 0) {
+		for (int i=0; i<numMsgs; i++) {
+			if (msgs[i].done) continue;
+			outstanding = i;
+			send_interval(&msgs[i], now);
+			break;
+		}
+	}
+}
+
+// Called by the task of gcs_poll()
+void gcs_report(void)
+{
+	if (polled.sysid == 0) return;
+	ESP_LOGI(TAG, "autopilot=%d%s screen=%d heartbeats=%u commands=%u accepted=%u rejected=%u timeouts=%u send_errors=%u",
+		polled.sysid, lost ? " lost" : "", activeScreen, stats.heartbeats, stats.commands,
+		stats.accepted, stats.rejected, stats.timeouts, stats.sendErrors);
+	for (int i=0; i<numMsgs; i++) {
+		ESP_LOGD(TAG, "msgid=%-4u interval=%-8d %s", msgs[i].msgid, msgs[i].interval,
+			!msgs[i].done ? "pending" : "done");
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef MAIN_GCS_H_
+#define MAIN_GCS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "framer.h"
+
+// Ground station side of the link.
+// Sends a HEARTBEAT and the receive counters (LINK_NODE_STATUS) to the autopilot and
+// asks it with MAV_CMD_SET_MESSAGE_INTERVAL for the messages the active screen needs.
+// No ESP-IDF dependencies except esp_log.h, so the host tools can run it against
+// a stand-in autopilot.
+
+#define GCS_COMPID			190		// MAV_COMP_ID_MISSIONPLANNER
+#define GCS_POLL_MS			100		// gcs_poll() period
+#define GCS_HEARTBEAT_US	(1000 * 1000)
+#define GCS_RETRY_US		(500 * 1000)	// Wait for COMMAND_ACK
+#define GCS_TRIES			3
+#define GCS_TARGET_LOST_US	(5 * 1000 * 1000)	// Autopilot HEARTBEAT timeout
+#define GCS_MESSAGES		24		// Message IDs with a requested interval
+
+#define GCS_INTERVAL_STOP	-1		// Stop sending the message
+
+#define GCS_SCREENS			5		// Screens 1 to 5 of the TFT task
+
+// Sends one datagram to addr:port (network order address). Returns the bytes sent or -1.
+typedef int (*GCS_SEND)(uint32_t addr, uint16_t port, const uint8_t *data, int length);
+
+typedef struct {
+	uint32_t heartbeats;	// HEARTBEATs sent
+	uint32_t commands;		// SET_MESSAGE_INTERVAL sent, retries included
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t timeouts;		// Requests without COMMAND_ACK after GCS_TRIES
+	uint32_t sendErrors;
+} GCS_STATS_t;
+
+void gcs_init(FRAMER_t *framer, GCS_SEND send);
+bool gcs_frame(uint32_t addr, uint16_t port, const FRAME_t *frame, uint8_t selected);
+void gcs_header(const FRAME_t *frame);
+void gcs_screen(int screen);
+void gcs_poll(int64_t now);
+void gcs_report(void);
+
+#endif /* MAIN_GCS_H_ */
@@ -0,0 +1,198 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "health.h"
+
+static const char *TAG = "HEALTH";
+
+// Only the receive path writes the table. Readers copy single counters without
+// a lock, so a row may be torn for one refresh.
+static HEALTH_STREAM_t streams[HEALTH_STREAMS];
+
+// Sums of every stream there has been
+static uint32_t totalReceived = 0;
+static uint32_t totalLost = 0;
+
+// Arrival time of the datagram being parsed
+static int64_t arrival;
+
+void health_time(int64_t now)
+{
+	arrival = now;
+}
+
+// Stream of a (sysid, compid). Only a frame with a good CRC may start a new one,
+// since a header nobody checked may be made up of other bytes.
+// A new stream replaces the least recently seen one when full.
+static HEALTH_STREAM_t *health_stream(uint8_t sysid, uint8_t compid, bool create)
+{
+	int slot = -1;
+	for (int i=0; i<HEALTH_STREAMS; i++) {
+		HEALTH_STREAM_t *s = &streams[i];
+		if (s->used && s->sysid == sysid && s->compid == compid) return s;
+		if (!create) continue;
+		if (slot >= 0 && !streams[slot].used) continue;
+		if (slot < 0 || !s->used || s->lastSeen < streams[slot].lastSeen) slot = i;
+	}
+	if (!create) return NULL;
+	HEALTH_STREAM_t *s = &streams[slot];
+	memset(s, 0, sizeof(HEALTH_STREAM_t));
+	s->used = true;
+	s->sysid = sysid;
+	s->compid = compid;
+	s->rateTime = arrival;
+	return s;
+}
+
+// Message slot by open addressing on the message ID
+static HEALTH_MSG_t *health_msg(HEALTH_STREAM_t *s, uint32_t msgid)
+{
+	uint32_t h = msgid & (HEALTH_MSG_SLOTS - 1);
+	for (int i=0; i<HEALTH_MSG_SLOTS; i++) {
+		HEALTH_MSG_t *m = &s->msgs[(h + i) & (HEALTH_MSG_SLOTS - 1)];
+		if (m->used && m->msgid == msgid) return m;
+		if (!m->used) {
+			m->used = true;
+			m->msgid = msgid;
+			return m;
+		}
+	}
+	return NULL;
+}
+
+static void health_rates(HEALTH_STREAM_t *s)
+{
+	int64_t elapsed = arrival - s->rateTime;
+	if (elapsed < HEALTH_INTERVAL) return;
+	s->rate = (s->received - s->rateCount) * 1000000.0 / elapsed;
+	s->rateCount = s->received;
+	for (int i=0; i<HEALTH_MSG_SLOTS; i++) {
+		HEALTH_MSG_t *m = &s->msgs[i];
+		if (!m->used) continue;
+		m->rate = (m->count - m->rateCount) * 1000000.0 / elapsed;
+		m->rateCount = m->count;
+	}
+	s->rateTime = arrival;
+}
+
+// Framer header hook. Runs for every frame, so every step is O(1).
+void health_frame(const FRAME_t *frame, void *arg)
+{
+	HEALTH_STREAM_t *s = health_stream(frame->sysid, frame->compid, frame->checked);
+	if (s == NULL) return;
+	s->received++;
+	totalReceived++;
+	if (frame->checked) s->checked++;
+	s->lastSeen = arrival;
+
+	// seq is per sender and wraps at 256. A step back of less than half the range is late.
+	if (s->seqValid) {
+		uint8_t diff = frame->seq - s->lastSeq;
+		if (diff == 0 || diff >= 128) {
+			s->reordered++;
+		} else {
+			s->lost += diff - 1;
+			totalLost += diff - 1;
+			s->lastSeq = frame->seq;
+		}
+	} else {
+		s->seqValid = true;
+		s->lastSeq = frame->seq;
+	}
+
+	HEALTH_MSG_t *m = health_msg(s, frame->msgid);
+	if (m == NULL) {
+		s->other++;
+	} else {
+		m->count++;
+		// Smoothed interval and jitter, as in RFC 3550
+		if (m->lastArrival != 0) {
+			int32_t d = arrival - m->lastArrival;
+			if (m->interval == 0) m->interval = d;
+			m->interval += (d - m->interval) / 8;
+			m->jitter += (abs(d - m->interval) - m->jitter) / 16;
+		}
+		m->lastArrival = arrival;
+	}
+	health_rates(s);
+}
+
+void health_bad_crc(const FRAME_t *frame, void *arg)
+{
+	HEALTH_STREAM_t *s = health_stream(frame->sysid, frame->compid, false);
+	if (s == NULL) return;
+	s->badCrc++;
+	s->lastSeen = arrival;
+}
+
+static void health_summarize(const HEALTH_STREAM_t *s, HEALTH_SUMMARY_t *out)
+{
+	out->sysid = s->sysid;
+	out->compid = s->compid;
+	out->rate = s->rate;
+	uint32_t expected = s->received + s->lost;
+	out->loss = expected ? s->lost * 100.0 / expected : 0;
+	// Skipped frames are not CRC checked, so only wanted frames count
+	uint32_t checked = s->checked + s->badCrc;
+	out->crcError = checked ? s->badCrc * 100.0 / checked : 0;
+	out->reordered = s->reordered;
+	out->jitterMsgid = 0;
+	out->jitter = 0;
+	float fastest = -1;
+	for (int i=0; i<HEALTH_MSG_SLOTS; i++) {
+		const HEALTH_MSG_t *m = &s->msgs[i];
+		if (!m->used || m->rate <= fastest) continue;
+		fastest = m->rate;
+		out->jitterMsgid = m->msgid;
+		out->jitter = m->jitter;
+	}
+	out->lastSeen = s->lastSeen;
+}
+
+// Summaries of the streams in use. Returns the number written.
+int health_summary(HEALTH_SUMMARY_t *out, int max)
+{
+	int count = 0;
+	for (int i=0; i<HEALTH_STREAMS && count<max; i++) {
+		if (!streams[i].used) continue;
+		health_summarize(&streams[i], &out[count++]);
+	}
+	return count;
+}
+
+// Frames received and lost since boot. They never go down, also when a stream is replaced.
+void health_totals(uint32_t *received, uint32_t *lost)
+{
+	*received = totalReceived;
+	*lost = totalLost;
+}
+
+void health_report(int64_t now)
+{
+	for (int i=0; i<HEALTH_STREAMS; i++) {
+		const HEALTH_STREAM_t *s = &streams[i];
+		if (!s->used) continue;
+		HEALTH_SUMMARY_t sum;
+		health_summarize(s, &sum);
+		ESP_LOGI(TAG, "%d/%d rate=%.1f loss=%.2f%% lost=%u reordered=%u crc_error=%.2f%% jitter=%dus(msgid=%u) idle=%"PRId64"ms",
+			sum.sysid, sum.compid, sum.rate, sum.loss, s->lost, sum.reordered, sum.crcError,
+			sum.jitter, sum.jitterMsgid, (now - sum.lastSeen) / 1000);
+		for (int j=0; j<HEALTH_MSG_SLOTS; j++) {
+			const HEALTH_MSG_t *m = &s->msgs[j];
+			if (!m->used) continue;
+			ESP_LOGD(TAG, "%d/%d msgid=%u count=%u rate=%.1f interval=%dus jitter=%dus",
+				s->sysid, s->compid, m->msgid, m->count, m->rate, m->interval, m->jitter);
+		}
+	}
+}
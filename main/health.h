@@ -0,0 +1,63 @@
+#ifndef MAIN_HEALTH_H_
+#define MAIN_HEALTH_H_
+
+#include "framer.h"
+
+// Streams are (sysid, compid) pairs
+#define HEALTH_STREAMS		8
+// Message IDs tracked per stream. Power of two. Others are counted as other.
+#define HEALTH_MSG_SLOTS	16
+// Rate window
+#define HEALTH_INTERVAL		(1000*1000)
+
+typedef struct {
+	bool used;
+	uint32_t msgid;
+	uint32_t count;
+	uint32_t rateCount;
+	float rate;				// Frames per second over the last window
+	int64_t lastArrival;
+	int32_t interval;		// Smoothed inter-arrival time (us)
+	int32_t jitter;			// Smoothed deviation from the interval (us)
+} HEALTH_MSG_t;
+
+typedef struct {
+	bool used;
+	uint8_t sysid;
+	uint8_t compid;
+	bool seqValid;
+	uint8_t lastSeq;
+	uint32_t received;		// Frames with a parsed header
+	uint32_t checked;		// Of them, frames with a good CRC
+	uint32_t lost;			// Sequence numbers never seen
+	uint32_t reordered;		// Duplicate or late sequence numbers
+	uint32_t badCrc;
+	uint32_t other;			// Frames of message IDs that did not fit in msgs
+	uint32_t rateCount;
+	float rate;
+	int64_t rateTime;
+	int64_t lastSeen;
+	HEALTH_MSG_t msgs[HEALTH_MSG_SLOTS];
+} HEALTH_STREAM_t;
+
+// One line of the diagnostics screen and log
+typedef struct {
+	uint8_t sysid;
+	uint8_t compid;
+	float rate;
+	float loss;				// Percent of sequence numbers lost
+	float crcError;			// Percent of frames with a bad CRC
+	uint32_t reordered;
+	uint32_t jitterMsgid;	// Fastest message ID
+	int32_t jitter;			// Its jitter (us)
+	int64_t lastSeen;
+} HEALTH_SUMMARY_t;
+
+void health_time(int64_t now);
+void health_frame(const FRAME_t *frame, void *arg);
+void health_bad_crc(const FRAME_t *frame, void *arg);
+int health_summary(HEALTH_SUMMARY_t *out, int max);
+void health_totals(uint32_t *received, uint32_t *lost);
+void health_report(int64_t now);
+
+#endif /* MAIN_HEALTH_H_ */
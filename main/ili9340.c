@@ -1,13 +1,12 @@
 #include <string.h>
 #include <math.h>
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include "esp_log.h"
 
+#include "os.h"
+#include "trace.h"
 #include "ili9340.h"
 
 #define TAG "ILI9340"
@@ -43,7 +42,7 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO
 		gpio_pad_select_gpio( GPIO_RESET );
 		gpio_set_direction( GPIO_RESET, GPIO_MODE_OUTPUT );
 		gpio_set_level( GPIO_RESET, 0 );
-		vTaskDelay( pdMS_TO_TICKS( 100 ) );
+		os_delay_ms( 100 );
 		gpio_set_level( GPIO_RESET, 1 );
 	}
 
@@ -83,6 +82,106 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO
 }
 
 
+// Traffic per drawing primitive. Only the TFT task draws, so no lock.
+static SPI_STATS_t spiStats[SPI_PRIMS];
+static uint32_t spiBusBytes = 0;	// Always counted, for the bus utilization
+static int spiDc = 0;
+#if CONFIG_SPI_STATS || CONFIG_TRACE
+static SPI_PRIM_t spiPrim = SPI_PRIM_OTHER;
+#endif
+
+static const char *spiPrimNames[SPI_PRIMS] = {
+	"other", "pixel", "multipixels", "fillrect", "fillscreen", "line", "rect", "rectangle",
+	"triangle", "circle", "fillcircle", "roundrect", "arrow", "fillarrow", "char", "string",
+};
+
+static void spi_master_set_dc(TFT_t * dev, int mode)
+{
+	gpio_set_level( dev->_dc, mode );
+	spiDc = mode;
+}
+
+#if CONFIG_SPI_STATS || CONFIG_TRACE
+// Only the outermost primitive takes the tag. Nested ones leave it alone.
+SPI_SCOPE_t spi_scope_begin(SPI_PRIM_t prim)
+{
+	SPI_SCOPE_t scope = { .previous = spiPrim, .start = 0 };
+	if (spiPrim == SPI_PRIM_OTHER) {
+		spiPrim = prim;
+		TRACE(TRACE_DRAW_BEGIN, prim, 0);
+#if CONFIG_SPI_STATS
+		spiStats[prim].calls++;
+		scope.start = os_time_us();
+#endif
+	}
+	return scope;
+}
+
+void spi_scope_end(SPI_SCOPE_t *scope)
+{
+	if (scope->previous != SPI_PRIM_OTHER) return;
+#if CONFIG_SPI_STATS
+	spiStats[spiPrim].time += os_time_us() - scope->start;
+#endif
+	TRACE(TRACE_DRAW_END, spiPrim, 0);
+	spiPrim = SPI_PRIM_OTHER;
+}
+#endif
+
+// Bytes sent since boot. Other tasks may read it.
+uint32_t spi_bus_bytes(void)
+{
+	return spiBusBytes;
+}
+
+uint32_t spi_bus_hz(void)
+{
+	return SPI_Frequency;
+}
+
+void spi_stats_get(SPI_STATS_t *out)
+{
+	memcpy(out, spiStats, sizeof(spiStats));
+}
+
+void spi_stats_reset(void)
+{
+	memset(spiStats, 0, sizeof(spiStats));
+}
+
+// Log the primitives with traffic, most SPI time first
+void spi_stats_report(void)
+{
+	int order[SPI_PRIMS];
+	int count = 0;
+	SPI_STATS_t total = {0};
+	for (int i=0; i<SPI_PRIMS; i++) {
+		const SPI_STATS_t *s = &spiStats[i];
+		if (s->transactions == 0 && s->calls == 0) continue;
+		int j = count++;
+		while (j > 0 && spiStats[order[j-1]].spiTime < s->spiTime) {
+			order[j] = order[j-1];
+			j--;
+		}
+		order[j] = i;
+		total.calls += s->calls;
+		total.transactions += s->transactions;
+		total.dataBytes += s->dataBytes;
+		total.commandBytes += s->commandBytes;
+		total.spiTime += s->spiTime;
+	}
+	if (count == 0) return;
+	ESP_LOGI(TAG, "%-11s %7s %8s %7s %9s %8s %8s %8s", "primitive", "calls", "trans", "tr/call", "data", "command", "spi_ms", "ms");
+	for (int k=0; k<count; k++) {
+		const SPI_STATS_t *s = &spiStats[order[k]];
+		ESP_LOGI(TAG, "%-11s %7u %8u %7u %9u %8u %8u %8u", spiPrimNames[order[k]], s->calls, s->transactions,
+			s->calls ? s->transactions / s->calls : 0, s->dataBytes, s->commandBytes,
+			(uint32_t)(s->spiTime / 1000), (uint32_t)(s->time / 1000));
+	}
+	ESP_LOGI(TAG, "%-11s %7u %8u %7s %9u %8u %8u", "total", total.calls, total.transactions, "",
+		total.dataBytes, total.commandBytes, (uint32_t)(total.spiTime / 1000));
+}
+
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength)
 {
 	spi_transaction_t SPITransaction;
@@ -92,13 +191,29 @@ bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, s
 		memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
 		SPITransaction.length = DataLength * 8;
 		SPITransaction.tx_buffer = Data;
+#if CONFIG_SPI_STATS
+		int64_t start = os_time_us();
+#endif
+		TRACE(TRACE_SPI_BEGIN, spiDc, DataLength);
 #if 1
 		ret = spi_device_transmit( SPIHandle, &SPITransaction );
 #endif
 #if 0
 		ret = spi_device_polling_transmit( SPIHandle, &SPITransaction );
 #endif
+		TRACE(TRACE_SPI_END, spiDc, DataLength);
 		assert(ret==ESP_OK); 
+		spiBusBytes += DataLength;
+#if CONFIG_SPI_STATS
+		SPI_STATS_t *stats = &spiStats[spiPrim];
+		stats->spiTime += os_time_us() - start;
+		stats->transactions++;
+		if (spiDc == SPI_Command_Mode) {
+			stats->commandBytes += DataLength;
+		} else {
+			stats->dataBytes += DataLength;
+		}
+#endif
 	}
 
 	return true;
@@ -108,7 +223,7 @@ bool spi_master_write_comm_byte(TFT_t * dev, uint8_t cmd)
 {
 	static uint8_t Byte = 0;
 	Byte = cmd;
-	gpio_set_level( dev->_dc, SPI_Command_Mode );
+	spi_master_set_dc( dev, SPI_Command_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, &Byte, 1 );
 }
 
@@ -117,7 +232,7 @@ bool spi_master_write_comm_word(TFT_t * dev, uint16_t cmd)
 	static uint8_t Byte[2];
 	Byte[0] = (cmd >> 8) & 0xFF;
 	Byte[1] = cmd & 0xFF;
-	gpio_set_level( dev->_dc, SPI_Command_Mode );
+	spi_master_set_dc( dev, SPI_Command_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, Byte, 2 );
 }
 
@@ -126,7 +241,7 @@ bool spi_master_write_data_byte(TFT_t * dev, uint8_t data)
 {
 	static uint8_t Byte = 0;
 	Byte = data;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	spi_master_set_dc( dev, SPI_Data_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, &Byte, 1 );
 }
 
@@ -136,7 +251,7 @@ bool spi_master_write_data_word(TFT_t * dev, uint16_t data)
 	static uint8_t Byte[2];
 	Byte[0] = (data >> 8) & 0xFF;
 	Byte[1] = data & 0xFF;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	spi_master_set_dc( dev, SPI_Data_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, Byte, 2);
 }
 
@@ -147,41 +262,44 @@ bool spi_master_write_addr(TFT_t * dev, uint16_t addr1, uint16_t addr2)
 	Byte[1] = addr1 & 0xFF;
 	Byte[2] = (addr2 >> 8) & 0xFF;
 	Byte[3] = addr2 & 0xFF;
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	spi_master_set_dc( dev, SPI_Data_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, Byte, 4);
 }
 
+// Pixel data buffer shared by spi_master_write_color() and spi_master_write_colors().
+// Only the TFT task draws, and spi_device_transmit() returns after the DMA is done.
+static uint8_t ColorBuffer[SPI_COLOR_BUFFER_SIZE];
+
 bool spi_master_write_color(TFT_t * dev, uint16_t color, uint16_t size)
 {
-	static uint8_t Byte[1024];
+	uint8_t * Byte = ColorBuffer;
 	int index = 0;
 	for(int i=0;i<size;i++) {
 		Byte[index++] = (color >> 8) & 0xFF;
 		Byte[index++] = color & 0xFF;
 	}
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	spi_master_set_dc( dev, SPI_Data_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, Byte, size*2);
 }
 
 // Add 202001
 bool spi_master_write_colors(TFT_t * dev, uint16_t * colors, uint16_t size)
 {
-	static uint8_t Byte[1024];
+	uint8_t * Byte = ColorBuffer;
 	int index = 0;
 	for(int i=0;i<size;i++) {
 		Byte[index++] = (colors[i] >> 8) & 0xFF;
 		Byte[index++] = colors[i] & 0xFF;
 	}
-	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	spi_master_set_dc( dev, SPI_Data_Mode );
 	return spi_master_write_byte( dev->_SPIHandle, Byte, size*2);
 }
 
 
+// Rounded up to the scheduler tick by the OS layer
 void delayMS(int ms) {
-	int _ms = ms + (portTICK_PERIOD_MS - 1);
-	TickType_t xTicksToDelay = _ms / portTICK_PERIOD_MS;
-	ESP_LOGD(TAG, "ms=%d _ms=%d portTICK_PERIOD_MS=%d xTicksToDelay=%d",ms,_ms,portTICK_PERIOD_MS,xTicksToDelay);
-	vTaskDelay(xTicksToDelay);
+	ESP_LOGD(TAG, "ms=%d",ms);
+	os_delay_ms(ms);
 }
 
 
@@ -205,6 +323,7 @@ void lcdInit(TFT_t * dev, uint16_t model, int width, int height, int offsetx, in
 	dev->_model = model;
 	dev->_width = width;
 	dev->_height = height;
+	dev->_clip_height = height;
 	dev->_offsetx = offsetx;
 	dev->_offsety = offsety;
 	dev->_font_direction = DIRECTION0;
@@ -472,8 +591,9 @@ void lcdInit(TFT_t * dev, uint16_t model, int width, int height, int offsetx, in
 // y:Y coordinate
 // color:color
 void lcdDrawPixel(TFT_t * dev, uint16_t x, uint16_t y, uint16_t color){
+	SPI_SCOPE(SPI_PRIM_PIXEL);
 	if (x >= dev->_width) return;
-	if (y >= dev->_height) return;
+	if (y >= dev->_clip_height) return;
 
 	uint16_t _x = x + dev->_offsetx;
 	uint16_t _y = y + dev->_offsety;
@@ -524,8 +644,9 @@ void lcdDrawPixel(TFT_t * dev, uint16_t x, uint16_t y, uint16_t color){
 // size:Number of colors
 // colors:colors
 void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint16_t * colors) {
+    SPI_SCOPE(SPI_PRIM_MULTI_PIXELS);
     if (x+size > dev->_width) return;
-    if (y >= dev->_height) return;
+    if (y >= dev->_clip_height) return;
 
     ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
     uint16_t _x1 = x + dev->_offsetx;
@@ -587,10 +708,11 @@ void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint
 // y2:End Y coordinate
 // color:color
 void lcdDrawFillRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_FILL_RECT);
 	if (x1 >= dev->_width) return;
 	if (x2 >= dev->_width) x2=dev->_width-1;
-	if (y1 >= dev->_height) return;
-	if (y2 >= dev->_height) y2=dev->_height-1;
+	if (y1 >= dev->_clip_height) return;
+	if (y2 >= dev->_clip_height) y2=dev->_clip_height-1;
 
 	ESP_LOGD(TAG,"offset(x)=%d offset(y)=%d",dev->_offsetx,dev->_offsety);
 	uint16_t _x1 = x1 + dev->_offsetx;
@@ -715,6 +837,7 @@ void lcdBGRFilter(TFT_t * dev) {
 // Fill screen
 // color:color
 void lcdFillScreen(TFT_t * dev, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_FILL_SCREEN);
 	lcdDrawFillRect(dev, 0, 0, dev->_width-1, dev->_height-1, color);
 }
 
@@ -725,6 +848,7 @@ void lcdFillScreen(TFT_t * dev, uint16_t color) {
 // y2:End Y coordinate
 // color:color 
 void lcdDrawLine(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_LINE);
 	int i;
 	int dx,dy;
 	int sx,sy;
@@ -773,6 +897,7 @@ void lcdDrawLine(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2
 // y2:End   Y coordinate
 // color:color
 void lcdDrawRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_RECT);
 	lcdDrawLine(dev, x1, y1, x2, y1, color);
 	lcdDrawLine(dev, x2, y1, x2, y2, color);
 	lcdDrawLine(dev, x2, y2, x1, y2, color);
@@ -791,6 +916,7 @@ void lcdDrawRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2
 // x1 = x * cos(angle) - y * sin(angle)
 // y1 = x * sin(angle) + y * cos(angle)
 void lcdDrawRectAngle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
+        SPI_SCOPE(SPI_PRIM_RECT_ANGLE);
         double xd,yd,rd;
         int x1,y1;
         int x2,y2;
@@ -834,6 +960,7 @@ void lcdDrawRectAngle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_
 // x1 = x * cos(angle) - y * sin(angle)
 // y1 = x * sin(angle) + y * cos(angle)
 void lcdDrawTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h, uint16_t angle, uint16_t color) {
+        SPI_SCOPE(SPI_PRIM_TRIANGLE);
         double xd,yd,rd;
         int x1,y1;
         int x2,y2;
@@ -865,6 +992,7 @@ void lcdDrawTriangle(TFT_t * dev, uint16_t xc, uint16_t yc, uint16_t w, uint16_t
 // r:radius
 // color:color
 void lcdDrawCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_CIRCLE);
 	int x;
 	int y;
 	int err;
@@ -889,6 +1017,7 @@ void lcdDrawCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t c
 // r:radius
 // color:color
 void lcdDrawFillCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_FILL_CIRCLE);
 	int x;
 	int y;
 	int err;
@@ -918,6 +1047,7 @@ void lcdDrawFillCircle(TFT_t * dev, uint16_t x0, uint16_t y0, uint16_t r, uint16
 // r:radius
 // color:color
 void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t r, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_ROUND_RECT);
 	int x;
 	int y;
 	int err;
@@ -969,6 +1099,7 @@ void lcdDrawRoundRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16
 // color:color
 // Thanks http://k-hiura.cocolog-nifty.com/blog/2010/11/post-2a62.html
 void lcdDrawArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,uint16_t w,uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_ARROW);
 	double Vx= x1 - x0;
 	double Vy= y1 - y0;
 	double v = sqrt(Vx*Vx+Vy*Vy);
@@ -998,6 +1129,7 @@ void lcdDrawArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,u
 // w:Width of the botom
 // color:color
 void lcdDrawFillArrow(TFT_t * dev, uint16_t x0,uint16_t y0,uint16_t x1,uint16_t y1,uint16_t w,uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_FILL_ARROW);
 	double Vx= x1 - x0;
 	double Vy= y1 - y0;
 	double v = sqrt(Vx*Vx+Vy*Vy);
@@ -1043,6 +1175,7 @@ uint16_t rgb565_conv(uint16_t r,uint16_t g,uint16_t b) {
 // ascii: ascii code
 // color:color
 int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t ascii, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_CHAR);
 	uint16_t xx,yy,bit,ofs;
 	unsigned char fonts[128]; // font pattern
 	unsigned char pw, ph;
@@ -1172,6 +1305,7 @@ int lcdDrawChar(TFT_t * dev, FontxFile *fxs, uint16_t x, uint16_t y, uint8_t asc
 }
 
 int lcdDrawString(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t * ascii, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_STRING);
 	int length = strlen((char *)ascii);
 	if(_DEBUG_)printf("lcdDrawString length=%d\n",length);
 	for(int i=0;i<length;i++) {
@@ -1200,6 +1334,7 @@ int lcdDrawString(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t *
 // sjis: SJIS code
 // color:color
 int lcdDrawSJISChar(TFT_t * dev, FontxFile *fxs, uint16_t x,uint16_t y,uint16_t sjis,uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_CHAR);
 	uint16_t xx,yy,bit,ofs;
 	unsigned char fonts[128]; // font pattern
 	unsigned char pw, ph;
@@ -1307,6 +1442,7 @@ int lcdDrawSJISChar(TFT_t * dev, FontxFile *fxs, uint16_t x,uint16_t y,uint16_t
 // utf8: UTF8 code
 // color:color
 int lcdDrawUTF8Char(TFT_t * dev, FontxFile *fx, uint16_t x,uint16_t y,uint8_t *utf8,uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_CHAR);
 	uint16_t sjis[1];
 
 	sjis[0] = UTF2SJIS(utf8);
@@ -1320,6 +1456,7 @@ int lcdDrawUTF8Char(TFT_t * dev, FontxFile *fx, uint16_t x,uint16_t y,uint8_t *u
 // utfs: UTF8 string
 // color:color
 int lcdDrawUTF8String(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, unsigned char *utfs, uint16_t color) {
+	SPI_SCOPE(SPI_PRIM_STRING);
 
 	int i;
 	int spos;
@@ -1389,6 +1526,12 @@ void lcdBacklightOn(TFT_t * dev) {
 	}
 }
 
+// Drop drawing from row height down, so the rows below keep what is on them.
+// height:Rows that are drawn. dev->_height draws all.
+void lcdSetClipHeight(TFT_t * dev, uint16_t height) {
+	dev->_clip_height = (height < dev->_height) ? height : dev->_height;
+}
+
 // Vertical Scrolling Definition
 // tfa:Top Fixed Area
 // vsa:Vertical Scrolling Area
@@ -15,15 +15,68 @@
 #define PURPLE			0xF81F
 
 
+// Size of the pixel data buffer used for SPI DMA
+#define SPI_COLOR_BUFFER_SIZE	1024
+
 #define DIRECTION0		0
 #define DIRECTION90		1
 #define DIRECTION180		2
 #define DIRECTION270		3
 
+// SPI traffic accounting. Transactions are counted for the outermost drawing
+// primitive on the call stack, so a string owns the traffic of its characters.
+typedef enum {
+	SPI_PRIM_OTHER = 0,		// Init, display control and scrolling
+	SPI_PRIM_PIXEL,
+	SPI_PRIM_MULTI_PIXELS,
+	SPI_PRIM_FILL_RECT,
+	SPI_PRIM_FILL_SCREEN,
+	SPI_PRIM_LINE,
+	SPI_PRIM_RECT,
+	SPI_PRIM_RECT_ANGLE,
+	SPI_PRIM_TRIANGLE,
+	SPI_PRIM_CIRCLE,
+	SPI_PRIM_FILL_CIRCLE,
+	SPI_PRIM_ROUND_RECT,
+	SPI_PRIM_ARROW,
+	SPI_PRIM_FILL_ARROW,
+	SPI_PRIM_CHAR,
+	SPI_PRIM_STRING,
+	SPI_PRIMS,
+} SPI_PRIM_t;
+
+typedef struct {
+	uint32_t calls;			// Outermost calls
+	uint32_t transactions;
+	uint32_t dataBytes;		// Sent with DC high: pixels and parameters
+	uint32_t commandBytes;	// Sent with DC low
+	int64_t spiTime;		// Microseconds in spi_device_transmit()
+	int64_t time;			// Microseconds in the primitive, drawing included
+} SPI_STATS_t;
+
+#define SPI_STATS_REPORT_US	(60 * 1000 * 1000)
+
+// Scopes also mark the draw spans of the trace
+#if CONFIG_SPI_STATS || CONFIG_TRACE
+typedef struct {
+	SPI_PRIM_t previous;
+	int64_t start;
+} SPI_SCOPE_t;
+
+SPI_SCOPE_t spi_scope_begin(SPI_PRIM_t prim);
+void spi_scope_end(SPI_SCOPE_t *scope);
+
+// Tag the rest of the enclosing block, early returns included
+#define SPI_SCOPE(prim)	SPI_SCOPE_t spiScope_ __attribute__((cleanup(spi_scope_end))) = spi_scope_begin(prim)
+#else
+#define SPI_SCOPE(prim)
+#endif
+
 typedef struct {
 	uint16_t _model;
 	uint16_t _width;
 	uint16_t _height;
+	uint16_t _clip_height;	// Rows from here down are not drawn
 	uint16_t _offsetx;
 	uint16_t _offsety;
 	uint16_t _font_direction;
@@ -81,8 +134,14 @@ void lcdSetFontUnderLine(TFT_t * dev, uint16_t color);
 void lcdUnsetFontUnderLine(TFT_t * dev);
 void lcdBacklightOff(TFT_t * dev);
 void lcdBacklightOn(TFT_t * dev);
+void lcdSetClipHeight(TFT_t * dev, uint16_t height);
 void lcdSetScrollArea(TFT_t * dev, uint16_t tfa, uint16_t vsa, uint16_t bfa);
 void lcdResetScrollArea(TFT_t * dev, uint16_t vsa);
 void lcdScroll(TFT_t * dev, uint16_t vsp);
+void spi_stats_get(SPI_STATS_t *out);
+void spi_stats_reset(void);
+void spi_stats_report(void);
+uint32_t spi_bus_bytes(void);
+uint32_t spi_bus_hz(void);
 #endif /* MAIN_ILI9340_H_ */
 
@@ -0,0 +1,115 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "latency.h"
+#include "trace.h"
+
+static const char *TAG = "LATENCY";
+
+// Upper bucket edges in microseconds. The last bucket takes everything above.
+static const uint32_t edges[LATENCY_BUCKETS-1] = {
+	100, 200, 500, 1000, 2000, 3000, 5000, 7000, 10000, 15000, 20000, 30000,
+	40000, 50000, 70000, 100000, 150000, 200000, 300000, 500000, 700000, 1000000, 2000000,
+};
+
+static const char *names[LATENCY_STAGES] = { "decode", "send", "queue", "draw", "total" };
+
+// Histograms of the current window, and the summary of the last window with updates.
+// The summary is also read by other tasks.
+static LATENCY_HIST_t window[LATENCY_STAGES];
+static LATENCY_SUMMARY_t last[LATENCY_STAGES];
+static OS_LOCK_t lastLock = OS_LOCK_INITIALIZER;
+static int64_t windowStart = 0;
+
+void latency_hist_add(LATENCY_HIST_t *h, uint32_t us)
+{
+	int bucket = 0;
+	while (bucket < LATENCY_BUCKETS-1 && us > edges[bucket]) bucket++;
+	h->buckets[bucket]++;
+	h->count++;
+	if (us > h->max) h->max = us;
+}
+
+uint32_t latency_hist_percentile(const LATENCY_HIST_t *h, int percent)
+{
+	if (h->count == 0) return 0;
+	// Rank of the sample, rounded up
+	uint32_t rank = ((uint64_t)h->count * percent + 99) / 100;
+	uint32_t seen = 0;
+	for (int bucket=0; bucket<LATENCY_BUCKETS-1; bucket++) {
+		seen += h->buckets[bucket];
+		if (seen >= rank) return (edges[bucket] < h->max) ? edges[bucket] : h->max;
+	}
+	return h->max;
+}
+
+const char *latency_stage_name(int stage)
+{
+	return (stage >= 0 && stage < LATENCY_STAGES) ? names[stage] : "?";
+}
+
+static uint32_t elapsed(int64_t from, int64_t to)
+{
+	return (to > from) ? to - from : 0;
+}
+
+void latency_update(int64_t received, int64_t decoded, int64_t queued, int64_t start, int64_t done)
+{
+	latency_hist_add(&window[LATENCY_DECODE], elapsed(received, decoded));
+	latency_hist_add(&window[LATENCY_HANDOFF], elapsed(decoded, queued));
+	latency_hist_add(&window[LATENCY_QUEUE], elapsed(queued, start));
+	latency_hist_add(&window[LATENCY_DRAW], elapsed(start, done));
+	latency_hist_add(&window[LATENCY_TOTAL], elapsed(received, done));
+#if CONFIG_TRACE
+	trace_latency(elapsed(received, done));
+#endif
+}
+
+// Close the window every LATENCY_REPORT_US. A window with updates is logged and
+// becomes the summary. Returns true when the summary changed.
+bool latency_report(int64_t now)
+{
+	if (windowStart == 0) windowStart = now;
+	if (now - windowStart < LATENCY_REPORT_US) return false;
+	windowStart = now;
+	if (window[LATENCY_TOTAL].count == 0) return false;
+
+	LATENCY_SUMMARY_t summary[LATENCY_STAGES];
+	for (int stage=0; stage<LATENCY_STAGES; stage++) {
+		LATENCY_HIST_t *h = &window[stage];
+		summary[stage].count = h->count;
+		summary[stage].p50 = latency_hist_percentile(h, 50);
+		summary[stage].p95 = latency_hist_percentile(h, 95);
+		summary[stage].p99 = latency_hist_percentile(h, 99);
+		summary[stage].max = h->max;
+	}
+	os_lock(&lastLock);
+	memcpy(last, summary, sizeof(last));
+	os_unlock(&lastLock);
+	const LATENCY_SUMMARY_t *t = &last[LATENCY_TOTAL];
+	ESP_LOGI(TAG, "updates=%u total p50=%uus p95=%uus p99=%uus max=%uus",
+		t->count, t->p50, t->p95, t->p99, t->max);
+	ESP_LOGI(TAG, "p95 decode=%uus send=%uus queue=%uus draw=%uus",
+		last[LATENCY_DECODE].p95, last[LATENCY_HANDOFF].p95, last[LATENCY_QUEUE].p95, last[LATENCY_DRAW].p95);
+	memset(window, 0, sizeof(window));
+	return true;
+}
+
+// Summary of every stage. Returns false until a window had updates. Any task.
+bool latency_summary(LATENCY_SUMMARY_t out[LATENCY_STAGES])
+{
+	os_lock(&lastLock);
+	memcpy(out, last, sizeof(last));
+	os_unlock(&lastLock);
+	return out[LATENCY_TOTAL].count != 0;
+}
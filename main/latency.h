@@ -0,0 +1,49 @@
+#ifndef MAIN_LATENCY_H_
+#define MAIN_LATENCY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Telemetry-to-photon latency.
+// Every redraw caused by telemetry carries the time its datagram was received,
+// decoded and queued. The TFT task adds the start of drawing and the end of the
+// last SPI transaction and sorts the five stages into fixed bucket histograms.
+
+#define LATENCY_BUCKETS		24
+#define LATENCY_REPORT_US	(10 * 1000 * 1000)
+
+typedef enum {
+	LATENCY_DECODE = 0,		// Datagram received to frame decode
+	LATENCY_HANDOFF,		// Decode to xQueueSend() to the TFT task
+	LATENCY_QUEUE,			// Waiting in xQueueCmd
+	LATENCY_DRAW,			// Start of drawing to the end of the last SPI transaction
+	LATENCY_TOTAL,			// Receive to photon
+	LATENCY_STAGES,
+} LATENCY_STAGE_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t max;
+	uint32_t buckets[LATENCY_BUCKETS];
+} LATENCY_HIST_t;
+
+// Percentiles are the upper edge of their bucket, never more than max
+typedef struct {
+	uint32_t count;
+	uint32_t p50;
+	uint32_t p95;
+	uint32_t p99;
+	uint32_t max;
+} LATENCY_SUMMARY_t;
+
+void latency_hist_add(LATENCY_HIST_t *h, uint32_t us);
+uint32_t latency_hist_percentile(const LATENCY_HIST_t *h, int percent);
+const char *latency_stage_name(int stage);
+
+// Only the TFT task calls these
+void latency_update(int64_t received, int64_t decoded, int64_t queued, int64_t start, int64_t done);
+bool latency_report(int64_t now);
+// Any task
+bool latency_summary(LATENCY_SUMMARY_t out[LATENCY_STAGES]);
+
+#endif /* MAIN_LATENCY_H_ */
@@ -11,19 +11,22 @@
 #include <limits.h>
 #include <float.h>
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
-
-#include "esp_err.h"
 #include "esp_log.h"
-#include "esp_system.h"
-
-#include "driver/gpio.h"
 
+#include "os.h"
 #include "ili9340.h"
 #include "fontx.h"
 #include "cmd.h"
+#include "boot.h"
+#include "wifi.h"
+#include "telemetry.h"
+#include "vehicle.h"
+#include "health.h"
+#include "gcs.h"
+#include "recorder.h"
+#include "evlog.h"
+#include "latency.h"
+#include "perf.h"
 
 // for M5Stack
 #define SCREEN_WIDTH	320
@@ -33,125 +36,417 @@
 #define RESET_GPIO		33
 #define BL_GPIO			32
 #define DISPLAY_LENGTH	26
-#define GPIO_INPUT_A	GPIO_NUM_39
-#define GPIO_INPUT_B	GPIO_NUM_38
-#define GPIO_INPUT_C	GPIO_NUM_37
 
-extern QueueHandle_t xQueueCmd;
+// SPIFFS mount point of the fonts. Host builds point it at the fonts directory.
+#ifndef FONT_DIR
+#define FONT_DIR		"/fonts"
+#endif
 
-// Left Button Monitoring
-void buttonA(void *pvParameters)
+extern OS_QUEUE_t xQueueCmd;
+
+//#define CONFIG_ESP_FONT_GOTHIC	1
+//#define CONFIG_ESP_FONT_MINCYO	0
+
+// Rows of the General Info screen. A row is redrawn only when a frame of its message arrives
+// and the formatted value changed.
+typedef struct {
+	const char *label;
+	uint32_t msgid;
+	void (*format)(const TELEMETRY_t *t, char *value, int size);
+} GENERAL_ROW_t;
+
+// Values come from any sender on the UDP port, so a huge float must not overrun the buffer
+
+static void formatAirspeed(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%f", t->vfrHud.airspeed); }
+static void formatGroundspeed(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%f", t->vfrHud.groundspeed); }
+static void formatAlt(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%f", t->vfrHud.alt); }
+static void formatClimb(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%f", t->vfrHud.climb); }
+static void formatHeading(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%d", t->vfrHud.heading); }
+static void formatThrottle(const TELEMETRY_t *t, char *value, int size) { snprintf(value, size, "%d", t->vfrHud.throttle); }
+#if CONFIG_TELEMETRY_ATTITUDE
+static void formatAttitude(const TELEMETRY_t *t, char *value, int size)
 {
-	ESP_LOGI(pcTaskGetTaskName(0), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_BUTTON_LEFT;
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
+	snprintf(value, size, "%.1f/%.1f", t->attitude.roll * 180.0 / M_PI, t->attitude.pitch * 180.0 / M_PI);
+}
+#endif
+#if CONFIG_TELEMETRY_GPS
+static void formatGps(const TELEMETRY_t *t, char *value, int size)
+{
+	snprintf(value, size, "fix=%d sat=%d", t->gpsRawInt.fix_type, t->gpsRawInt.satellites_visible);
+}
+#endif
+#if CONFIG_TELEMETRY_BATTERY
+static void formatBattery(const TELEMETRY_t *t, char *value, int size)
+{
+	snprintf(value, size, "%.2fV %d%%", t->sysStatus.voltage_battery / 1000.0, t->sysStatus.battery_remaining);
+}
+#endif
 
-	// set the GPIO as a input
-	gpio_pad_select_gpio(GPIO_INPUT_A);
-	gpio_set_direction(GPIO_INPUT_A, GPIO_MODE_DEF_INPUT);
+static const GENERAL_ROW_t generalRows[] = {
+	{ "airspeed    : ", MAVLINK_MSG_ID_VFR_HUD, formatAirspeed },
+	{ "groundspeed : ", MAVLINK_MSG_ID_VFR_HUD, formatGroundspeed },
+	{ "alt         : ", MAVLINK_MSG_ID_VFR_HUD, formatAlt },
+	{ "climb       : ", MAVLINK_MSG_ID_VFR_HUD, formatClimb },
+	{ "heading     : ", MAVLINK_MSG_ID_VFR_HUD, formatHeading },
+	{ "throttle    : ", MAVLINK_MSG_ID_VFR_HUD, formatThrottle },
+#if CONFIG_TELEMETRY_ATTITUDE
+	{ "roll/pitch  : ", MAVLINK_MSG_ID_ATTITUDE, formatAttitude },
+#endif
+#if CONFIG_TELEMETRY_GPS
+	{ "gps         : ", MAVLINK_MSG_ID_GPS_RAW_INT, formatGps },
+#endif
+#if CONFIG_TELEMETRY_BATTERY
+	{ "battery     : ", MAVLINK_MSG_ID_SYS_STATUS, formatBattery },
+#endif
+};
+#define GENERAL_ROWS	(sizeof(generalRows)/sizeof(generalRows[0]))
+#define GENERAL_VALUE	24
 
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_A);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetTaskName(0), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_A);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
+// Show startup stages and their times.
+// Labels are drawn once, then only the values that changed are redrawn.
+static void drawBoot(TFT_t * dev, FontxFile *fx, uint8_t fontWidth, uint8_t fontHeight, int64_t *shown)
+{
+	uint8_t ascii[44];
+	uint16_t xValue = (fontWidth * 12) - 1;
+	uint16_t ypos = (fontHeight*3)-1;
+	for (int stage=0; stage<BOOT_STAGE_MAX; stage++) {
+		int64_t value = boot_time(stage);
+		if (value == 0 && boot_failed(stage)) value = -1;
+		if (shown[stage] == INT64_MIN) {
+			sprintf((char *)ascii, "%-10s: ", boot_stage_name(stage));
+			lcdDrawString(dev, fx, 0, ypos, ascii, CYAN);
+		} else if (shown[stage] == value) {
+			ypos = ypos + fontHeight;
+			continue;
 		}
-		vTaskDelay(1);
+		lcdDrawFillRect(dev, xValue, ypos-fontHeight+1, SCREEN_WIDTH-1, ypos, BLACK);
+		if (value > 0) {
+			sprintf((char *)ascii, "%lldms", value / 1000);
+			lcdDrawString(dev, fx, xValue, ypos, ascii, GREEN);
+		} else if (value < 0) {
+			strcpy((char *)ascii, "failed");
+			lcdDrawString(dev, fx, xValue, ypos, ascii, RED);
+		} else {
+			strcpy((char *)ascii, "waiting");
+			lcdDrawString(dev, fx, xValue, ypos, ascii, GRAY);
+		}
+		shown[stage] = value;
+		ypos = ypos + fontHeight;
 	}
 }
 
-// Middle Button Monitoring
-void buttonB(void *pvParameters)
+// Show WiFi link state as a dot in the header
+static void drawLink(TFT_t * dev, uint16_t x, uint16_t y, int state)
 {
-	ESP_LOGI(pcTaskGetTaskName(0), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_BUTTON_MIDDLE;
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
+	uint16_t color = RED;
+	if (state == LINK_CONNECTING) color = YELLOW;
+	if (state == LINK_UP) color = GREEN;
+	lcdDrawFillCircle(dev, x, y, 6, color);
+}
+
+#if CONFIG_RECORDER
+// Red while recording, yellow while records are dropped
+static void drawRecorder(TFT_t * dev, uint16_t x, uint16_t y, RECORDER_STATE_t state)
+{
+	uint16_t color = BLACK;
+	if (state == RECORDER_ON) color = RED;
+	if (state == RECORDER_DROPPING) color = YELLOW;
+	lcdDrawFillRect(dev, x-5, y-5, x+5, y+5, color);
+}
+#endif
 
-	// set the GPIO as a input
-	gpio_pad_select_gpio(GPIO_INPUT_B);
-	gpio_set_direction(GPIO_INPUT_B, GPIO_MODE_DEF_INPUT);
+// Show the selected vehicle in the header
+static void drawVehicle(TFT_t * dev, FontxFile *fx, uint16_t x, uint16_t y, uint8_t fontWidth, uint8_t fontHeight, uint8_t sysid)
+{
+	uint8_t ascii[8];
+	lcdDrawFillRect(dev, x, y-fontHeight+1, x+(fontWidth*4)-1, y, BLACK);
+	if (sysid == VEHICLE_NONE) return;
+	sprintf((char *)ascii, "#%d", sysid);
+	lcdDrawString(dev, fx, x, y, ascii, YELLOW);
+}
 
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_B);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetTaskName(0), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_B);
-				if (level == 1) break;
-				vTaskDelay(1);
+// Link Health screen. Two lines per (sysid, compid) stream, redrawn when the text changes.
+#define HEALTH_LINES		10
+#define HEALTH_TEXT			32
+#define HEALTH_REFRESH_MS	1000
+#define HEALTH_STALE_US		(3*1000*1000)
+
+static void drawHealth(TFT_t * dev, FontxFile *fx, uint8_t fontHeight, char shown[][HEALTH_TEXT], uint16_t *shownColor)
+{
+	HEALTH_SUMMARY_t sum[HEALTH_STREAMS];
+	int count = health_summary(sum, HEALTH_STREAMS);
+	int64_t now = os_time_us();
+	int lines = (SCREEN_HEIGHT - fontHeight) / fontHeight;
+	if (lines > HEALTH_LINES) lines = HEALTH_LINES;
+	uint16_t ypos = (fontHeight*2)-1;
+	for (int line=0; line<lines; line++, ypos += fontHeight) {
+		char text[HEALTH_TEXT];
+		uint16_t color = CYAN;
+		text[0] = 0;
+		int i = line / 2;
+		if (i < count) {
+			if (line % 2 == 0) {
+				snprintf(text, sizeof(text), "%d/%d %.0fHz jit %dms",
+					sum[i].sysid, sum[i].compid, sum[i].rate, sum[i].jitter / 1000);
+			} else {
+				snprintf(text, sizeof(text), " loss%.1f%% ooo%u crc%.1f%%",
+					sum[i].loss, sum[i].reordered, sum[i].crcError);
 			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
+			if (sum[i].loss > 5.0 || sum[i].crcError > 1.0) color = RED;
+			if (now - sum[i].lastSeen > HEALTH_STALE_US) color = GRAY;
+		} else if (line == 0 && count == 0) {
+			strcpy(text, "No MAVLink stream");
+			color = GRAY;
 		}
-		vTaskDelay(1);
+		if (strcmp(text, shown[line]) == 0 && color == shownColor[line]) continue;
+		lcdDrawFillRect(dev, 0, ypos-fontHeight+1, SCREEN_WIDTH-1, ypos, BLACK);
+		if (text[0]) lcdDrawString(dev, fx, 0, ypos, (uint8_t *)text, color);
+		strcpy(shown[line], text);
+		shownColor[line] = color;
 	}
 }
 
-// Right Button Monitoring
-void buttonC(void *pvParameters)
+// Latency screen. Percentiles of the last window with telemetry redraws, in ms.
+#define LATENCY_LINES		(LATENCY_STAGES + 2)
+#define LATENCY_TEXT		32
+#define LATENCY_WARN_US		(100*1000)
+#define LATENCY_BAD_US		(300*1000)
+
+static void formatMs(char *out, uint32_t us)
 {
-	ESP_LOGI(pcTaskGetTaskName(0), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_BUTTON_RIGHT;
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
+	if (us < 100000) {
+		sprintf(out, "%5.1f", us / 1000.0);
+	} else {
+		sprintf(out, "%5.0f", us / 1000.0);
+	}
+}
 
-	// set the GPIO as a input
-	gpio_pad_select_gpio(GPIO_INPUT_C);
-	gpio_set_direction(GPIO_INPUT_C, GPIO_MODE_DEF_INPUT);
+static void drawLatency(TFT_t * dev, FontxFile *fx, uint8_t fontHeight, char shown[][LATENCY_TEXT], uint16_t *shownColor)
+{
+	LATENCY_SUMMARY_t sum[LATENCY_STAGES];
+	bool valid = latency_summary(sum);
+	uint16_t ypos = (fontHeight*2)-1;
+	for (int line=0; line<LATENCY_LINES; line++, ypos += fontHeight) {
+		char text[LATENCY_TEXT];
+		uint16_t color = CYAN;
+		text[0] = 0;
+		int stage = line - 1;
+		if (!valid) {
+			if (line == 0) strcpy(text, "No telemetry drawn yet");
+			color = GRAY;
+		} else if (line == 0) {
+			strcpy(text, "ms      p50  p95  p99  max");
+			color = YELLOW;
+		} else if (stage < LATENCY_STAGES) {
+			char p50[12], p95[12], p99[12], max[12];
+			formatMs(p50, sum[stage].p50);
+			formatMs(p95, sum[stage].p95);
+			formatMs(p99, sum[stage].p99);
+			formatMs(max, sum[stage].max);
+			// 6 + 4 * 5 = 26 characters of the 12px font fill the 320px screen
+			snprintf(text, sizeof(text), "%-6s%s%s%s%s", latency_stage_name(stage), p50, p95, p99, max);
+			if (stage == LATENCY_TOTAL && sum[stage].p95 > LATENCY_WARN_US) color = YELLOW;
+			if (stage == LATENCY_TOTAL && sum[stage].p95 > LATENCY_BAD_US) color = RED;
+		} else {
+			snprintf(text, sizeof(text), "%u updates in %ds", sum[LATENCY_TOTAL].count, LATENCY_REPORT_US / 1000000);
+			color = GRAY;
+		}
+		if (strcmp(text, shown[line]) == 0 && color == shownColor[line]) continue;
+		lcdDrawFillRect(dev, 0, ypos-fontHeight+1, SCREEN_WIDTH-1, ypos, BLACK);
+		if (text[0]) lcdDrawString(dev, fx, 0, ypos, (uint8_t *)text, color);
+		strcpy(shown[line], text);
+		shownColor[line] = color;
+	}
+}
 
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_C);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetTaskName(0), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_C);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
+#if CONFIG_PERF_OVERLAY
+// Performance overlay. Two lines of the small font at the bottom of every screen.
+// While it is shown the screens are clipped above it, and a cell is redrawn only when its text changes.
+#define OVERLAY_LINES		2
+#define OVERLAY_TEXT		12
+#define OVERLAY_REFRESH_MS	1000
+#define OVERLAY_IDLE_WARN	25		// Percent idle
+#define OVERLAY_IDLE_BAD	10
+#define OVERLAY_SPI_WARN	70		// Percent of the bus
+#define OVERLAY_SPI_BAD		90
+#define OVERLAY_STACK_WARN	1024	// Bytes of stack headroom
+#define OVERLAY_STACK_BAD	512
+
+typedef enum {
+	OVERLAY_IDLE0 = 0,
+	OVERLAY_IDLE1,
+	OVERLAY_FPS,
+	OVERLAY_MESSAGES,
+	OVERLAY_QUEUE,
+	OVERLAY_SPI,
+	OVERLAY_STACK,			// One cell per PERF_TASKS
+	OVERLAY_CELLS = OVERLAY_STACK + PERF_TASKS,
+} OVERLAY_CELL_t;
+
+// Line, column and width of every cell in characters
+static const uint8_t overlayPlace[OVERLAY_CELLS][3] = {
+	{0, 0, 9}, {0, 10, 9}, {0, 20, 8}, {0, 29, 10},
+	{1, 0, 6}, {1, 7, 8}, {1, 16, 7}, {1, 24, 7}, {1, 32, 7},
+};
+static const char *overlayStackLabels[PERF_TASKS] = { "udp", "tft", "btn" };
+
+typedef struct {
+	bool shown;
+	int64_t drawn;
+	uint32_t queuePeak;		// Deepest xQueueCmd since the last refresh
+	PERF_WINDOW_t window;
+	char text[OVERLAY_CELLS][OVERLAY_TEXT];
+	uint16_t color[OVERLAY_CELLS];
+} OVERLAY_t;
+
+static uint16_t level(int value, int warn, int bad, bool low)
+{
+	if (value < 0) return GRAY;
+	if (low ? value < bad : value >= bad) return RED;
+	if (low ? value < warn : value >= warn) return YELLOW;
+	return CYAN;
+}
+
+static void formatOverlay(int cell, const PERF_t *perf, uint32_t queuePeak, char *text, uint16_t *color)
+{
+	int value = -1;
+	switch (cell) {
+	case OVERLAY_IDLE0:
+	case OVERLAY_IDLE1:
+		value = perf->idle[cell - OVERLAY_IDLE0];
+		if (value < 0) {
+			sprintf(text, "idle%d --", cell - OVERLAY_IDLE0);
+		} else {
+			sprintf(text, "idle%d %d%%", cell - OVERLAY_IDLE0, value);
 		}
-		vTaskDelay(1);
+		*color = level(value, OVERLAY_IDLE_WARN, OVERLAY_IDLE_BAD, true);
+		break;
+	case OVERLAY_FPS:
+		sprintf(text, "%.1ffps", perf->fps);
+		*color = CYAN;
+		break;
+	case OVERLAY_MESSAGES:
+		sprintf(text, "%umsg/s", perf->messages);
+		*color = CYAN;
+		break;
+	case OVERLAY_QUEUE:
+		sprintf(text, "q%u/%d", queuePeak, CMD_QUEUE_LENGTH);
+		*color = level(queuePeak, CMD_QUEUE_LENGTH / 2, CMD_QUEUE_LENGTH, false);
+		break;
+	case OVERLAY_SPI:
+		sprintf(text, "spi %d%%", perf->spi);
+		*color = level(perf->spi, OVERLAY_SPI_WARN, OVERLAY_SPI_BAD, false);
+		break;
+	default:
+		value = perf->stackFree[cell - OVERLAY_STACK];
+		if (value < 0) {
+			sprintf(text, "%s --", overlayStackLabels[cell - OVERLAY_STACK]);
+		} else {
+			sprintf(text, "%s%d", overlayStackLabels[cell - OVERLAY_STACK], value > 9999 ? 9999 : value);
+		}
+		*color = level(value, OVERLAY_STACK_WARN, OVERLAY_STACK_BAD, true);
+		break;
 	}
 }
 
-//#define CONFIG_ESP_FONT_GOTHIC	1
-//#define CONFIG_ESP_FONT_MINCYO	0
+// Clear the strip and clip the screens above it
+static void showOverlay(TFT_t * dev, uint16_t top, OVERLAY_t *overlay)
+{
+	lcdSetClipHeight(dev, SCREEN_HEIGHT);
+	lcdDrawFillRect(dev, 0, top, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+	lcdDrawLine(dev, 0, top, SCREEN_WIDTH-1, top, GRAY);
+	lcdSetClipHeight(dev, top);
+	for (int cell=0; cell<OVERLAY_CELLS; cell++) {
+		overlay->text[cell][0] = 0;
+		overlay->color[cell] = BLACK;
+	}
+	overlay->drawn = 0;
+}
+
+static void drawOverlay(TFT_t * dev, FontxFile *fx, uint8_t fontWidth, uint8_t fontHeight, uint16_t top, OVERLAY_t *overlay)
+{
+	PERF_t perf = { .idle = { -1, -1 }, .spi = -1, .cpu = { -1, -1, -1 }, .stackFree = { -1, -1, -1 } };
+	perf_sample(&overlay->window, &perf);
+	lcdSetClipHeight(dev, SCREEN_HEIGHT);
+	for (int cell=0; cell<OVERLAY_CELLS; cell++) {
+		char text[OVERLAY_TEXT];
+		uint16_t color;
+		formatOverlay(cell, &perf, overlay->queuePeak, text, &color);
+		if (strcmp(text, overlay->text[cell]) == 0 && color == overlay->color[cell]) continue;
+		uint16_t x = overlayPlace[cell][1] * fontWidth;
+		uint16_t y = top + (overlayPlace[cell][0] + 1) * fontHeight;
+		lcdDrawFillRect(dev, x, y-fontHeight+1, x + overlayPlace[cell][2] * fontWidth - 1, y, BLACK);
+		lcdDrawString(dev, fx, x, y, (uint8_t *)text, color);
+		strcpy(overlay->text[cell], text);
+		overlay->color[cell] = color;
+	}
+	lcdSetClipHeight(dev, top);
+	overlay->queuePeak = 0;
+}
+
+// Button of the screen shown. A second press toggles the overlay.
+// Link Health and Latency are reached with the right button held, so a short press of it toggles there.
+static uint16_t screenButton(int screen)
+{
+	if (screen == 1) return CMD_BUTTON_LEFT;
+	if (screen == 2) return CMD_BUTTON_MIDDLE;
+	if (screen >= 3 && screen <= 5) return CMD_BUTTON_RIGHT;
+	return 0;
+}
+#endif
 
 void tft(void *pvParameters)
 {
-	ESP_LOGI(pcTaskGetTaskName(0), "Start");
+	ESP_LOGI(os_task_name(), "Start");
+
+	// Setup Screen
+	// This runs while app_main mounts SPIFFS and WiFi associates.
+	TFT_t dev;
+	spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
+	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	ESP_LOGI(os_task_name(), "Setup Screen done");
+
+	// Fonts are on SPIFFS
+	while (!boot_wait(BOOT_STAGE_SPIFFS, 100)) {
+		if (boot_failed(BOOT_STAGE_SPIFFS)) break;
+	}
+
 	// Set font file
 	FontxFile fx[2];
 #if CONFIG_ESP_FONT_GOTHIC
-	InitFontx(fx,"/fonts/ILGH24XB.FNT",""); // 12x24Dot Gothic
+	InitFontx(fx,FONT_DIR "/ILGH24XB.FNT",""); // 12x24Dot Gothic
 #endif
 #if CONFIG_ESP_FONT_MINCYO
-	InitFontx(fx,"/fonts/ILMH24XB.FNT",""); // 12x24Dot Mincyo
+	InitFontx(fx,FONT_DIR "/ILMH24XB.FNT",""); // 12x24Dot Mincyo
 #endif
 
 	// Get font width & height
 	uint8_t buffer[FontxGlyphBufSize];
-	uint8_t fontWidth;
-	uint8_t fontHeight;
-	GetFontx(fx, 0, buffer, &fontWidth, &fontHeight);
-	ESP_LOGI(pcTaskGetTaskName(0), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
+	uint8_t fontWidth = 12;
+	uint8_t fontHeight = 24;
+	bool fontValid = GetFontx(fx, 0, buffer, &fontWidth, &fontHeight);
+	ESP_LOGI(os_task_name(), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
 
-	// Setup Screen
-	TFT_t dev;
-	spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
-	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
-	ESP_LOGI(pcTaskGetTaskName(0), "Setup Screen done");
+#if CONFIG_PERF_OVERLAY
+	FontxFile fxSmall[2];
+#if CONFIG_ESP_FONT_GOTHIC
+	InitFontx(fxSmall,FONT_DIR "/ILGH16XB.FNT",""); // 8x16Dot Gothic
+#endif
+#if CONFIG_ESP_FONT_MINCYO
+	InitFontx(fxSmall,FONT_DIR "/ILMH16XB.FNT",""); // 8x16Dot Mincyo
+#endif
+	uint8_t smallWidth = 8;
+	uint8_t smallHeight = 16;
+	bool overlayValid = GetFontx(fxSmall, 0, buffer, &smallWidth, &smallHeight);
+	uint16_t overlayTop = SCREEN_HEIGHT - (smallHeight * OVERLAY_LINES) - 1;
+	OVERLAY_t overlay;
+	memset(&overlay, 0, sizeof(overlay));
+#endif
 
 	int lines = (SCREEN_HEIGHT - fontHeight) / fontHeight;
-	ESP_LOGD(pcTaskGetTaskName(0), "SCREEN_HEIGHT=%d fontHeight=%d lines=%d", SCREEN_HEIGHT, fontHeight, lines);
+	ESP_LOGD(os_task_name(), "SCREEN_HEIGHT=%d fontHeight=%d lines=%d", SCREEN_HEIGHT, fontHeight, lines);
 	int ymax = (lines+1) * fontHeight;
-	ESP_LOGD(pcTaskGetTaskName(0), "ymax=%d",ymax);
+	ESP_LOGD(os_task_name(), "ymax=%d",ymax);
 
 	// Clear Screen
 	lcdFillScreen(&dev, BLACK);
@@ -175,19 +470,45 @@ void tft(void *pvParameters)
 	strcpy((char *)subTitle, "General Info");
 	lcdDrawString(&dev, fx, xTitle, yTitle, subTitle, YELLOW);
 
+	// Show selected vehicle between the title and the link state
+	uint16_t xVehicle = (fontWidth * 7) + 2;
+	uint8_t shownVehicle = VEHICLE_NONE;
+
+	// Show link state
+	uint16_t xLink = xTitle - 16;
+	uint16_t yLink = fontHeight/2;
+	int linkState = wifi_link_state();
+	drawLink(&dev, xLink, yLink, linkState);
+
+#if CONFIG_RECORDER
+	// Show recorder state left of the link state
+	uint16_t xRecorder = xLink - 16;
+	RECORDER_STATE_t recorderState = RECORDER_OFF;
+#endif
+
+	// Show boot screen until the first telemetry arrives
+	int16_t drawBootScreen = 1;
+	int64_t bootShown[BOOT_STAGE_MAX];
+	for (int stage=0; stage<BOOT_STAGE_MAX; stage++) bootShown[stage] = INT64_MIN;
+	if (fontValid) {
+		drawBoot(&dev, fx, fontWidth, fontHeight, bootShown);
+	} else {
+		// No font to tell what went wrong
+		lcdDrawFillRect(&dev, 0, (fontHeight*1), SCREEN_WIDTH-1, SCREEN_HEIGHT-1, RED);
+	}
+	boot_stage(BOOT_STAGE_DISPLAY);
+
 	CMD_t cmdBuf;
-	CMD_t cmdBufOld;
-	cmdBufOld.airspeed = FLT_MAX;
-	cmdBufOld.groundspeed = FLT_MAX;
-	cmdBufOld.alt = FLT_MAX;
-	cmdBufOld.climb = FLT_MAX;
-	cmdBufOld.heading = INT16_MAX;
-	cmdBufOld.throttle = UINT16_MAX;
+	TELEMETRY_t telemetry;
 	int screen = 1;
 
 	// for general staff
 	int16_t drawGeneral = 0;
 	uint16_t xGeneral = (fontWidth * 14) - 1;
+	// Use the blank line under the header when there are more than six rows
+	uint16_t yGeneral = (fontHeight * (GENERAL_ROWS > 6 ? 2 : 3)) - 1;
+	char generalShown[GENERAL_ROWS][GENERAL_VALUE];
+	for (int row=0; row<GENERAL_ROWS; row++) generalShown[row][0] = 0;
 
 	// for heading staff
 	int16_t drawHeading = 0;
@@ -200,78 +521,120 @@ void tft(void *pvParameters)
 	uint16_t xSpeed = 0;
 	uint16_t ySpeed = 0;
 	uint16_t speedRadius = 130;
+
+	// for link health staff
+	int16_t drawHealthScreen = 0;
+	int64_t healthDrawn = 0;
+	char healthShown[HEALTH_LINES][HEALTH_TEXT];
+	uint16_t healthColor[HEALTH_LINES];
+
+	// for latency staff
+	int16_t drawLatencyScreen = 0;
+	bool latencyChanged = false;
+	char latencyShown[LATENCY_LINES][LATENCY_TEXT];
+	uint16_t latencyColor[LATENCY_LINES];
+
+	// for button latency
+	int64_t buttonLatencyMin = INT64_MAX;
+	int64_t buttonLatencyMax = 0;
+	int64_t buttonLatencySum = 0;
+	int32_t buttonLatencyCount = 0;
+
+#if CONFIG_SPI_STATS
+	int64_t spiReported = os_time_us();
+#endif
+
 #if 0
 	int16_t airspeedPrimary = 0;
 	int16_t airspeedDelta = 1;
 #endif
 
 	while(1) {
-		xQueueReceive(xQueueCmd, &cmdBuf, portMAX_DELAY);
-		ESP_LOGD(pcTaskGetTaskName(0),"cmdBuf.command=%d screen=%d", cmdBuf.command, screen);
-		if (cmdBuf.command == CMD_MAVLINK) {
+		// The Link Health and Latency screens also refresh while no telemetry arrives
+		int32_t wait = (screen >= 4) ? HEALTH_REFRESH_MS : OS_WAIT_FOREVER;
+#if CONFIG_PERF_OVERLAY
+		if (overlay.shown) wait = OVERLAY_REFRESH_MS;
+#endif
+		if (!os_queue_receive(xQueueCmd, &cmdBuf, wait)) {
+			cmdBuf.command = CMD_REFRESH;
+			cmdBuf.press = 0;
+			cmdBuf.time = os_time_us();
+		}
+#if CONFIG_PERF_OVERLAY
+		else {
+			// This command and the ones behind it
+			uint32_t depth = os_queue_waiting(xQueueCmd) + 1;
+			if (depth > overlay.queuePeak) overlay.queuePeak = depth;
+		}
+#endif
+		int64_t drawStart = os_time_us();
+		ESP_LOGD(os_task_name(),"cmdBuf.command=%d screen=%d", cmdBuf.command, screen);
+		if (cmdBuf.command == CMD_STATUS) {
+			if (linkState != wifi_link_state()) {
+				linkState = wifi_link_state();
+				drawLink(&dev, xLink, yLink, linkState);
+			}
+#if CONFIG_RECORDER
+			if (recorderState != recorder_state()) {
+				recorderState = recorder_state();
+				drawRecorder(&dev, xRecorder, yLink, recorderState);
+			}
+#endif
+			if (drawBootScreen && fontValid) drawBoot(&dev, fx, fontWidth, fontHeight, bootShown);
+			continue;
+		}
+
+		// Long press of the middle button selects the next vehicle
+		if (cmdBuf.command == CMD_BUTTON_MIDDLE && cmdBuf.press == BUTTON_PRESS_LONG) {
+			vehicle_select_next();
+		}
+		if (vehicle_selected() != shownVehicle) {
+			shownVehicle = vehicle_selected();
+			drawVehicle(&dev, fx, xVehicle, yTitle, fontWidth, fontHeight, shownVehicle);
+			// Nothing of the previous vehicle may stay on the screen
+			if (!drawBootScreen) lcdDrawFillRect(&dev, 0, (fontHeight*1), SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+			drawGeneral = 0;
+			drawHeading = 0;
+			drawSpeed = 0;
+			drawHealthScreen = 0;
+			drawLatencyScreen = 0;
+			for (int row=0; row<GENERAL_ROWS; row++) generalShown[row][0] = 0;
+		}
+
+
+		if (cmdBuf.command == CMD_REFRESH) {
+			// Only the Link Health and Latency screens are redrawn below
+		} else if (cmdBuf.command == CMD_MAVLINK) {
+			drawBootScreen = 0;
+			// Only the selected vehicle's state is read
+			if (!telemetry_get(&telemetry)) continue;
+			bool drawn = false;
 			if (screen == 1){
 				if (drawGeneral == 0) {
+					drawn = true;
 					lcdDrawFillRect(&dev, 0, (fontHeight*1), SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
 					xpos = 0;
-					ypos = (fontHeight*3)-1;
-					strcpy((char *)ascii, "airspeed    : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
-					ypos = ypos + fontHeight;
-					strcpy((char *)ascii, "groundspeed : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
-					ypos = ypos + fontHeight;
-					strcpy((char *)ascii, "alt         : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
-					ypos = ypos + fontHeight;
-					strcpy((char *)ascii, "climb       : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
-					ypos = ypos + fontHeight;
-					strcpy((char *)ascii, "heading     : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
-					ypos = ypos + fontHeight;
-					strcpy((char *)ascii, "throttle    : ");
-					lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
+					ypos = yGeneral;
+					for (int row=0; row<GENERAL_ROWS && ypos<SCREEN_HEIGHT; row++) {
+						strcpy((char *)ascii, generalRows[row].label);
+						lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
+						ypos = ypos + fontHeight;
+					}
 				}
 				drawGeneral = 1;
-				ypos = (fontHeight*3)-1;
-				if (cmdBufOld.airspeed != cmdBuf.airspeed) {
-					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%f", cmdBuf.airspeed);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
-				}
-				ypos = ypos + fontHeight;
-				if (cmdBufOld.groundspeed != cmdBuf.groundspeed) {
-					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%f", cmdBuf.groundspeed);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
-				}
-				ypos = ypos + fontHeight;
-				if (cmdBufOld.alt != cmdBuf.alt) {
+				ypos = yGeneral;
+				for (int row=0; row<GENERAL_ROWS && ypos<SCREEN_HEIGHT; row++, ypos += fontHeight) {
+					if (generalRows[row].msgid != cmdBuf.msgid) continue;
+					char value[GENERAL_VALUE];
+					generalRows[row].format(&telemetry, value, sizeof(value));
+					if (strcmp(value, generalShown[row]) == 0) continue;
 					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%f", cmdBuf.alt);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
+					lcdDrawString(&dev, fx, xGeneral, ypos, (uint8_t *)value, CYAN);
+					strcpy(generalShown[row], value);
+					drawn = true;
 				}
-				ypos = ypos + fontHeight;
-				if (cmdBufOld.climb != cmdBuf.climb) {
-					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%f", cmdBuf.climb);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
-				}
-				ypos = ypos + fontHeight;
-				if (cmdBufOld.heading != cmdBuf.heading) {
-					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%d", cmdBuf.heading);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
-				}
-				ypos = ypos + fontHeight;
-				if (cmdBufOld.throttle != cmdBuf.throttle) {
-					lcdDrawFillRect(&dev, xGeneral, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-					sprintf((char *)ascii, "%d", cmdBuf.throttle);
-					lcdDrawString(&dev, fx, xGeneral, ypos, ascii, CYAN);
-				}
-				memcpy(&cmdBufOld, &cmdBuf, sizeof(cmdBuf));
 
-			} else if (screen == 2) {
+			} else if (screen == 2 && cmdBuf.msgid == MAVLINK_MSG_ID_VFR_HUD) {
 				uint16_t xCenter = SCREEN_WIDTH/2;
 				uint16_t yCenter = (SCREEN_HEIGHT)/2 + (fontHeight/2);
 				if (drawHeading == 0) {
@@ -313,14 +676,15 @@ void tft(void *pvParameters)
 				drawHeading = 1;
 
 				// Draw Arrow
-				int16_t heading = cmdBuf.heading - 90; 
-				if (cmdBuf.heading < 90) heading = 270 + cmdBuf.heading;
+				int16_t heading = telemetry.vfrHud.heading - 90; 
+				if (telemetry.vfrHud.heading < 90) heading = 270 + telemetry.vfrHud.heading;
 				float rad = heading * M_PI / 180.0;
 				xHeading = xCenter + cos(rad) * (float)(headingRadius-5);
 				yHeading = yCenter + sin(rad) * (float)(headingRadius-5);
 				lcdDrawArrow(&dev, xCenter, yCenter, xHeading, yHeading, 4, RED);
+				drawn = true;
 
-			} else if (screen == 3) {
+			} else if (screen == 3 && cmdBuf.msgid == MAVLINK_MSG_ID_VFR_HUD) {
 				uint16_t xCenter = SCREEN_WIDTH/2;
 				uint16_t yCenter = SCREEN_HEIGHT-20;
 				if (drawSpeed == 0) {
@@ -386,7 +750,7 @@ void tft(void *pvParameters)
 
 #if 0
 				// for debug
-				cmdBuf.airspeed = airspeedPrimary;
+				telemetry.vfrHud.airspeed = airspeedPrimary;
 				airspeedPrimary = airspeedPrimary + airspeedDelta;
 				if (airspeedPrimary >= 20) airspeedDelta = -1;
 				if (airspeedPrimary <= 0) airspeedDelta = 1;
@@ -398,36 +762,82 @@ void tft(void *pvParameters)
 				lcdDrawFillRect(&dev, xpos, ypos, xpos+fontWidth*10, ypos+fontHeight, BLACK);
 
 				// Draw Speed
-				sprintf((char *)ascii,"%4.1f m/Sec", cmdBuf.airspeed);
+				sprintf((char *)ascii,"%4.1f m/Sec", telemetry.vfrHud.airspeed);
 				xpos = SCREEN_WIDTH / 2 - fontWidth * 5;
 				ypos = yCenter-(fontHeight*1);
 				lcdDrawString(&dev, fx, xpos, ypos, ascii, CYAN);
 
 				// Draw Needle
-				int16_t airspeed = cmdBuf.airspeed; 
+				int16_t airspeed = telemetry.vfrHud.airspeed; 
 				
 				if (airspeed > 20) airspeed = 20;
 				int16_t notched = 180 / 20;
-				ESP_LOGD(pcTaskGetTaskName(0),"airspeed=%d", airspeed);
+				ESP_LOGD(os_task_name(),"airspeed=%d", airspeed);
 				airspeed = airspeed * notched + 180;
 				float rad = airspeed * M_PI / 180.0;
 				xSpeed = xCenter + cos(rad) * (float)(speedRadius-5);
 				ySpeed = yCenter + sin(rad) * (float)(speedRadius-5);
 				lcdDrawArrow(&dev, xCenter, yCenter, xSpeed, ySpeed, 4, RED);
+				drawn = true;
+			}
+
+			// spi_device_transmit() returns after the transfer, so the last SPI
+			// transaction of this update is complete and the pixels are on the panel.
+			if (drawn) {
+				latency_update(cmdBuf.received, cmdBuf.time, cmdBuf.queued, drawStart, os_time_us());
+				perf_frame();
+			}
+
+			// Time to first telemetry frame
+			if (!boot_done(BOOT_STAGE_TELEMETRY)) {
+				boot_stage(BOOT_STAGE_TELEMETRY);
+				boot_report();
 			}
 
+		} else if (cmdBuf.command == CMD_BUTTON_RIGHT && cmdBuf.press == BUTTON_PRESS_LONG) {
+			// Long presses step through the diagnostics screens
+			screen = (screen == 4) ? 5 : 4;
+			lcdDrawFillRect(&dev, xTitle, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
+			strcpy((char *)subTitle, (screen == 4) ? "Link Health" : "Latency");
+			lcdDrawString(&dev, fx, xTitle, yTitle, subTitle, YELLOW);
+			drawHealthScreen = 0; // Draw Frame
+			drawLatencyScreen = 0;
+			drawBootScreen = 0; // Also useful while no telemetry arrives
+#if CONFIG_RECORDER
+		} else if (cmdBuf.command == CMD_BUTTON_LEFT && cmdBuf.press == BUTTON_PRESS_LONG) {
+			recorder_toggle();
+#endif
+		} else if (cmdBuf.press != BUTTON_PRESS_SHORT) {
+			// Other long presses and repeats are not assigned yet
+			ESP_LOGD(os_task_name(),"cmdBuf.command=%d press=%d", cmdBuf.command, cmdBuf.press);
+#if CONFIG_PERF_OVERLAY
+		} else if (overlayValid && cmdBuf.command == screenButton(screen)) {
+			overlay.shown = !overlay.shown;
+			if (overlay.shown) {
+				showOverlay(&dev, overlayTop, &overlay);
+			} else {
+				lcdSetClipHeight(&dev, SCREEN_HEIGHT);
+				lcdDrawFillRect(&dev, 0, overlayTop, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+				// The screen gets the rows under the strip back
+				drawGeneral = 0;
+				drawHeading = 0;
+				drawSpeed = 0;
+				drawHealthScreen = 0;
+				drawLatencyScreen = 0;
+				for (int row=0; row<GENERAL_ROWS; row++) generalShown[row][0] = 0;
+				if (drawBootScreen && fontValid) {
+					for (int stage=0; stage<BOOT_STAGE_MAX; stage++) bootShown[stage] = INT64_MIN;
+					drawBoot(&dev, fx, fontWidth, fontHeight, bootShown);
+				}
+			}
+#endif
 		} else if (cmdBuf.command == CMD_BUTTON_LEFT) {
 			screen = 1;
 			lcdDrawFillRect(&dev, xTitle, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
 			strcpy((char *)subTitle, "General Info");
 			lcdDrawString(&dev, fx, xTitle, yTitle, subTitle, YELLOW);
 			drawGeneral = 0; // Draw Title
-			cmdBufOld.airspeed = FLT_MAX;
-			cmdBufOld.groundspeed = FLT_MAX;
-			cmdBufOld.alt = FLT_MAX;
-			cmdBufOld.climb = FLT_MAX;
-			cmdBufOld.heading = INT16_MAX;
-			cmdBufOld.throttle = UINT16_MAX;
+			for (int row=0; row<GENERAL_ROWS; row++) generalShown[row][0] = 0;
 		} else if (cmdBuf.command == CMD_BUTTON_MIDDLE) {
 			screen = 2;
 			lcdDrawFillRect(&dev, xTitle, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
@@ -441,11 +851,76 @@ void tft(void *pvParameters)
 			lcdDrawString(&dev, fx, xTitle, yTitle, subTitle, YELLOW);
 			drawSpeed = 0; // Draw Frame
 		}
+
+#if CONFIG_MAVLINK_REQUEST_RATES
+		// The UDP task asks the autopilot for the messages of this screen only
+		gcs_screen(screen);
+#endif
+
+		if (screen == 4) {
+			int64_t now = os_time_us();
+			if (drawHealthScreen == 0) {
+				lcdDrawFillRect(&dev, 0, (fontHeight*1), SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+				for (int line=0; line<HEALTH_LINES; line++) {
+					healthShown[line][0] = 0;
+					healthColor[line] = BLACK;
+				}
+				healthDrawn = 0;
+			}
+			drawHealthScreen = 1;
+			if (now - healthDrawn >= HEALTH_REFRESH_MS * 1000LL) {
+				drawHealth(&dev, fx, fontHeight, healthShown, healthColor);
+				healthDrawn = now;
+			}
+		}
+
+		if (latency_report(os_time_us())) latencyChanged = true;
+#if CONFIG_SPI_STATS
+		// Since boot, so runs of the same replay can be compared
+		if (os_time_us() - spiReported >= SPI_STATS_REPORT_US) {
+			spi_stats_report();
+			spiReported = os_time_us();
+		}
+#endif
+		if (screen == 5) {
+			if (drawLatencyScreen == 0) {
+				lcdDrawFillRect(&dev, 0, (fontHeight*1), SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+				for (int line=0; line<LATENCY_LINES; line++) {
+					latencyShown[line][0] = 0;
+					latencyColor[line] = BLACK;
+				}
+				latencyChanged = true;
+			}
+			drawLatencyScreen = 1;
+			if (latencyChanged) {
+				drawLatency(&dev, fx, fontHeight, latencyShown, latencyColor);
+				latencyChanged = false;
+			}
+		}
+
+#if CONFIG_PERF_OVERLAY
+		if (overlay.shown && os_time_us() - overlay.drawn >= OVERLAY_REFRESH_MS * 1000LL) {
+			drawOverlay(&dev, fxSmall, smallWidth, smallHeight, overlayTop, &overlay);
+			overlay.drawn = os_time_us();
+		}
+#endif
+
+		// Press-to-screen latency. Drawing is synchronous, so the screen is updated at this point.
+		if (cmdBuf.command == CMD_BUTTON_LEFT || cmdBuf.command == CMD_BUTTON_MIDDLE || cmdBuf.command == CMD_BUTTON_RIGHT) {
+			int64_t latency = os_time_us() - cmdBuf.time;
+			if (latency < buttonLatencyMin) buttonLatencyMin = latency;
+			if (latency > buttonLatencyMax) buttonLatencyMax = latency;
+			buttonLatencySum += latency;
+			buttonLatencyCount++;
+			EVLOG(EVLOG_BUTTON_LATENCY, cmdBuf.command, latency, buttonLatencyMax);
+			EVLOG(EVLOG_BUTTON_LATENCY_AVG, buttonLatencyCount > INT16_MAX ? INT16_MAX : buttonLatencyCount,
+				buttonLatencyMin, buttonLatencySum / buttonLatencyCount);
+		}
 	}
 
 	// Don't reach here
 	while (1) {
-		vTaskDelay(2000 / portTICK_PERIOD_MS);
+		os_delay_ms(2000);
 	}
 }
 
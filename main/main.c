@@ -17,140 +17,225 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_system.h"
-#include "esp_wifi.h"
+#include "esp_heap_caps.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "nvs_flash.h"
 
+#include "os.h"
 #include "cmd.h"
+#include "button.h"
+#include "ili9340.h"
+#include "boot.h"
+#include "wifi.h"
+#include "udp_receiver.h"
+#include "recorder.h"
+#include "replay.h"
+#include "evlog.h"
+#include "trace.h"
+#include "metrics.h"
+
+OS_QUEUE_t xQueueCmd;
+QueueHandle_t xQueueButton;
 
-QueueHandle_t xQueueCmd;
-
-/* The examples use WiFi configuration that you can set via project configuration menu
-
-   If you'd rather not, just change the below entries to strings with
-   the config you want - ie #define ESP_WIFI_SSID "mywifissid"
-*/
-#define ESP_WIFI_SSID	   CONFIG_ESP_WIFI_SSID
-#define ESP_WIFI_PASS	   CONFIG_ESP_WIFI_PASSWORD
-#define ESP_MAXIMUM_RETRY  CONFIG_ESP_MAXIMUM_RETRY
-
-/* FreeRTOS event group to signal when we are connected*/
-static EventGroupHandle_t s_wifi_event_group;
+static const char *TAG = "MAIN";
 
-/* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT	   BIT1
+void button(void *pvParameters);
+void tft(void *pvParameters);
 
-static const char *TAG = "MAIN";
+// Task topology
+#if CONFIG_FREERTOS_UNICORE
+#define TASK_CORE(core)	0
+#else
+#define TASK_CORE(core)	((core) < 0 ? tskNO_AFFINITY : (core))
+#endif
+
+typedef struct {
+	TaskFunction_t function;
+	const char *name;
+	uint32_t stack;
+	UBaseType_t priority;
+	BaseType_t core;
+	StackType_t *stackBuffer;
+	StaticTask_t *taskBuffer;
+	TaskHandle_t handle;
+} TASK_t;
+
+// Memory plan
+// With CONFIG_STATIC_ALLOCATION every task stack, task control block and queue
+// storage is reserved here at link time, so the heap only serves WiFi and lwIP.
+// Note: ESP-IDF stack sizes are in bytes and StackType_t is uint8_t.
+#if CONFIG_STATIC_ALLOCATION
+static StackType_t udpStack[CONFIG_UDP_TASK_STACK];
+static StaticTask_t udpTaskBuffer;
+static StackType_t buttonStack[CONFIG_BUTTON_TASK_STACK];
+static StaticTask_t buttonTaskBuffer;
+static StackType_t tftStack[CONFIG_TFT_TASK_STACK];
+static StaticTask_t tftTaskBuffer;
+#if CONFIG_RECORDER
+static StackType_t recStack[CONFIG_REC_TASK_STACK];
+static StaticTask_t recTaskBuffer;
+#endif
+#if CONFIG_EVLOG
+static StackType_t logStack[CONFIG_LOG_TASK_STACK];
+static StaticTask_t logTaskBuffer;
+#endif
+#if CONFIG_TRACE
+static StackType_t traceStack[CONFIG_TRACE_TASK_STACK];
+static StaticTask_t traceTaskBuffer;
+#endif
+#if CONFIG_METRICS
+static StackType_t metricsStack[CONFIG_METRICS_TASK_STACK];
+static StaticTask_t metricsTaskBuffer;
+#endif
+#define TASK_MEMORY(stack, buffer)	stack, &buffer
+#else
+#define TASK_MEMORY(stack, buffer)	NULL, NULL
+#endif
+
+static TASK_t tasks[] = {
+	{ receiver, "UDP", CONFIG_UDP_TASK_STACK, CONFIG_UDP_TASK_PRIORITY, TASK_CORE(CONFIG_UDP_TASK_CORE), TASK_MEMORY(udpStack, udpTaskBuffer) },
+	{ button, "BUTTON", CONFIG_BUTTON_TASK_STACK, CONFIG_BUTTON_TASK_PRIORITY, TASK_CORE(CONFIG_BUTTON_TASK_CORE), TASK_MEMORY(buttonStack, buttonTaskBuffer) },
+	{ tft, "TFT", CONFIG_TFT_TASK_STACK, CONFIG_TFT_TASK_PRIORITY, TASK_CORE(CONFIG_TFT_TASK_CORE), TASK_MEMORY(tftStack, tftTaskBuffer) },
+#if CONFIG_RECORDER
+	{ recorder, "REC", CONFIG_REC_TASK_STACK, CONFIG_REC_TASK_PRIORITY, TASK_CORE(CONFIG_REC_TASK_CORE), TASK_MEMORY(recStack, recTaskBuffer) },
+#endif
+#if CONFIG_EVLOG
+	{ evlog, "LOG", CONFIG_LOG_TASK_STACK, CONFIG_LOG_TASK_PRIORITY, TASK_CORE(CONFIG_LOG_TASK_CORE), TASK_MEMORY(logStack, logTaskBuffer) },
+#endif
+#if CONFIG_TRACE
+	{ trace, "TRACE", CONFIG_TRACE_TASK_STACK, CONFIG_TRACE_TASK_PRIORITY, TASK_CORE(CONFIG_TRACE_TASK_CORE), TASK_MEMORY(traceStack, traceTaskBuffer) },
+#endif
+#if CONFIG_METRICS
+	{ metrics, "METRICS", CONFIG_METRICS_TASK_STACK, CONFIG_METRICS_TASK_PRIORITY, TASK_CORE(CONFIG_METRICS_TASK_CORE), TASK_MEMORY(metricsStack, metricsTaskBuffer) },
+#endif
+};
+#define NUM_TASKS (sizeof(tasks)/sizeof(tasks[0]))
+
+typedef struct {
+	QueueHandle_t *handle;
+	const char *name;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	uint8_t *storage;
+	StaticQueue_t *queueBuffer;
+} QUEUE_t;
+
+#if CONFIG_STATIC_ALLOCATION
+static uint8_t cmdQueueStorage[CMD_QUEUE_LENGTH * sizeof(CMD_t)];
+static StaticQueue_t cmdQueueBuffer;
+static uint8_t buttonQueueStorage[BUTTON_QUEUE_LENGTH * sizeof(BUTTON_EVENT_t)];
+static StaticQueue_t buttonQueueBuffer;
+#define QUEUE_MEMORY(storage, buffer)	storage, &buffer
+#else
+#define QUEUE_MEMORY(storage, buffer)	NULL, NULL
+#endif
+
+static QUEUE_t queues[] = {
+	{ &xQueueCmd, "CMD", CMD_QUEUE_LENGTH, sizeof(CMD_t), QUEUE_MEMORY(cmdQueueStorage, cmdQueueBuffer) },
+	{ &xQueueButton, "BUTTON", BUTTON_QUEUE_LENGTH, sizeof(BUTTON_EVENT_t), QUEUE_MEMORY(buttonQueueStorage, buttonQueueBuffer) },
+};
+#define NUM_QUEUES (sizeof(queues)/sizeof(queues[0]))
+
+static const char * core_name(BaseType_t core) {
+	if (core == 0) return "PRO";
+	if (core == 1) return "APP";
+	return "ANY";
+}
 
-static int s_retry_num = 0;
+static void task_report(void) {
+#if CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
+	BaseType_t wifiCore = 1;
+#else
+	BaseType_t wifiCore = 0;
+#endif
+#ifdef CONFIG_LWIP_TCPIP_TASK_AFFINITY
+	BaseType_t lwipCore = CONFIG_LWIP_TCPIP_TASK_AFFINITY;
+#else
+	BaseType_t lwipCore = tskNO_AFFINITY;
+#endif
+	ESP_LOGI(TAG, "Task topology");
+	ESP_LOGI(TAG, "%-8s %-4s %4s %6s", "name", "core", "prio", "stack");
+	ESP_LOGI(TAG, "%-8s %-4s %4s %6s", "wifi", core_name(wifiCore), "-", "-");
+	ESP_LOGI(TAG, "%-8s %-4s %4s %6s", "tiT", core_name(lwipCore), "-", "-");
+	for (int i=0; i<NUM_TASKS; i++) {
+		ESP_LOGI(TAG, "%-8s %-4s %4d %6d", tasks[i].name, core_name(tasks[i].core), tasks[i].priority, tasks[i].stack);
+	}
+	if (tasks[0].core != tskNO_AFFINITY && tasks[0].core == tasks[2].core) {
+		ESP_LOGW(TAG, "UDP and TFT share a core. WiFi bursts will stall rendering");
+	}
+}
 
-static void event_handler(void* arg, esp_event_base_t event_base,
-								int32_t event_id, void* event_data)
-{
-	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-		esp_wifi_connect();
-	} else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-		if (s_retry_num < ESP_MAXIMUM_RETRY) {
-			esp_wifi_connect();
-			s_retry_num++;
-			ESP_LOGI(TAG, "retry to connect to the AP");
+static void queue_create(void) {
+	for (int i=0; i<NUM_QUEUES; i++) {
+		if (queues[i].storage) {
+			*queues[i].handle = xQueueCreateStatic(queues[i].length, queues[i].itemSize, queues[i].storage, queues[i].queueBuffer);
 		} else {
-			xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+			*queues[i].handle = xQueueCreate(queues[i].length, queues[i].itemSize);
 		}
-		ESP_LOGI(TAG,"connect to the AP fail");
-	} else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-		ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-		ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-		s_retry_num = 0;
-		xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+		configASSERT( *queues[i].handle );
 	}
 }
 
-esp_err_t wifi_init_sta(void)
-{
-	esp_err_t ret_value = ESP_OK;
-	s_wifi_event_group = xEventGroupCreate();
-
-	ESP_ERROR_CHECK(esp_netif_init());
-
-	ESP_ERROR_CHECK(esp_event_loop_create_default());
-	esp_netif_create_default_wifi_sta();
-
-	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-	esp_event_handler_instance_t instance_any_id;
-	esp_event_handler_instance_t instance_got_ip;
-	ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-			ESP_EVENT_ANY_ID,
-			&event_handler,
-			NULL,
-			&instance_any_id));
-	ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-			IP_EVENT_STA_GOT_IP,
-			&event_handler,
-			NULL,
-			&instance_got_ip));
-
-	wifi_config_t wifi_config = {
-		.sta = {
-			.ssid = ESP_WIFI_SSID,
-			.password = ESP_WIFI_PASS,
-			/* Setting a password implies station will connect to all security modes including WEP/WPA.
-			 * However these modes are deprecated and not advisable to be used. Incase your Access point
-			 * doesn't support WPA2, these mode can be enabled by commenting below line */
-		 .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-
-			.pmf_cfg = {
-				.capable = true,
-				.required = false
-			},
-		},
-	};
-	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-	ESP_ERROR_CHECK(esp_wifi_start() );
-
-	ESP_LOGI(TAG, "wifi_init_sta finished.");
-
-	/* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-	 * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-	EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-			WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-			pdFALSE,
-			pdFALSE,
-			portMAX_DELAY);
-
-	/* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-	 * happened. */
-	if (bits & WIFI_CONNECTED_BIT) {
-		ESP_LOGI(TAG, "connected to ap SSID:%s password:%s",
-				 ESP_WIFI_SSID, ESP_WIFI_PASS);
-	} else if (bits & WIFI_FAIL_BIT) {
-		ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s",
-				 ESP_WIFI_SSID, ESP_WIFI_PASS);
-		ret_value = ESP_FAIL;
-	} else {
-		ESP_LOGE(TAG, "UNEXPECTED EVENT");
-		ret_value = ESP_FAIL;
+static void task_start(void) {
+	for (int i=0; i<NUM_TASKS; i++) {
+		if (tasks[i].stackBuffer) {
+			tasks[i].handle = xTaskCreateStaticPinnedToCore(tasks[i].function, tasks[i].name, tasks[i].stack,
+				NULL, tasks[i].priority, tasks[i].stackBuffer, tasks[i].taskBuffer, tasks[i].core);
+			configASSERT( tasks[i].handle );
+		} else {
+			BaseType_t ret = xTaskCreatePinnedToCore(tasks[i].function, tasks[i].name, tasks[i].stack,
+				NULL, tasks[i].priority, &tasks[i].handle, tasks[i].core);
+			configASSERT( ret == pdPASS );
+		}
 	}
-
-	/* The event will not be processed after unregister */
-	ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-	ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
-	vEventGroupDelete(s_wifi_event_group);
-	return ret_value;
+	task_report();
 }
 
-void receiver(void *pvParameters);
-void buttonA(void *pvParameters);
-void buttonB(void *pvParameters);
-void buttonC(void *pvParameters);
-void tft(void *pvParameters);
+// Memory budget report
+void memory_report(void) {
+	uint32_t static_total = 0;
+#if CONFIG_STATIC_ALLOCATION
+	ESP_LOGI(TAG, "Memory budget (static allocation)");
+#else
+	ESP_LOGI(TAG, "Memory budget (dynamic allocation)");
+#endif
+	ESP_LOGI(TAG, "%-8s %6s %6s %6s", "task", "stack", "used", "free");
+	for (int i=0; i<NUM_TASKS; i++) {
+		UBaseType_t free = uxTaskGetStackHighWaterMark(tasks[i].handle);
+		ESP_LOGI(TAG, "%-8s %6d %6d %6d", tasks[i].name, tasks[i].stack, tasks[i].stack - free, free);
+		if (tasks[i].stackBuffer) static_total += tasks[i].stack + sizeof(StaticTask_t);
+	}
+	ESP_LOGI(TAG, "%-8s %6s %6s %6s", "queue", "length", "item", "bytes");
+	for (int i=0; i<NUM_QUEUES; i++) {
+		uint32_t bytes = queues[i].length * queues[i].itemSize;
+		ESP_LOGI(TAG, "%-8s %6d %6d %6d", queues[i].name, queues[i].length, queues[i].itemSize, bytes);
+		if (queues[i].storage) static_total += bytes + sizeof(StaticQueue_t);
+	}
+	ESP_LOGI(TAG, "SPI color buffer   : %d", SPI_COLOR_BUFFER_SIZE);
+#if CONFIG_RECORDER
+	ESP_LOGI(TAG, "Recorder buffers   : %d", RECORDER_RING + RECORDER_BLOCK);
+	static_total += RECORDER_RING + RECORDER_BLOCK;
+#endif
+#if CONFIG_EVLOG
+	ESP_LOGI(TAG, "Event log rings    : %d", portNUM_PROCESSORS * EVLOG_RING * sizeof(EVLOG_RECORD_t));
+	static_total += portNUM_PROCESSORS * EVLOG_RING * sizeof(EVLOG_RECORD_t);
+#endif
+#if CONFIG_TRACE
+	ESP_LOGI(TAG, "Trace ring         : %d", TRACE_RING * sizeof(TRACE_RECORD_t));
+	static_total += TRACE_RING * sizeof(TRACE_RECORD_t);
+#endif
+#if CONFIG_UDP_BACKEND_SOCKET
+	ESP_LOGI(TAG, "UDP receive buffer : %d", UDP_BUFFER_SIZE+1);
+#elif CONFIG_UDP_BACKEND_REPLAY
+	ESP_LOGI(TAG, "Replay buffers     : %d", sizeof(REPLAY_t) + UDP_BUFFER_SIZE + FRAMER_MAX_FRAME);
+#endif
+	ESP_LOGI(TAG, "Static reserved    : %d", static_total);
+	ESP_LOGI(TAG, "Heap free          : %d", esp_get_free_heap_size());
+	ESP_LOGI(TAG, "Heap minimum free  : %d", esp_get_minimum_free_heap_size());
+	ESP_LOGI(TAG, "Heap largest block : %d", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+	ESP_LOGI(TAG, "DMA capable free   : %d", heap_caps_get_free_size(MALLOC_CAP_DMA));
+}
 
 static void SPIFFS_Directory(char * path) {
 	DIR* dir = opendir(path);
@@ -203,6 +288,8 @@ esp_err_t SPIFFS_Mount(char * path, char * label, int max_files) {
 
 void app_main(void)
 {
+	boot_init();
+
 	//Initialize NVS
 	esp_err_t ret = nvs_flash_init();
 	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -210,30 +297,29 @@ void app_main(void)
 	  ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(ret);
+	boot_stage(BOOT_STAGE_NVS);
 
-	// Initialize WiFi
-	ESP_LOGI(TAG, "Initializing WiFi");
-	if (wifi_init_sta() != ESP_OK) {
-		ESP_LOGE(TAG, "Connection failed");
-		while(1) { vTaskDelay(1); }
-	}
+	// Create Queue
+	queue_create();
+
+	// Create Task
+	// The TFT task resets the panel while SPIFFS is mounted and WiFi associates.
+	task_start();
 
 	// Initialize SPIFFS
 	ESP_LOGI(TAG, "Initializing SPIFFS");
-	if (SPIFFS_Mount("/fonts", "storage", 6) != ESP_OK)
-	{
+	if (SPIFFS_Mount("/fonts", "storage", 6) == ESP_OK) {
+		boot_stage(BOOT_STAGE_SPIFFS);
+	} else {
 		ESP_LOGE(TAG, "SPIFFS mount failed");
-		while(1) { vTaskDelay(1); }
+		boot_fail(BOOT_STAGE_SPIFFS);
 	}
 
-	// Create Queue
-	xQueueCmd = xQueueCreate( 10, sizeof(CMD_t) );
-	configASSERT( xQueueCmd );
+	// Initialize WiFi
+	ESP_LOGI(TAG, "Initializing WiFi");
+	wifi_init_sta();
 
-	// Create Task
-	xTaskCreate(receiver, "UDP", 1024*4, NULL, 2, NULL);
-	xTaskCreate(buttonA, "BUTTON1", 1024*2, NULL, 2, NULL);
-	xTaskCreate(buttonB, "BUTTON2", 1024*2, NULL, 2, NULL);
-	xTaskCreate(buttonC, "BUTTON3", 1024*2, NULL, 2, NULL);
-	xTaskCreate(tft, "TFT", 1024*8, NULL, 2, NULL);
+	// Report memory once the tasks have finished their setup
+	vTaskDelay(pdMS_TO_TICKS(CONFIG_MEMORY_REPORT_DELAY));
+	memory_report();
 }
@@ -0,0 +1,110 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "os.h"
+#include "boot.h"
+#include "wifi.h"
+#include "udp_receiver.h"
+#include "health.h"
+#include "latency.h"
+#include "perf.h"
+#include "metrics.h"
+
+#if CONFIG_METRICS
+static const char *TAG = "METRICS";
+
+_Static_assert(METRICS_CORES == OS_CORES, "METRICS_CORES must follow OS_CORES");
+_Static_assert(METRICS_TASKS == PERF_TASKS, "METRICS_TASKS must follow PERF_TASKS");
+
+static uint8_t percent(int value)
+{
+	return (value < 0) ? METRICS_UNKNOWN : value;
+}
+
+static void fill(METRICS_PACKET_t *p, const PERF_t *perf, uint32_t interval)
+{
+	p->interval = interval;
+	p->sequence++;
+	p->uptime = os_time_us() / 1000;
+	p->fps = perf->fps * 10 + 0.5f;
+	p->messages = (perf->messages > UINT16_MAX) ? UINT16_MAX : perf->messages;
+
+	LATENCY_SUMMARY_t sum[LATENCY_STAGES];
+	latency_summary(sum);
+	p->latency[METRICS_P50] = sum[LATENCY_TOTAL].p50;
+	p->latency[METRICS_P95] = sum[LATENCY_TOTAL].p95;
+	p->latency[METRICS_P99] = sum[LATENCY_TOTAL].p99;
+	p->latency[METRICS_MAX] = sum[LATENCY_TOTAL].max;
+
+	// Written by the UDP task. A count may be one datagram behind.
+	p->datagrams = udpStats.datagrams;
+	p->badCrc = udpStats.badCrc;
+	p->truncated = udpStats.truncated;
+	p->oversized = udpStats.oversized;
+	uint32_t received;
+	health_totals(&received, &p->lost);
+
+	p->heapFree = os_heap_free();
+	p->heapMin = os_heap_min_free();
+	p->rssi = wifi_rssi();
+	p->link = wifi_link_state();
+	p->spi = percent(perf->spi);
+	for (int core=0; core<METRICS_CORES; core++) p->idle[core] = percent(perf->idle[core]);
+	for (int task=0; task<METRICS_TASKS; task++) {
+		p->cpu[task] = percent(perf->cpu[task]);
+		int32_t stack = perf->stackFree[task];
+		p->stackFree[task] = (stack < 0 || stack >= METRICS_NO_STACK) ? METRICS_NO_STACK : stack;
+	}
+}
+
+// METRICS task. Sends a packet every CONFIG_METRICS_INTERVAL_MS once the unit has an address.
+void metrics(void *pvParameters)
+{
+	ESP_LOGI(TAG, "Start. %s:%d every %dms", CONFIG_METRICS_HOST, CONFIG_METRICS_PORT, CONFIG_METRICS_INTERVAL_MS);
+	uint32_t addr = os_udp_address(CONFIG_METRICS_HOST);
+	if (addr == 0) ESP_LOGE(TAG, "CONFIG_METRICS_HOST=%s is not an IPv4 address. Nothing is sent.", CONFIG_METRICS_HOST);
+	boot_wait(BOOT_STAGE_IP, OS_WAIT_FOREVER);
+	int fd = -1;
+	while (addr != 0 && fd < 0) {
+		fd = os_udp_open(0, 0);
+		if (fd < 0) os_delay_ms(CONFIG_METRICS_INTERVAL_MS);
+	}
+
+	static METRICS_PACKET_t packet = {
+		.magic = METRICS_MAGIC,
+		.version = METRICS_VERSION,
+		.size = sizeof(METRICS_PACKET_t),
+	};
+	wifi_mac(packet.mac);
+	PERF_WINDOW_t window;
+	memset(&window, 0, sizeof(window));
+	PERF_t perf;
+	perf_sample(&window, &perf);
+	int64_t last = os_time_us();
+	uint32_t failed = 0;
+	while (1) {
+		os_delay_ms(CONFIG_METRICS_INTERVAL_MS);
+		if (fd < 0 || !perf_sample(&window, &perf)) continue;
+		int64_t now = os_time_us();
+		fill(&packet, &perf, (now - last) / 1000);
+		last = now;
+		// Nobody may be listening, and the link may be down. Only the first failure of a row is logged.
+		if (os_udp_send(fd, addr, CONFIG_METRICS_PORT, (const uint8_t *)&packet, sizeof(packet)) < 0) {
+			if (failed++ == 0) ESP_LOGW(TAG, "os_udp_send sequence=%u failed", packet.sequence);
+		} else {
+			failed = 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MAIN_METRICS_H_
+#define MAIN_METRICS_H_
+
+#include <stdint.h>
+
+// Metrics export.
+// Every CONFIG_METRICS_INTERVAL_MS the METRICS task sends one METRICS_PACKET_t
+// to CONFIG_METRICS_HOST:CONFIG_METRICS_PORT, so the health of many units can be
+// watched from one ground station. host/metrics_collect prints or logs them as CSV.
+// The packet has a fixed size per version and is sent as it is in memory.
+// Little endian like the ESP32.
+
+#define METRICS_MAGIC		0x4d445548	// "HUDM"
+#define METRICS_VERSION		1
+#define METRICS_CORES		2
+#define METRICS_TASKS		3			// UDP, TFT and BUTTON like perf.h
+#define METRICS_UNKNOWN		0xff		// Percent that this build does not know
+#define METRICS_NO_STACK	0xffff
+
+typedef enum {
+	METRICS_P50 = 0,
+	METRICS_P95,
+	METRICS_P99,
+	METRICS_MAX,
+	METRICS_LATENCIES,
+} METRICS_LATENCY_t;
+
+// 88 bytes. Counters are since boot, rates and percents over the interval.
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;						// sizeof(METRICS_PACKET_t) of this version
+	uint8_t mac[6];						// WiFi station MAC, which names the unit
+	uint16_t interval;					// ms since the previous packet
+	uint32_t sequence;
+	uint32_t uptime;					// ms
+	uint16_t fps;						// Updates drawn from telemetry per second, times 10
+	uint16_t messages;					// MAVLink frames per second
+	uint32_t latency[METRICS_LATENCIES];	// Receive to photon in us, of the last latency window with updates
+	uint32_t datagrams;
+	uint32_t badCrc;
+	uint32_t truncated;					// Datagrams that ended in the middle of a frame
+	uint32_t oversized;					// Datagrams larger than the receive buffer
+	uint32_t lost;						// Sequence numbers never seen, all streams
+	uint32_t heapFree;
+	uint32_t heapMin;					// Least free heap since boot
+	int8_t rssi;						// dBm of the access point. 0 while not associated.
+	uint8_t link;						// LINK_DOWN, LINK_CONNECTING or LINK_UP
+	uint8_t spi;						// Percent of the display bus
+	uint8_t idle[METRICS_CORES];		// Percent of each core in its idle task
+	uint8_t cpu[METRICS_TASKS];			// Percent of its core each task ran
+	uint16_t stackFree[METRICS_TASKS];	// Least free stack since start in bytes
+	uint16_t reserved;
+} METRICS_PACKET_t;
+
+_Static_assert(sizeof(METRICS_PACKET_t) == 88, "METRICS_PACKET_t of version 1 must stay 88 bytes");
+
+void metrics(void *pvParameters);
+
+#endif /* MAIN_METRICS_H_ */
@@ -0,0 +1,113 @@
+#ifndef MAIN_OS_H_
+#define MAIN_OS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// OS layer of the HUD core.
+// The receive, decode and render modules only use tasks, queues, event bits,
+// locks, timers, time and a UDP socket through these calls. os_freertos.c implements
+// them on the device, host/os_posix.c with pthreads and BSD sockets on Linux.
+// Waits are in milliseconds. OS_WAIT_FOREVER blocks until it succeeds.
+
+#define OS_WAIT_FOREVER		(-1)
+
+#if OS_POSIX
+#include <pthread.h>
+
+typedef struct OS_QUEUE *OS_QUEUE_t;
+typedef struct OS_EVENT *OS_EVENT_t;
+typedef struct OS_TIMER *OS_TIMER_t;
+typedef pthread_mutex_t OS_LOCK_t;
+#define OS_LOCK_INITIALIZER	PTHREAD_MUTEX_INITIALIZER
+#define os_lock(lock)		pthread_mutex_lock(lock)
+#define os_unlock(lock)		pthread_mutex_unlock(lock)
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+typedef QueueHandle_t OS_QUEUE_t;
+typedef EventGroupHandle_t OS_EVENT_t;
+typedef esp_timer_handle_t OS_TIMER_t;
+// Short sections that tasks of both cores and the tcpip task enter
+typedef portMUX_TYPE OS_LOCK_t;
+#define OS_LOCK_INITIALIZER	portMUX_INITIALIZER_UNLOCKED
+#define os_lock(lock)		portENTER_CRITICAL(lock)
+#define os_unlock(lock)		portEXIT_CRITICAL(lock)
+#endif
+
+typedef void (*OS_TASK_FUNCTION_t)(void *arg);
+
+// Time since start in microseconds
+int64_t os_time_us(void);
+void os_delay_ms(uint32_t ms);
+
+// Cycle counter of the current core for trace time stamps. Wraps, and the
+// counters of two cores are not in step.
+uint32_t os_cycles(void);
+uint32_t os_cycles_per_us(void);
+int os_core(void);
+
+// core < 0 lets the scheduler choose. Returns NULL when the task was not created.
+void *os_task_create(OS_TASK_FUNCTION_t function, const char *name, uint32_t stack, int priority, int core, void *arg);
+void *os_task_current(void);
+const char *os_task_name(void);
+
+OS_QUEUE_t os_queue_create(uint32_t length, uint32_t itemSize);
+bool os_queue_send(OS_QUEUE_t queue, const void *item, int32_t waitMs);
+bool os_queue_receive(OS_QUEUE_t queue, void *item, int32_t waitMs);
+uint32_t os_queue_waiting(OS_QUEUE_t queue);
+
+// Bits up to 1 << 23
+OS_EVENT_t os_event_create(void);
+void os_event_set(OS_EVENT_t event, uint32_t bits);
+void os_event_clear(OS_EVENT_t event, uint32_t bits);
+uint32_t os_event_get(OS_EVENT_t event);
+// Waits until all of bits are set and leaves them set. Returns the bits at that time.
+uint32_t os_event_wait(OS_EVENT_t event, uint32_t bits, int32_t waitMs);
+
+// One-shot or periodic timer. The function runs in the timer task of the OS, not in
+// an interrupt, and must not block. Starting a running timer starts it again.
+// Returns NULL or false when the OS is out of timers.
+OS_TIMER_t os_timer_create(const char *name, OS_TASK_FUNCTION_t function, void *arg);
+bool os_timer_start(OS_TIMER_t timer, uint32_t ms, bool periodic);
+void os_timer_stop(OS_TIMER_t timer);
+
+// Run time statistics of every task, for diagnostics. Run times are in the unit
+// of the run time clock and wrap. os_stats() returns false where the OS keeps none.
+#define OS_CORES			2
+#define OS_STATS_TASKS		32
+
+typedef struct {
+	char name[16];
+	int8_t idleCore;		// Core of an idle task, else -1
+	uint32_t runTime;
+	uint32_t stackFree;		// Least free stack since the task started, in bytes
+} OS_TASK_STATS_t;
+
+typedef struct {
+	uint32_t runTime;		// Run time clock at the snapshot
+	int count;
+	OS_TASK_STATS_t tasks[OS_STATS_TASKS];
+} OS_STATS_t;
+
+bool os_stats(OS_STATS_t *out);
+
+// Free heap and the least it has been since start, in bytes. 0 where the OS does not know.
+uint32_t os_heap_free(void);
+uint32_t os_heap_min_free(void);
+
+// UDP socket bound to port on every address. Addresses are IPv4 in network order,
+// ports in host order. A receive that waits longer than timeoutMs (0 for never)
+// returns OS_UDP_TIMEOUT. The rest of a datagram larger than size is dropped.
+#define OS_UDP_TIMEOUT		(-2)
+int os_udp_open(uint16_t port, int32_t timeoutMs);
+// Dotted quad to an address. 0 when text is not one.
+uint32_t os_udp_address(const char *text);
+int os_udp_receive(int fd, uint8_t *buffer, int size, uint32_t *addr, uint16_t *port);
+int os_udp_send(int fd, uint32_t addr, uint16_t port, const uint8_t *data, int length);
+void os_udp_close(int fd);
+
+#endif /* MAIN_OS_H_ */
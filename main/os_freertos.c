@@ -0,0 +1,284 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+// OS layer on FreeRTOS, esp_timer and the lwIP socket API
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp32/clk.h"
+#include "xtensa/hal.h"
+
+#include "lwip/sockets.h"
+
+#include "os.h"
+#include "trace.h"
+
+static const char *TAG = "OS";
+
+// Rounded up, so a wait is never shorter than asked for
+static TickType_t ticks(int32_t ms)
+{
+	if (ms < 0) return portMAX_DELAY;
+	return (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+int64_t os_time_us(void)
+{
+	return esp_timer_get_time();
+}
+
+void os_delay_ms(uint32_t ms)
+{
+	TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_DELAY, ms);
+	vTaskDelay(ticks(ms));
+	TRACE(TRACE_WAIT_END, TRACE_WAIT_DELAY, 1);
+}
+
+// CCOUNT, one count per CPU clock
+uint32_t os_cycles(void)
+{
+	return xthal_get_ccount();
+}
+
+uint32_t os_cycles_per_us(void)
+{
+	return esp_clk_cpu_freq() / 1000000;
+}
+
+int os_core(void)
+{
+	return xPortGetCoreID();
+}
+
+void *os_task_create(OS_TASK_FUNCTION_t function, const char *name, uint32_t stack, int priority, int core, void *arg)
+{
+	TaskHandle_t handle = NULL;
+	BaseType_t ret = xTaskCreatePinnedToCore(function, name, stack, arg, priority, &handle,
+		(core < 0 || portNUM_PROCESSORS == 1) ? tskNO_AFFINITY : core);
+	return (ret == pdPASS) ? handle : NULL;
+}
+
+void *os_task_current(void)
+{
+	return xTaskGetCurrentTaskHandle();
+}
+
+const char *os_task_name(void)
+{
+	return pcTaskGetTaskName(NULL);
+}
+
+OS_QUEUE_t os_queue_create(uint32_t length, uint32_t itemSize)
+{
+	return xQueueCreate(length, itemSize);
+}
+
+// A send or receive that may block is traced as a wait
+bool os_queue_send(OS_QUEUE_t queue, const void *item, int32_t waitMs)
+{
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_QUEUE_SEND, waitMs);
+	bool sent = xQueueSend(queue, item, ticks(waitMs)) == pdPASS;
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_QUEUE_SEND, sent);
+	TRACE(TRACE_QUEUE_SEND, sent, uxQueueMessagesWaiting(queue));
+	return sent;
+}
+
+bool os_queue_receive(OS_QUEUE_t queue, void *item, int32_t waitMs)
+{
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_QUEUE_RECEIVE, waitMs);
+	bool received = xQueueReceive(queue, item, ticks(waitMs)) == pdTRUE;
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_QUEUE_RECEIVE, received);
+	return received;
+}
+
+uint32_t os_queue_waiting(OS_QUEUE_t queue)
+{
+	return uxQueueMessagesWaiting(queue);
+}
+
+// The boot event group is the only one. With CONFIG_STATIC_ALLOCATION it is reserved here.
+#if CONFIG_STATIC_ALLOCATION
+#define STATIC_EVENTS	1
+static StaticEventGroup_t eventBuffers[STATIC_EVENTS];
+static int eventCount = 0;
+#endif
+
+OS_EVENT_t os_event_create(void)
+{
+#if CONFIG_STATIC_ALLOCATION
+	configASSERT( eventCount < STATIC_EVENTS );
+	return xEventGroupCreateStatic(&eventBuffers[eventCount++]);
+#else
+	return xEventGroupCreate();
+#endif
+}
+
+void os_event_set(OS_EVENT_t event, uint32_t bits)
+{
+	xEventGroupSetBits(event, bits);
+}
+
+void os_event_clear(OS_EVENT_t event, uint32_t bits)
+{
+	xEventGroupClearBits(event, bits);
+}
+
+uint32_t os_event_get(OS_EVENT_t event)
+{
+	return xEventGroupGetBits(event);
+}
+
+uint32_t os_event_wait(OS_EVENT_t event, uint32_t bits, int32_t waitMs)
+{
+	if (waitMs) TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_EVENT, waitMs);
+	uint32_t result = xEventGroupWaitBits(event, bits, pdFALSE, pdTRUE, ticks(waitMs));
+	if (waitMs) TRACE(TRACE_WAIT_END, TRACE_WAIT_EVENT, (result & bits) == bits);
+	return result;
+}
+
+// Callbacks run in the esp_timer task
+OS_TIMER_t os_timer_create(const char *name, OS_TASK_FUNCTION_t function, void *arg)
+{
+	esp_timer_create_args_t args = {
+		.callback = function,
+		.arg = arg,
+		.name = name,
+	};
+	esp_timer_handle_t timer;
+	if (esp_timer_create(&args, &timer) != ESP_OK) return NULL;
+	return timer;
+}
+
+bool os_timer_start(OS_TIMER_t timer, uint32_t ms, bool periodic)
+{
+	// ESP_ERR_INVALID_STATE when it was not running
+	esp_timer_stop(timer);
+	uint64_t us = (uint64_t)ms * 1000;
+	esp_err_t err = periodic ? esp_timer_start_periodic(timer, us) : esp_timer_start_once(timer, us);
+	return err == ESP_OK;
+}
+
+void os_timer_stop(OS_TIMER_t timer)
+{
+	esp_timer_stop(timer);
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// uxTaskGetSystemState() takes every task or none, so it gets room for all of them
+bool os_stats(OS_STATS_t *out)
+{
+	TaskStatus_t status[OS_STATS_TASKS];
+	uint32_t runTime;
+	UBaseType_t count = uxTaskGetSystemState(status, OS_STATS_TASKS, &runTime);
+	if (count == 0) return false;
+	out->runTime = runTime;
+	out->count = count;
+	for (int i=0; i<count; i++) {
+		OS_TASK_STATS_t *t = &out->tasks[i];
+		snprintf(t->name, sizeof(t->name), "%s", status[i].pcTaskName);
+		t->idleCore = -1;
+		for (int core=0; core<portNUM_PROCESSORS; core++) {
+			if (status[i].xHandle == xTaskGetIdleTaskHandleForCPU(core)) t->idleCore = core;
+		}
+		t->runTime = status[i].ulRunTimeCounter;
+		t->stackFree = status[i].usStackHighWaterMark;
+	}
+	return true;
+}
+#else
+bool os_stats(OS_STATS_t *out)
+{
+	return false;
+}
+#endif
+
+uint32_t os_heap_free(void)
+{
+	return esp_get_free_heap_size();
+}
+
+uint32_t os_heap_min_free(void)
+{
+	return esp_get_minimum_free_heap_size();
+}
+
+int os_udp_open(uint16_t port, int32_t timeoutMs)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	int fd = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) {
+		ESP_LOGE(TAG, "lwip_socket errno=%d", errno);
+		return -1;
+	}
+	if (lwip_bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ESP_LOGE(TAG, "lwip_bind port=%d errno=%d", port, errno);
+		lwip_close(fd);
+		return -1;
+	}
+	if (timeoutMs > 0) {
+		struct timeval timeout = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+		if (lwip_setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+			ESP_LOGE(TAG, "SO_RCVTIMEO errno=%d", errno);
+			lwip_close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+int os_udp_receive(int fd, uint8_t *buffer, int size, uint32_t *addr, uint16_t *port)
+{
+	struct sockaddr_in from;
+	socklen_t fromLen = sizeof(from);
+	TRACE(TRACE_WAIT_BEGIN, TRACE_WAIT_UDP, 0);
+	int ret = lwip_recvfrom(fd, buffer, size, 0, (struct sockaddr *)&from, &fromLen);
+	TRACE(TRACE_WAIT_END, TRACE_WAIT_UDP, ret >= 0);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return OS_UDP_TIMEOUT;
+		ESP_LOGW(TAG, "lwip_recvfrom errno=%d", errno);
+		return -1;
+	}
+	*addr = from.sin_addr.s_addr;
+	*port = ntohs(from.sin_port);
+	return ret;
+}
+
+int os_udp_send(int fd, uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(port);
+	to.sin_addr.s_addr = addr;
+	return lwip_sendto(fd, data, length, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+uint32_t os_udp_address(const char *text)
+{
+	struct in_addr addr;
+	if (!inet_aton(text, &addr)) return 0;
+	return addr.s_addr;
+}
+
+void os_udp_close(int fd)
+{
+	lwip_close(fd);
+}
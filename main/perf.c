@@ -0,0 +1,89 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "os.h"
+#include "ili9340.h"
+#include "udp_receiver.h"
+#include "perf.h"
+
+static const char *taskNames[PERF_TASKS] = { "UDP", "TFT", "BUTTON" };
+
+// Written by the TFT task only
+static uint32_t frames = 0;
+
+const char *perf_task_name(int task)
+{
+	return (task >= 0 && task < PERF_TASKS) ? taskNames[task] : "?";
+}
+
+// Called by the TFT task for every update drawn from telemetry
+void perf_frame(void)
+{
+	frames++;
+}
+
+static int percent(uint32_t part, uint32_t whole)
+{
+	if (whole == 0) return -1;
+	uint32_t p = (uint64_t)part * 100 / whole;
+	return (p > 100) ? 100 : p;
+}
+
+bool perf_sample(PERF_WINDOW_t *window, PERF_t *out)
+{
+	PERF_WINDOW_t now = {
+		.time = os_time_us(),
+		.frames = frames,
+		.messages = udpStats.frames + udpStats.skipped,
+		.spiBytes = spi_bus_bytes(),
+	};
+	int32_t stackFree[PERF_TASKS] = { -1, -1, -1 };
+	OS_STATS_t stats;
+	now.statsValid = os_stats(&stats);
+	if (now.statsValid) now.runTime = stats.runTime;
+	for (int i=0; now.statsValid && i<stats.count; i++) {
+		const OS_TASK_STATS_t *t = &stats.tasks[i];
+		for (int task=0; task<PERF_TASKS; task++) {
+			if (strcmp(t->name, taskNames[task]) != 0) continue;
+			now.taskTime[task] = t->runTime;
+			now.tasksFound |= 1 << task;
+			stackFree[task] = t->stackFree;
+		}
+		int core = t->idleCore;
+		if (core < 0 || core >= OS_CORES) continue;
+		now.idleTime[core] = t->runTime;
+		if (core >= now.cores) now.cores = core + 1;
+	}
+
+	PERF_WINDOW_t last = *window;
+	*window = now;
+	if (last.time == 0 || now.time <= last.time) return false;
+
+	int64_t elapsed = now.time - last.time;
+	out->fps = (now.frames - last.frames) * 1000000.0f / elapsed;
+	out->messages = (uint64_t)(now.messages - last.messages) * 1000000 / elapsed;
+	// Every bit takes one clock of the bus
+	uint64_t busUs = (uint64_t)(now.spiBytes - last.spiBytes) * 8 * 1000000 / spi_bus_hz();
+	out->spi = percent(busUs, elapsed);
+	for (int core=0; core<OS_CORES; core++) {
+		out->idle[core] = -1;
+		if (now.statsValid && last.statsValid && core < now.cores) {
+			out->idle[core] = percent(now.idleTime[core] - last.idleTime[core], now.runTime - last.runTime);
+		}
+	}
+	for (int task=0; task<PERF_TASKS; task++) {
+		out->cpu[task] = -1;
+		if (now.tasksFound & last.tasksFound & (1 << task)) {
+			out->cpu[task] = percent(now.taskTime[task] - last.taskTime[task], now.runTime - last.runTime);
+		}
+		out->stackFree[task] = stackFree[task];
+	}
+	return true;
+}
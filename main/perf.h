@@ -0,0 +1,40 @@
+#ifndef MAIN_PERF_H_
+#define MAIN_PERF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "os.h"
+
+// Load of the unit between two samples.
+// Every reader keeps its own window, so readers with different periods do not disturb each other.
+#define PERF_TASKS		3		// CPU share and stack headroom of UDP, TFT and BUTTON
+
+typedef struct {
+	int64_t time;
+	uint32_t frames;
+	uint32_t messages;
+	uint32_t spiBytes;
+	bool statsValid;
+	int cores;						// With an idle task
+	uint32_t runTime;
+	uint32_t idleTime[OS_CORES];
+	uint32_t taskTime[PERF_TASKS];
+	uint32_t tasksFound;			// Bit per task that exists
+} PERF_WINDOW_t;
+
+typedef struct {
+	int idle[OS_CORES];				// Percent of the window the idle task of the core ran. -1 when unknown.
+	float fps;						// Updates drawn from telemetry per second
+	uint32_t messages;				// MAVLink frames per second, used or not
+	int spi;						// Percent of the window the display bus was busy
+	int cpu[PERF_TASKS];			// Percent of the window the task ran on its core. -1 when unknown.
+	int32_t stackFree[PERF_TASKS];	// Least free stack since start in bytes. -1 when unknown.
+} PERF_t;
+
+const char *perf_task_name(int task);
+void perf_frame(void);
+// False for the first call of a window, which only starts it
+bool perf_sample(PERF_WINDOW_t *window, PERF_t *out);
+
+#endif /* MAIN_PERF_H_ */
@@ -0,0 +1,269 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+
+#include "os.h"
+#include "cmd.h"
+#include "framer.h"
+#include "recorder.h"
+
+extern OS_QUEUE_t xQueueCmd;
+
+static const char *TAG = "RECORDER";
+
+_Static_assert((RECORDER_RING & (RECORDER_RING - 1)) == 0, "CONFIG_RECORDER_RING_KB must be a power of two");
+
+// Single producer, single consumer. The receive path only moves head and the
+// writer task only moves tail, so neither side ever waits for the other.
+// Both are free running and wrap through the unsigned range.
+static uint8_t ring[RECORDER_RING];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+
+static volatile bool recording = false;
+static volatile bool toggle = false;
+static volatile RECORDER_STATE_t state = RECORDER_OFF;
+static RECORDER_STATS_t stats;
+
+// Owned by the writer task
+static uint8_t block[RECORDER_BLOCK] __attribute__((aligned(4)));
+static uint16_t used = 0;
+static const esp_partition_t *partition;
+static uint32_t numBlocks;
+static uint32_t nextBlock = 0;
+static uint32_t session = 0;
+static uint32_t seq = 0;
+static uint32_t droppedSeen = 0;
+static int64_t lastDrop = 0;
+
+static void ring_put(uint32_t pos, const uint8_t *data, uint32_t length)
+{
+	uint32_t offset = pos & (RECORDER_RING - 1);
+	uint32_t first = RECORDER_RING - offset;
+	if (first > length) first = length;
+	memcpy(&ring[offset], data, first);
+	memcpy(ring, data + first, length - first);
+}
+
+static void ring_get(uint32_t pos, uint8_t *data, uint32_t length)
+{
+	uint32_t offset = pos & (RECORDER_RING - 1);
+	uint32_t first = RECORDER_RING - offset;
+	if (first > length) first = length;
+	memcpy(data, &ring[offset], first);
+	memcpy(data + first, ring, length - first);
+}
+
+// Framer hook. Runs in the receive path, so it never waits.
+// A record that does not fit is dropped and counted.
+void recorder_frame(const FRAME_t *frame, void *arg)
+{
+	if (!recording) return;
+	uint32_t length = 8 + frame->length;
+	uint32_t h = head;
+	uint32_t fill = h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+	if (RECORDER_RING - fill < length) {
+		stats.dropped++;
+		stats.droppedBytes += length;
+		return;
+	}
+
+	uint64_t now = esp_timer_get_time();
+	uint8_t stamp[8];
+	for (int i=0; i<8; i++) stamp[i] = now >> (56 - i * 8);
+	ring_put(h, stamp, sizeof(stamp));
+	ring_put(h + sizeof(stamp), frame->frame, frame->length);
+	__atomic_store_n(&head, h + length, __ATOMIC_RELEASE);
+
+	fill += length;
+	if (fill > stats.ringMax) stats.ringMax = fill;
+	stats.records++;
+	stats.bytes += length;
+}
+
+// Called by the TFT task. The writer task starts or stops at its next poll.
+void recorder_toggle(void)
+{
+	toggle = true;
+}
+
+RECORDER_STATE_t recorder_state(void)
+{
+	return state;
+}
+
+void recorder_report(void)
+{
+	static uint32_t droppedReported = 0;
+	if (stats.records == 0 && stats.dropped == 0) return;
+	ESP_LOGI(TAG, "%s session=%u records=%u bytes=%u blocks=%u wraps=%u ring_max=%u/%u erase_max=%uus write_max=%uus",
+		recording ? "on" : "off", session, stats.records, stats.bytes, stats.blocks, stats.wraps,
+		stats.ringMax, RECORDER_RING, stats.eraseMax, stats.writeMax);
+	if (stats.dropped != droppedReported) {
+		ESP_LOGW(TAG, "dropped=%u bytes=%u. Flash does not keep up", stats.dropped, stats.droppedBytes);
+		droppedReported = stats.dropped;
+	}
+	if (stats.writeErrors) ESP_LOGW(TAG, "write_errors=%u", stats.writeErrors);
+}
+
+// Whole record length from the frame header behind the timestamp
+static uint32_t record_length(uint32_t pos)
+{
+	uint8_t header[3];
+	ring_get(pos + 8, header, sizeof(header));
+	if (header[0] == FRAMER_STX_V2) {
+		return 8 + FRAMER_HEADER_V2 + header[1] + 2 + ((header[2] & 0x01) ? FRAMER_SIGNATURE : 0);
+	}
+	return 8 + FRAMER_HEADER_V1 + header[1] + 2;
+}
+
+// The TFT task redraws the indicator on CMD_STATUS
+static void set_state(RECORDER_STATE_t newState)
+{
+	if (newState == state) return;
+	state = newState;
+	CMD_t cmdBuf;
+	cmdBuf.command = CMD_STATUS;
+	cmdBuf.time = esp_timer_get_time();
+	cmdBuf.taskHandle = os_task_current();
+	os_queue_send(xQueueCmd, &cmdBuf, 0);
+}
+
+// Erase and write one sector. Blocks are used in turn through the budget,
+// so every sector sees the same number of erase cycles.
+// The flash cache is off on both cores during each call, which stops every task
+// that is not in IRAM, the receive path too. The erase is the long one.
+static void write_block(void)
+{
+	RECORDER_BLOCK_t *header = (RECORDER_BLOCK_t *)block;
+	header->magic = RECORDER_MAGIC;
+	header->session = session;
+	header->seq = seq++;
+	header->used = used;
+	header->reserved = 0;
+	memset(&block[sizeof(RECORDER_BLOCK_t) + used], 0xFF, RECORDER_DATA - used);
+
+	uint32_t offset = nextBlock * RECORDER_BLOCK;
+	int64_t start = esp_timer_get_time();
+	esp_err_t err = esp_partition_erase_range(partition, offset, RECORDER_BLOCK);
+	int64_t erased = esp_timer_get_time();
+	if (erased - start > stats.eraseMax) stats.eraseMax = erased - start;
+	if (err == ESP_OK) {
+		err = esp_partition_write(partition, offset, block, RECORDER_BLOCK);
+		uint32_t elapsed = esp_timer_get_time() - erased;
+		if (elapsed > stats.writeMax) stats.writeMax = elapsed;
+	}
+	if (err != ESP_OK) {
+		stats.writeErrors++;
+		ESP_LOGW(TAG, "block %u: %s", nextBlock, esp_err_to_name(err));
+	}
+
+	stats.blocks++;
+	if (++nextBlock == numBlocks) {
+		nextBlock = 0;
+		stats.wraps++;
+	}
+	used = 0;
+}
+
+// Move whole records from the ring into the block buffer
+static void drain(bool flush)
+{
+	uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	while (tail != h) {
+		uint32_t length = record_length(tail);
+		if (used + length > RECORDER_DATA) write_block();
+		ring_get(tail, &block[sizeof(RECORDER_BLOCK_t) + used], length);
+		used += length;
+		__atomic_store_n(&tail, tail + length, __ATOMIC_RELEASE);
+	}
+	if (flush && used > 0) write_block();
+}
+
+// Continue after the newest block of the last recording
+static void resume(void)
+{
+	bool found = false;
+	uint32_t lastSeq = 0;
+	for (uint32_t i=0; i<numBlocks; i++) {
+		RECORDER_BLOCK_t header;
+		if (esp_partition_read(partition, i * RECORDER_BLOCK, &header, sizeof(header)) != ESP_OK) continue;
+		if (header.magic != RECORDER_MAGIC) continue;
+		if (!found || header.session > session || (header.session == session && header.seq > lastSeq)) {
+			session = header.session;
+			lastSeq = header.seq;
+			nextBlock = (i + 1) % numBlocks;
+			found = true;
+		}
+	}
+	ESP_LOGI(TAG, "partition=0x%x budget=%u blocks, last session=%u next block=%u",
+		partition->size, numBlocks, session, nextBlock);
+}
+
+// Recorder Writer Task
+// Runs at low priority. The receive path only waits for flash while the cache is off.
+void recorder(void *pvParameters)
+{
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, RECORDER_SUBTYPE, RECORDER_LABEL);
+	if (partition == NULL) {
+		// The task stays, so its handle stays valid for memory_report(). Recording never starts.
+		ESP_LOGE(TAG, "No %s partition. See partitions.csv", RECORDER_LABEL);
+		while (1) os_delay_ms(60 * 1000);
+	}
+	uint32_t budget = CONFIG_RECORDER_BUDGET_KB * 1024;
+	if (budget > partition->size) budget = partition->size;
+	numBlocks = budget / RECORDER_BLOCK;
+	resume();
+#if CONFIG_RECORDER_AUTOSTART
+	toggle = true;
+#endif
+
+	while(1) {
+		vTaskDelay(pdMS_TO_TICKS(RECORDER_POLL_MS));
+		if (toggle) {
+			toggle = false;
+			if (!recording) {
+				session++;
+				seq = 0;
+				used = 0;
+				recording = true;
+				ESP_LOGI(TAG, "start session=%u", session);
+			} else {
+				recording = false;
+				// Let a record in flight land in the ring
+				vTaskDelay(1);
+				drain(true);
+				ESP_LOGI(TAG, "stop session=%u blocks=%u", session, seq);
+			}
+		}
+		if (recording) drain(false);
+
+		int64_t now = esp_timer_get_time();
+		if (stats.dropped != droppedSeen) {
+			droppedSeen = stats.dropped;
+			lastDrop = now;
+		}
+		if (!recording) {
+			set_state(RECORDER_OFF);
+		} else if (lastDrop != 0 && now - lastDrop < RECORDER_DROP_US) {
+			set_state(RECORDER_DROPPING);
+		} else {
+			set_state(RECORDER_ON);
+		}
+	}
+}
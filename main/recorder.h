@@ -0,0 +1,58 @@
+#ifndef MAIN_RECORDER_H_
+#define MAIN_RECORDER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "framer.h"
+
+// Flight recorder.
+// The receive path appends every frame with a timestamp to a ring buffer, tlog style.
+// A low priority task moves whole flash sectors from the ring to the tlog partition.
+
+#define RECORDER_SUBTYPE	0x40	// Data partition subtype in partitions.csv
+#define RECORDER_LABEL		"tlog"
+#define RECORDER_BLOCK		4096	// Flash sector. Erased and written at once.
+#define RECORDER_MAGIC		0x474f4c54	// "TLOG"
+#define RECORDER_RING		(CONFIG_RECORDER_RING_KB * 1024)
+#define RECORDER_POLL_MS	50
+#define RECORDER_DROP_US	(2 * 1000 * 1000)	// Shown as dropping for this long
+
+// Start of every block. The rest is tlog records, a big endian timestamp in
+// microseconds followed by one frame. A record never spans blocks.
+typedef struct {
+	uint32_t magic;
+	uint32_t session;	// Counts up at every start of recording
+	uint32_t seq;		// Block number within the session
+	uint16_t used;		// Record bytes after the header
+	uint16_t reserved;
+} RECORDER_BLOCK_t;
+
+#define RECORDER_DATA		(RECORDER_BLOCK - sizeof(RECORDER_BLOCK_t))
+
+typedef enum {
+	RECORDER_OFF = 0,
+	RECORDER_ON,
+	RECORDER_DROPPING,	// Flash does not keep up
+} RECORDER_STATE_t;
+
+typedef struct {
+	uint32_t records;
+	uint32_t bytes;
+	uint32_t dropped;		// Records that did not fit in the ring
+	uint32_t droppedBytes;
+	uint32_t ringMax;		// Ring high water mark
+	uint32_t blocks;		// Blocks written
+	uint32_t wraps;			// Times the budget was full and the oldest block was reused
+	uint32_t eraseMax;		// Longest sector erase in microseconds. The receive path stalls this long.
+	uint32_t writeMax;		// Longest sector write in microseconds
+	uint32_t writeErrors;
+} RECORDER_STATS_t;
+
+void recorder_frame(const FRAME_t *frame, void *arg);
+void recorder_toggle(void);
+RECORDER_STATE_t recorder_state(void);
+void recorder_report(void);
+void recorder(void *pvParameters);
+
+#endif /* MAIN_RECORDER_H_ */
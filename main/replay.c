@@ -0,0 +1,233 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "framer.h"
+#include "recorder.h"
+#include "replay.h"
+
+static const char *TAG = "REPLAY";
+
+// A position is a byte offset for a plain tlog. For a recorder partition it is
+// the block index of the session in the upper bits and the offset in its data below.
+#define POS_SHIFT	12
+#define POS_MASK	((1 << POS_SHIFT) - 1)
+
+_Static_assert(RECORDER_DATA <= POS_MASK, "block data must fit below POS_SHIFT");
+
+// Frames read while indexing and seeking
+static uint8_t scratch[FRAMER_MAX_FRAME];
+
+static uint64_t timestamp(const uint8_t *p)
+{
+	uint64_t t = 0;
+	for (int i=0; i<8; i++) t = (t << 8) | p[i];
+	return t;
+}
+
+static int compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x < y) ? -1 : (x > y);
+}
+
+// Collect the blocks of the newest session in seq order.
+// Returns false when the source holds no recorder blocks.
+static bool find_blocks(REPLAY_t *r)
+{
+	if (r->size % RECORDER_BLOCK) return false;
+	uint32_t count = r->size / RECORDER_BLOCK;
+	// seq above the physical block number, so one sort orders both
+	uint64_t *keys = malloc(sizeof(uint64_t) * count);
+	if (keys == NULL) return false;
+
+	uint32_t numKeys = 0;
+	bool found = false;
+	for (uint32_t i=0; i<count; i++) {
+		RECORDER_BLOCK_t header;
+		if (!r->read(r->ctx, i * RECORDER_BLOCK, &header, sizeof(header))) continue;
+		if (header.magic != RECORDER_MAGIC || header.used > RECORDER_DATA) continue;
+		if (!found || header.session > r->session) {
+			r->session = header.session;
+			numKeys = 0;
+			found = true;
+		}
+		if (header.session == r->session) keys[numKeys++] = ((uint64_t)header.seq << 16) | i;
+	}
+	if (!found) {
+		free(keys);
+		return false;
+	}
+	qsort(keys, numKeys, sizeof(uint64_t), compare);
+
+	r->blocks = malloc(sizeof(uint16_t) * numKeys);
+	r->used = malloc(sizeof(uint16_t) * numKeys);
+	if (r->blocks == NULL || r->used == NULL) {
+		free(keys);
+		replay_close(r);
+		return false;
+	}
+	for (uint32_t i=0; i<numKeys; i++) {
+		RECORDER_BLOCK_t header;
+		r->blocks[i] = keys[i] & 0xFFFF;
+		r->used[i] = 0;
+		if (r->read(r->ctx, r->blocks[i] * RECORDER_BLOCK, &header, sizeof(header))) r->used[i] = header.used;
+	}
+	r->numBlocks = numKeys;
+	free(keys);
+	return true;
+}
+
+// Read the record at *pos and move *pos behind it.
+// Returns the frame length, 0 at the end and -1 for a record that is not a frame.
+static int read_record(REPLAY_t *r, uint32_t *pos, uint8_t *frame, uint64_t *stamp)
+{
+	uint32_t offset, limit;
+	while (1) {
+		if (r->blocks == NULL) {
+			offset = *pos;
+			limit = r->size;
+			break;
+		}
+		uint32_t index = *pos >> POS_SHIFT;
+		uint32_t inBlock = *pos & POS_MASK;
+		if (index >= r->numBlocks) return 0;
+		// Records never span blocks. The rest of a block is padding.
+		if (inBlock + 8 + FRAMER_HEADER_V1 <= r->used[index]) {
+			offset = r->blocks[index] * RECORDER_BLOCK + sizeof(RECORDER_BLOCK_t) + inBlock;
+			limit = offset - inBlock + r->used[index];
+			break;
+		}
+		*pos = (index + 1) << POS_SHIFT;
+	}
+
+	uint8_t head[8 + 3];
+	if (offset + sizeof(head) > limit) return 0;
+	if (!r->read(r->ctx, offset, head, sizeof(head))) return -1;
+	int length;
+	if (head[8] == FRAMER_STX_V2) {
+		length = FRAMER_HEADER_V2 + head[9] + 2 + ((head[10] & 0x01) ? FRAMER_SIGNATURE : 0);
+	} else if (head[8] == FRAMER_STX_V1) {
+		length = FRAMER_HEADER_V1 + head[9] + 2;
+	} else {
+		return -1;
+	}
+	if (offset + 8 + length > limit) return (r->blocks == NULL) ? 0 : -1;
+	if (!r->read(r->ctx, offset + 8, frame, length)) return -1;
+	*stamp = timestamp(head);
+	*pos += 8 + length;
+	return length;
+}
+
+// Add a seek mark. A full index keeps every other mark at twice the spacing.
+static void add_mark(REPLAY_t *r, uint64_t stamp, uint32_t pos)
+{
+	if (r->numMarks > 0 && stamp < r->marks[r->numMarks-1].stamp + r->markUs) return;
+	if (r->numMarks == REPLAY_MARKS) {
+		for (int i=0; i<REPLAY_MARKS/2; i++) r->marks[i] = r->marks[i*2];
+		r->numMarks = REPLAY_MARKS/2;
+		r->markUs *= 2;
+		if (stamp < r->marks[r->numMarks-1].stamp + r->markUs) return;
+	}
+	r->marks[r->numMarks].stamp = stamp;
+	r->marks[r->numMarks].pos = pos;
+	r->numMarks++;
+}
+
+// Open a plain tlog or a recorder partition and index it in one pass
+bool replay_open(REPLAY_t *r, REPLAY_READ read, void *ctx, uint32_t size)
+{
+	memset(r, 0, sizeof(REPLAY_t));
+	r->read = read;
+	r->ctx = ctx;
+	r->size = size;
+	r->markUs = REPLAY_MARK_US;
+	if (find_blocks(r)) {
+		ESP_LOGI(TAG, "recorder session=%u blocks=%u", r->session, r->numBlocks);
+	}
+
+	uint32_t pos = 0;
+	while (1) {
+		uint32_t start = pos;
+		uint64_t stamp;
+		int length = read_record(r, &pos, scratch, &stamp);
+		if (length < 0) {
+			ESP_LOGW(TAG, "no frame at 0x%x. Replay stops there", start);
+			break;
+		}
+		if (length == 0) break;
+		if (r->records == 0) r->first = stamp;
+		r->last = stamp;
+		r->records++;
+		add_mark(r, stamp, start);
+	}
+	if (r->records == 0) {
+		ESP_LOGE(TAG, "no records");
+		replay_close(r);
+		return false;
+	}
+	ESP_LOGI(TAG, "records=%u duration=%.1fs marks=%d every %ums",
+		r->records, (r->last - r->first) / 1e6, r->numMarks, r->markUs / 1000);
+	replay_seek(r, 0);
+	return true;
+}
+
+void replay_close(REPLAY_t *r)
+{
+	free(r->blocks);
+	free(r->used);
+	r->blocks = NULL;
+	r->used = NULL;
+	r->numBlocks = 0;
+	r->records = 0;
+}
+
+// Continue at the first record offset microseconds after the start of the recording
+void replay_seek(REPLAY_t *r, uint64_t offset)
+{
+	uint64_t target = r->first + offset;
+	int mark = 0;
+	while (mark + 1 < r->numMarks && r->marks[mark+1].stamp <= target) mark++;
+	r->pos = r->marks[mark].pos;
+
+	while (1) {
+		uint32_t pos = r->pos;
+		uint64_t stamp;
+		if (read_record(r, &pos, scratch, &stamp) <= 0 || stamp >= target) break;
+		r->pos = pos;
+	}
+	r->paced = false;
+}
+
+// Next frame and its timestamp. Returns the frame length, 0 at the end.
+int replay_next(REPLAY_t *r, uint8_t *frame, uint64_t *stamp)
+{
+	int length = read_record(r, &r->pos, frame, stamp);
+	return (length < 0) ? 0 : length;
+}
+
+// Microseconds until the frame with stamp is due. now is any monotonic clock.
+// The first frame after a seek is due at once and sets the reference.
+int64_t replay_wait(REPLAY_t *r, uint64_t stamp, int64_t now)
+{
+	if (r->speed == REPLAY_SPEED_MAX) return 0;
+	if (!r->paced) {
+		r->paced = true;
+		r->paceStart = now;
+		r->paceStamp = stamp;
+		return 0;
+	}
+	// An older timestamp than the reference is due at once
+	int64_t delta = (int64_t)(stamp - r->paceStamp);
+	if (delta < 0) return 0;
+	return r->paceStart + delta * 100 / r->speed - now;
+}
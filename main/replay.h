@@ -0,0 +1,59 @@
+#ifndef MAIN_REPLAY_H_
+#define MAIN_REPLAY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "framer.h"
+
+// tlog replay.
+// Reads a plain tlog, or the newest session of a recorder partition, through a
+// read callback and hands out the frames with their timestamps at a chosen pace.
+// No ESP-IDF dependencies except esp_log.h, so the host tools use it too.
+
+#define REPLAY_MARKS		256		// Seek index entries
+#define REPLAY_MARK_US		(1000 * 1000)	// First index spacing. Doubles when the index is full.
+#define REPLAY_SPEED_MAX	0		// As fast as possible
+
+// Reads length bytes at offset of the source. Returns false on error.
+typedef bool (*REPLAY_READ)(void *ctx, uint32_t offset, void *out, uint32_t length);
+
+typedef struct {
+	uint64_t stamp;
+	uint32_t pos;
+} REPLAY_MARK_t;
+
+typedef struct {
+	REPLAY_READ read;
+	void *ctx;
+	uint32_t size;
+
+	// Recorder partition: blocks of the session in order. NULL for a plain tlog.
+	uint16_t *blocks;
+	uint16_t *used;
+	uint32_t numBlocks;
+	uint32_t session;
+
+	// Filled by replay_open()
+	uint32_t records;
+	uint64_t first;		// Timestamps in microseconds
+	uint64_t last;
+	REPLAY_MARK_t marks[REPLAY_MARKS];
+	int numMarks;
+	uint32_t markUs;
+
+	// Playback
+	uint32_t pos;
+	uint32_t speed;		// Percent of real time, REPLAY_SPEED_MAX for no pacing
+	bool paced;
+	int64_t paceStart;
+	uint64_t paceStamp;
+} REPLAY_t;
+
+bool replay_open(REPLAY_t *r, REPLAY_READ read, void *ctx, uint32_t size);
+void replay_close(REPLAY_t *r);
+void replay_seek(REPLAY_t *r, uint64_t offset);
+int replay_next(REPLAY_t *r, uint8_t *frame, uint64_t *stamp);
+int64_t replay_wait(REPLAY_t *r, uint64_t stamp, int64_t now);
+
+#endif /* MAIN_REPLAY_H_ */
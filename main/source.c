@@ -0,0 +1,202 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "source.h"
+
+static const char *TAG = "SOURCE";
+
+//#define CONFIG_MAVLINK_SOURCES	4
+//#define CONFIG_MAVLINK_SOURCE_IDLE	30
+//#define CONFIG_MAVLINK_ALLOW	"*:1"
+
+// Senders and an open addressing index into them (0 = empty, n = sources[n-1]).
+// Only the receive path changes the table. The lock keeps source_report() consistent.
+static SOURCE_t sources[CONFIG_MAVLINK_SOURCES];
+static uint8_t hashIndex[SOURCE_HASH_SIZE];
+static int64_t lastEvict = 0;
+static OS_LOCK_t sourceLock = OS_LOCK_INITIALIZER;
+
+// sysid/compid pairs that reach the dispatch table. SOURCE_ANY matches every ID.
+typedef struct {
+	int16_t sysid;
+	int16_t compid;
+} ALLOW_t;
+
+static ALLOW_t allow[SOURCE_ALLOW_MAX];
+static int numAllow = 0;
+
+static uint32_t source_hash(uint32_t addr, uint16_t port)
+{
+	uint32_t h = addr ^ (port * 0x9e3779b1);
+	h ^= h >> 16;
+	return h & (SOURCE_HASH_SIZE - 1);
+}
+
+static void source_rehash(void)
+{
+	memset(hashIndex, 0, sizeof(hashIndex));
+	for (int i=0; i<CONFIG_MAVLINK_SOURCES; i++) {
+		if (!sources[i].used) continue;
+		uint32_t h = source_hash(sources[i].addr, sources[i].port);
+		while (hashIndex[h] != 0) h = (h + 1) & (SOURCE_HASH_SIZE - 1);
+		hashIndex[h] = i + 1;
+	}
+}
+
+// "*" or a number from 0 to 255
+static int16_t parse_id(const char *text, char **end)
+{
+	if (*text == '*') {
+		*end = (char *)text + 1;
+		return SOURCE_ANY;
+	}
+	long value = strtol(text, end, 10);
+	if (*end == text || value < 0 || value > 255) return -2;
+	return value;
+}
+
+// CONFIG_MAVLINK_ALLOW is a comma separated list of sysid:compid, for example "*:1,255:190".
+// An empty list allows everything.
+static void parse_allow(const char *list)
+{
+	const char *p = list;
+	while (*p && numAllow < SOURCE_ALLOW_MAX) {
+		while (isspace((int)*p) || *p == ',') p++;
+		if (*p == 0) break;
+		char *end;
+		int16_t sysid = parse_id(p, &end);
+		int16_t compid = -2;
+		if (sysid != -2 && *end == ':') compid = parse_id(end + 1, &end);
+		if (sysid == -2 || compid == -2) {
+			ESP_LOGE(TAG, "Bad allow-list entry in \"%s\"", list);
+			while (*p && *p != ',') p++;
+			continue;
+		}
+		allow[numAllow].sysid = sysid;
+		allow[numAllow].compid = compid;
+		numAllow++;
+		p = end;
+	}
+}
+
+void source_init(void)
+{
+	memset(sources, 0, sizeof(sources));
+	memset(hashIndex, 0, sizeof(hashIndex));
+	numAllow = 0;
+	parse_allow(CONFIG_MAVLINK_ALLOW);
+	for (int i=0; i<numAllow; i++) {
+		ESP_LOGI(TAG, "allow sysid=%d compid=%d (-1=any)", allow[i].sysid, allow[i].compid);
+	}
+}
+
+bool source_allowed(uint8_t sysid, uint8_t compid)
+{
+	if (numAllow == 0) return true;
+	for (int i=0; i<numAllow; i++) {
+		if (allow[i].sysid != SOURCE_ANY && allow[i].sysid != sysid) continue;
+		if (allow[i].compid != SOURCE_ANY && allow[i].compid != compid) continue;
+		return true;
+	}
+	return false;
+}
+
+// addr is in network order, so the first octet is the low byte on the ESP32
+void source_name(const SOURCE_t *src, char *name)
+{
+	sprintf(name, "%d.%d.%d.%d:%d", src->addr & 0xff, (src->addr >> 8) & 0xff,
+		(src->addr >> 16) & 0xff, (src->addr >> 24) & 0xff, src->port);
+}
+
+// Drop senders that went quiet. Checked at most once a second. Returns how many were dropped.
+static int source_evict(int64_t now)
+{
+	if (now - lastEvict < 1000*1000) return 0;
+	lastEvict = now;
+	int evicted = 0;
+	for (int i=0; i<CONFIG_MAVLINK_SOURCES; i++) {
+		if (!sources[i].used || now - sources[i].lastSeen < SOURCE_IDLE_US) continue;
+		sources[i].used = false;
+		evicted++;
+	}
+	if (evicted) source_rehash();
+	return evicted;
+}
+
+// Parser context of a sender. A new sender takes a free entry, or the least recently seen one.
+SOURCE_t *source_lookup(uint32_t addr, uint16_t port, int64_t now)
+{
+	// No logging inside the critical section
+	os_lock(&sourceLock);
+	int evicted = source_evict(now);
+
+	uint32_t h = source_hash(addr, port);
+	while (hashIndex[h] != 0) {
+		SOURCE_t *src = &sources[hashIndex[h] - 1];
+		if (src->addr == addr && src->port == port) {
+			src->lastSeen = now;
+			os_unlock(&sourceLock);
+			if (evicted) ESP_LOGI(TAG, "%d idle sender(s) evicted", evicted);
+			return src;
+		}
+		h = (h + 1) & (SOURCE_HASH_SIZE - 1);
+	}
+
+	int slot = 0;
+	for (int i=0; i<CONFIG_MAVLINK_SOURCES; i++) {
+		if (!sources[i].used) {
+			slot = i;
+			break;
+		}
+		if (sources[i].lastSeen < sources[slot].lastSeen) slot = i;
+	}
+	SOURCE_t *src = &sources[slot];
+	bool replaced = src->used;
+	memset(src, 0, sizeof(SOURCE_t));
+	src->used = true;
+	src->addr = addr;
+	src->port = port;
+	src->firstSeen = now;
+	src->lastSeen = now;
+	framer_ctx_init(&src->ctx);
+	if (replaced) {
+		source_rehash();
+	} else {
+		hashIndex[h] = slot + 1;
+	}
+	os_unlock(&sourceLock);
+
+	if (evicted) ESP_LOGI(TAG, "%d idle sender(s) evicted", evicted);
+	char name[24];
+	source_name(src, name);
+	ESP_LOGI(TAG, "New sender %s%s", name, replaced ? ". Table full, replaced the oldest" : "");
+	return src;
+}
+
+void source_report(int64_t now)
+{
+	for (int i=0; i<CONFIG_MAVLINK_SOURCES; i++) {
+		SOURCE_t src;
+		os_lock(&sourceLock);
+		memcpy(&src, &sources[i], sizeof(SOURCE_t));
+		os_unlock(&sourceLock);
+		if (!src.used) continue;
+		char name[24];
+		source_name(&src, name);
+		ESP_LOGI(TAG, "%s datagrams=%u bytes=%u frames=%u skipped=%u bad_crc=%u truncated=%u denied=%u idle=%llds",
+			name, src.datagrams, src.bytes, src.ctx.stats.frames, src.ctx.stats.skipped,
+			src.ctx.stats.badCrc, src.truncated, src.denied, (now - src.lastSeen) / 1000000);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef MAIN_SOURCE_H_
+#define MAIN_SOURCE_H_
+
+#include "framer.h"
+
+// Hash slots for the sender table. Power of two, at least twice CONFIG_MAVLINK_SOURCES.
+#define SOURCE_HASH_SIZE	16
+
+// Idle time after which a sender loses its parser context
+#define SOURCE_IDLE_US		(CONFIG_MAVLINK_SOURCE_IDLE * 1000 * 1000LL)
+
+#define SOURCE_ALLOW_MAX	8
+#define SOURCE_ANY			(-1)
+
+// One sender on CONFIG_UDP_PORT with its own parser context
+typedef struct {
+	bool used;
+	uint32_t addr;		// IPv4 address in network order
+	uint16_t port;		// Host order
+	int64_t firstSeen;
+	int64_t lastSeen;
+	uint32_t datagrams;
+	uint32_t bytes;
+	uint32_t truncated;
+	uint32_t denied;	// Frames from a sysid/compid not in the allow-list
+	FRAMER_CTX_t ctx;
+} SOURCE_t;
+
+void source_init(void);
+SOURCE_t *source_lookup(uint32_t addr, uint16_t port, int64_t now);
+bool source_allowed(uint8_t sysid, uint8_t compid);
+void source_name(const SOURCE_t *src, char *name);
+void source_report(int64_t now);
+
+#endif /* MAIN_SOURCE_H_ */
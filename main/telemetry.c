@@ -0,0 +1,156 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "cmd.h"
+#include "boot.h"
+#include "framer.h"
+#include "dispatch.h"
+#include "telemetry.h"
+#include "vehicle.h"
+#include "evlog.h"
+#include "trace.h"
+
+extern OS_QUEUE_t xQueueCmd;
+
+static const char *TAG = "TELEMETRY";
+
+// VFR_HUD records per second in the event log
+#define TELEMETRY_LOG_LIMIT	5
+
+// Vehicle of the frame being dispatched. Only the receive path uses it.
+static VEHICLE_t *current;
+static int64_t currentTime;
+// Arrival of the datagram being parsed
+static int64_t currentReceived;
+
+// Slots with a notification in xQueueCmd. Fast messages do not flood the queue,
+// because the TFT task reads every slot at once.
+static uint32_t pending = 0;
+
+// Count the update, and tell the TFT task which slot changed if the vehicle is shown.
+// Unselected vehicles never cause a redraw.
+static void updated(uint32_t msgid, int slot)
+{
+	vehicle_count(current, slot, currentTime);
+	if (!vehicle_is_selected(current)) return;
+
+	uint32_t bit = 1 << slot;
+	dispatch_lock();
+	bool queued = (pending & bit) != 0;
+	pending |= bit;
+	dispatch_unlock();
+	if (queued) return;
+
+	CMD_t cmdBuf;
+	cmdBuf.command = CMD_MAVLINK;
+	cmdBuf.msgid = msgid;
+	cmdBuf.time = currentTime;
+	cmdBuf.received = currentReceived;
+	cmdBuf.taskHandle = os_task_current();
+	cmdBuf.queued = os_time_us();
+	if (!os_queue_send(xQueueCmd, &cmdBuf, 0)) {
+		dispatch_lock();
+		pending &= ~bit;
+		dispatch_unlock();
+	}
+}
+
+static void vfr_hud(const FRAME_t *frame, void *state)
+{
+	mavlink_vfr_hud_t *param = &((TELEMETRY_t *)state)->vfrHud;
+	ESP_LOGD(TAG,"VFR_HUD:throttle=%d", param->throttle);
+	EVLOG_LIMIT(EVLOG_VFR_HUD, TELEMETRY_LOG_LIMIT, frame->sysid, evlog_float(param->airspeed), evlog_float(param->groundspeed));
+	EVLOG_LIMIT(EVLOG_VFR_HUD_ALT, TELEMETRY_LOG_LIMIT, param->heading, evlog_float(param->alt), evlog_float(param->climb));
+	updated(frame->msgid, TELEMETRY_VFR_HUD);
+	boot_stage(BOOT_STAGE_FRAME);
+}
+
+static void attitude(const FRAME_t *frame, void *state)
+{
+	mavlink_attitude_t *param = &((TELEMETRY_t *)state)->attitude;
+	ESP_LOGD(TAG,"ATTITUDE:roll=%f pitch=%f yaw=%f", param->roll, param->pitch, param->yaw);
+	updated(frame->msgid, TELEMETRY_ATTITUDE);
+}
+
+static void gps_raw_int(const FRAME_t *frame, void *state)
+{
+	mavlink_gps_raw_int_t *param = &((TELEMETRY_t *)state)->gpsRawInt;
+	ESP_LOGD(TAG,"GPS_RAW_INT:fix_type=%d satellites_visible=%d", param->fix_type, param->satellites_visible);
+	updated(frame->msgid, TELEMETRY_GPS_RAW_INT);
+}
+
+static void sys_status(const FRAME_t *frame, void *state)
+{
+	mavlink_sys_status_t *param = &((TELEMETRY_t *)state)->sysStatus;
+	ESP_LOGD(TAG,"SYS_STATUS:voltage_battery=%d battery_remaining=%d", param->voltage_battery, param->battery_remaining);
+	updated(frame->msgid, TELEMETRY_SYS_STATUS);
+}
+
+#define SLOT(member)	offsetof(TELEMETRY_t, member), sizeof(((TELEMETRY_t *)0)->member)
+
+// Register every slot. Only the messages selected in menuconfig are enabled,
+// the others are skipped by the framer without a CRC or decode.
+void telemetry_init(void)
+{
+	dispatch_register(MAVLINK_MSG_ID_VFR_HUD, MAVLINK_MSG_ID_VFR_HUD_CRC, SLOT(vfrHud), vfr_hud);
+	dispatch_register(MAVLINK_MSG_ID_ATTITUDE, MAVLINK_MSG_ID_ATTITUDE_CRC, SLOT(attitude), attitude);
+	dispatch_register(MAVLINK_MSG_ID_GPS_RAW_INT, MAVLINK_MSG_ID_GPS_RAW_INT_CRC, SLOT(gpsRawInt), gps_raw_int);
+	dispatch_register(MAVLINK_MSG_ID_SYS_STATUS, MAVLINK_MSG_ID_SYS_STATUS_CRC, SLOT(sysStatus), sys_status);
+
+	dispatch_enable(MAVLINK_MSG_ID_VFR_HUD, true);
+#if CONFIG_TELEMETRY_ATTITUDE
+	dispatch_enable(MAVLINK_MSG_ID_ATTITUDE, true);
+#endif
+#if CONFIG_TELEMETRY_GPS
+	dispatch_enable(MAVLINK_MSG_ID_GPS_RAW_INT, true);
+#endif
+#if CONFIG_TELEMETRY_BATTERY
+	dispatch_enable(MAVLINK_MSG_ID_SYS_STATUS, true);
+#endif
+}
+
+// Called by the receive path at the start of every datagram
+void telemetry_received(int64_t now)
+{
+	currentReceived = now;
+}
+
+// Called by the receive path for every wanted frame.
+// The payload is decoded into the slot of the sending vehicle.
+void telemetry_frame(const FRAME_t *frame)
+{
+	TRACE(TRACE_DECODE_BEGIN, frame->sysid, frame->msgid);
+	currentTime = os_time_us();
+	current = vehicle_lookup(frame->sysid, currentTime);
+	if (current != NULL) dispatch_frame(frame, &current->state);
+	TRACE(TRACE_DECODE_END, frame->sysid, frame->msgid);
+}
+
+// Consistent copy of the selected vehicle's slots for drawing.
+// Pending notifications are satisfied by it.
+bool telemetry_get(TELEMETRY_t *out)
+{
+	bool found = false;
+	dispatch_lock();
+	VEHICLE_t *v = NULL;
+	uint8_t sysid = vehicle_selected();
+	if (sysid != VEHICLE_NONE) v = vehicle_find(sysid);
+	if (v != NULL) {
+		memcpy(out, &v->state, sizeof(TELEMETRY_t));
+		found = true;
+	}
+	pending = 0;
+	dispatch_unlock();
+	return found;
+}
@@ -0,0 +1,28 @@
+#ifndef MAIN_TELEMETRY_H_
+#define MAIN_TELEMETRY_H_
+
+#include <ardupilotmega/mavlink.h>
+
+#include "framer.h"
+
+// Slot numbers
+#define TELEMETRY_VFR_HUD		0
+#define TELEMETRY_ATTITUDE		1
+#define TELEMETRY_GPS_RAW_INT	2
+#define TELEMETRY_SYS_STATUS	3
+#define TELEMETRY_SLOTS			4
+
+// Typed state slots of one vehicle. Each registered message decodes straight into its slot.
+typedef struct {
+	mavlink_vfr_hud_t vfrHud;
+	mavlink_attitude_t attitude;
+	mavlink_gps_raw_int_t gpsRawInt;
+	mavlink_sys_status_t sysStatus;	// Battery voltage, current and remaining
+} TELEMETRY_t;
+
+void telemetry_init(void);
+void telemetry_received(int64_t now);
+void telemetry_frame(const FRAME_t *frame);
+bool telemetry_get(TELEMETRY_t *out);
+
+#endif /* MAIN_TELEMETRY_H_ */
@@ -0,0 +1,217 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "os.h"
+#include "boot.h"
+#include "trace.h"
+
+#if CONFIG_TRACE
+static const char *TAG = "TRACE";
+
+_Static_assert((TRACE_RING & (TRACE_RING - 1)) == 0, "CONFIG_TRACE_RING must be a power of two");
+
+#define TRACE_CORES			2
+#define TRACE_POLL_MS		100		// The TRACE task looks for a latency trigger this often
+#define TRACE_SEND_GAP_MS	1		// Between two datagrams of a dump, so lwIP keeps up
+
+// Writers claim a slot by moving head and overwrite the oldest record.
+// A dump stops the writers first, so the ring holds still while it goes out.
+// head is free running and wraps through the unsigned range.
+static TRACE_RECORD_t ring[TRACE_RING];
+static uint32_t head = 0;
+static bool recording = true;
+static bool triggered = false;
+static uint32_t lastSync[TRACE_CORES];
+static uint32_t syncCycles = 0;
+
+// Tasks in the order of their first record. Only ever added to.
+static void *taskHandles[TRACE_TASKS];
+static char taskNames[TRACE_TASKS][TRACE_NAME] = { [TRACE_OTHER_TASK] = "other" };
+static int taskCount = 0;
+static OS_LOCK_t taskLock = OS_LOCK_INITIALIZER;
+
+static uint8_t task_index(void)
+{
+	void *handle = os_task_current();
+	int count = __atomic_load_n(&taskCount, __ATOMIC_ACQUIRE);
+	for (int i=0; i<count; i++) {
+		if (taskHandles[i] == handle) return i;
+	}
+
+	// First record of this task
+	const char *name = os_task_name();
+	os_lock(&taskLock);
+	int i;
+	for (i=0; i<taskCount; i++) {
+		if (taskHandles[i] == handle) break;
+	}
+	if (i == taskCount && i < TRACE_OTHER_TASK) {
+		taskHandles[i] = handle;
+		strncpy(taskNames[i], name, TRACE_NAME - 1);
+		__atomic_store_n(&taskCount, i + 1, __ATOMIC_RELEASE);
+	}
+	os_unlock(&taskLock);
+	return (i < TRACE_OTHER_TASK) ? i : TRACE_OTHER_TASK;
+}
+
+static inline void put(uint32_t cycles, uint8_t event, uint8_t task, uint16_t small, uint32_t arg)
+{
+	uint32_t pos = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	TRACE_RECORD_t *r = &ring[pos & (TRACE_RING - 1)];
+	r->cycles = cycles;
+	r->event = event;
+	r->task = task;
+	r->small = small;
+	r->arg = arg;
+}
+
+// Any task. Never waits. The first record of a core after TRACE_SYNC_US
+// is preceded by a TRACE_SYNC, which ties its cycles to the esp_timer time.
+void trace_put(uint8_t event, uint16_t small, uint32_t arg)
+{
+	if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) return;
+	if (syncCycles == 0) syncCycles = TRACE_SYNC_US * os_cycles_per_us();
+	uint8_t task = task_index();
+	int core = os_core();
+	if (core) task |= TRACE_CORE_BIT;
+	uint32_t cycles = os_cycles();
+	if (cycles - lastSync[core] >= syncCycles) {
+		lastSync[core] = cycles;
+		put(cycles, TRACE_SYNC, task, 0, (uint32_t)os_time_us());
+	}
+	put(cycles, event, task, small, arg);
+}
+
+// Called by the TFT task with every telemetry-to-photon latency.
+// A slow one stops the ring at once, so it ends with the slow update.
+void trace_latency(uint32_t us)
+{
+#if CONFIG_TRACE_TRIGGER_US > 0
+	static int64_t lastTrigger = 0;
+	if (us < CONFIG_TRACE_TRIGGER_US) return;
+	if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) return;
+	int64_t now = os_time_us();
+	if (lastTrigger != 0 && now - lastTrigger < TRACE_HOLDOFF_US) return;
+	lastTrigger = now;
+	trace_put(TRACE_TRIGGER, 0, us);
+	__atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&triggered, true, __ATOMIC_RELEASE);
+#endif
+}
+
+// A dump goes out in pieces: datagrams to a requester, or hex lines to the log when fd < 0
+typedef struct {
+	int fd;
+	uint32_t addr;
+	uint16_t port;
+	uint32_t offset;
+	int length;
+	int limit;
+	uint8_t buffer[4 + TRACE_CHUNK];
+} DUMP_t;
+
+static void dump_flush(DUMP_t *d)
+{
+	if (d->length == 0) return;
+	if (d->fd >= 0) {
+		for (int i=0; i<4; i++) d->buffer[i] = d->offset >> (i * 8);
+		if (os_udp_send(d->fd, d->addr, d->port, d->buffer, 4 + d->length) < 0) {
+			ESP_LOGW(TAG, "os_udp_send offset=%u failed", d->offset);
+		}
+		os_delay_ms(TRACE_SEND_GAP_MS);
+	} else {
+		char line[TRACE_HEX_BYTES * 2 + 1];
+		for (int i=0; i<d->length; i++) sprintf(&line[i*2], "%02x", d->buffer[4 + i]);
+		ESP_LOGI(TAG, "#%u:%s", d->offset, line);
+	}
+	d->offset += d->length;
+	d->length = 0;
+}
+
+static void dump_put(DUMP_t *d, const void *data, int length)
+{
+	const uint8_t *p = data;
+	while (length > 0) {
+		int n = d->limit - d->length;
+		if (n > length) n = length;
+		memcpy(&d->buffer[4 + d->length], p, n);
+		d->length += n;
+		p += n;
+		length -= n;
+		if (d->length == d->limit) dump_flush(d);
+	}
+}
+
+static void dump(DUMP_t *d)
+{
+	__atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+	// A writer that saw recording before finishes its record within a tick
+	os_delay_ms(1);
+	uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	uint32_t count = (end < TRACE_RING) ? end : TRACE_RING;
+
+	d->offset = 0;
+	d->length = 0;
+	d->limit = (d->fd >= 0) ? TRACE_CHUNK : TRACE_HEX_BYTES;
+	TRACE_HEADER_t header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.tasks = TRACE_TASKS,
+		.records = count,
+		.cyclesPerUs = os_cycles_per_us(),
+	};
+	dump_put(d, &header, sizeof(header));
+	dump_put(d, taskNames, sizeof(taskNames));
+	uint32_t first = (end - count) & (TRACE_RING - 1);
+	uint32_t tail = TRACE_RING - first;
+	if (tail > count) tail = count;
+	dump_put(d, &ring[first], tail * sizeof(TRACE_RECORD_t));
+	dump_put(d, &ring[0], (count - tail) * sizeof(TRACE_RECORD_t));
+	dump_flush(d);
+
+	// A trigger while this dump was waiting is in it
+	__atomic_store_n(&triggered, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&recording, true, __ATOMIC_RELEASE);
+	ESP_LOGI(TAG, "Dump of %u records, %u bytes", count, d->offset);
+}
+
+// TRACE task. Any datagram on CONFIG_TRACE_PORT asks for the ring, which goes
+// back to its sender. A latency trigger logs it as hex instead.
+void trace(void *pvParameters)
+{
+	ESP_LOGI(TAG, "Start. ring=%d records port=%d trigger=%dus", TRACE_RING, CONFIG_TRACE_PORT, CONFIG_TRACE_TRIGGER_US);
+	static DUMP_t d;
+	int fd = -1;
+	while (1) {
+		if (fd < 0 && boot_done(BOOT_STAGE_IP)) {
+			fd = os_udp_open(CONFIG_TRACE_PORT, TRACE_POLL_MS);
+		}
+		if (fd < 0) {
+			os_delay_ms(TRACE_POLL_MS);
+		} else {
+			uint8_t request[16];
+			int ret = os_udp_receive(fd, request, sizeof(request), &d.addr, &d.port);
+			if (ret >= 0) {
+				d.fd = fd;
+				dump(&d);
+			}
+		}
+
+		if (__atomic_exchange_n(&triggered, false, __ATOMIC_ACQ_REL)) {
+			ESP_LOGW(TAG, "Latency over %dus. Ring as hex for host/trace_json", CONFIG_TRACE_TRIGGER_US);
+			d.fd = -1;
+			dump(&d);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Trace points.
+// Waits in the OS layer, queue sends, datagrams, frame decodes, lcdDraw calls and
+// SPI transactions write 12 byte records stamped with the cycle counter into one
+// ring that always holds the latest CONFIG_TRACE_RING records. The TRACE task sends
+// the ring to whoever asks on CONFIG_TRACE_PORT, or logs it as hex when a
+// telemetry-to-photon latency is over CONFIG_TRACE_TRIGGER_US.
+// host/trace_json turns either into Chrome trace JSON.
+
+#define TRACE_RING			CONFIG_TRACE_RING	// Records. Power of two.
+#define TRACE_TASKS			16					// Tasks with their own track. The rest share one.
+#define TRACE_NAME			16					// Task name bytes in a dump
+#define TRACE_SYNC_US		10000				// A core stamps the esp_timer time at least this often
+#define TRACE_CHUNK			1024				// Dump bytes per datagram
+#define TRACE_HEX_BYTES		64					// Dump bytes per line of the hex output
+#define TRACE_HOLDOFF_US	(30 * 1000 * 1000)	// Latency triggers at most this often
+#define TRACE_MAGIC			0x31435254			// "TRC1"
+#define TRACE_VERSION		1
+
+typedef enum {
+	TRACE_SYNC = 0,			// arg=os_time_us() low 32 bits at the record's cycles
+	TRACE_WAIT_BEGIN,		// small=TRACE_WAIT_t arg=wait ms
+	TRACE_WAIT_END,			// small=TRACE_WAIT_t arg=1 when the wait got what it waited for
+	TRACE_QUEUE_SEND,		// small=1 when sent arg=items waiting after it
+	TRACE_DATAGRAM_BEGIN,	// arg=bytes
+	TRACE_DATAGRAM_END,		// arg=frames with a good CRC
+	TRACE_DECODE_BEGIN,		// small=sysid arg=msgid
+	TRACE_DECODE_END,		// small=sysid arg=msgid
+	TRACE_DRAW_BEGIN,		// small=SPI_PRIM_t of the outermost lcdDraw call
+	TRACE_DRAW_END,			// small=SPI_PRIM_t
+	TRACE_SPI_BEGIN,		// small=DC level arg=bytes
+	TRACE_SPI_END,			// small=DC level arg=bytes
+	TRACE_TRIGGER,			// arg=latency us that stopped the ring
+	TRACE_EVENTS,
+} TRACE_EVENT_t;
+
+typedef enum {
+	TRACE_WAIT_DELAY = 0,
+	TRACE_WAIT_QUEUE_SEND,
+	TRACE_WAIT_QUEUE_RECEIVE,
+	TRACE_WAIT_EVENT,
+	TRACE_WAIT_UDP,
+	TRACE_WAITS,
+} TRACE_WAIT_t;
+
+// 12 bytes. Cycles count on the core in bit 7 of task, and are only
+// comparable with the TRACE_SYNC records of the same core.
+typedef struct {
+	uint32_t cycles;
+	uint8_t event;
+	uint8_t task;		// Index into the task names of the dump, core in bit 7
+	uint16_t small;
+	uint32_t arg;
+} TRACE_RECORD_t;
+
+_Static_assert(sizeof(TRACE_RECORD_t) == 12, "TRACE_RECORD_t must stay 12 bytes");
+
+#define TRACE_CORE_BIT		0x80
+#define TRACE_OTHER_TASK	(TRACE_TASKS - 1)
+
+// A dump is this header, tasks names of TRACE_NAME bytes and the records oldest first.
+// Over UDP every datagram starts with the 32 bit offset of its bytes in the dump.
+// Little endian like the ESP32.
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t tasks;
+	uint32_t records;
+	uint32_t cyclesPerUs;
+} TRACE_HEADER_t;
+
+_Static_assert(sizeof(TRACE_HEADER_t) == 16, "TRACE_HEADER_t must stay 16 bytes");
+
+#if CONFIG_TRACE
+#define TRACE(event, small, arg)	trace_put(event, small, arg)
+#else
+#define TRACE(event, small, arg)	do {} while (0)
+#endif
+
+void trace_put(uint8_t event, uint16_t small, uint32_t arg);
+void trace_latency(uint32_t us);
+void trace(void *pvParameters);
+
+#endif /* MAIN_TRACE_H_ */
@@ -7,88 +7,59 @@
 */
 #include <stdio.h>
 #include <string.h>
+#include <assert.h>
+#include <inttypes.h>
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
-
-#include "esp_err.h"
 #include "esp_log.h"
-#include "esp_system.h"
 
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include "lwip/netdb.h"
+#if CONFIG_UDP_BENCHMARK || CONFIG_UDP_BACKEND_RAW
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+#if CONFIG_UDP_BACKEND_RAW
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#endif
+#if CONFIG_UDP_BACKEND_REPLAY
+#include "esp_partition.h"
+#endif
 
 #include <ardupilotmega/mavlink.h>
 
-#include "cmd.h"
-
-extern QueueHandle_t xQueueCmd;
+#include "os.h"
+#include "boot.h"
+#include "framer.h"
+#include "dispatch.h"
+#include "telemetry.h"
+#include "source.h"
+#include "vehicle.h"
+#include "health.h"
+#include "gcs.h"
+#include "recorder.h"
+#include "replay.h"
+#include "trace.h"
+#include "udp_receiver.h"
 
 static const char *TAG = "UDP";
 
 //#define CONFIG_BAD_CRC	0
 //#define CONFIG_UDP_PORT	14550
 
-// Bradcast Receive Task
-void receiver(void *pvParameters)
-{
-	ESP_LOGI(TAG, "Start. Wait for %d port", CONFIG_UDP_PORT);
-
-	/* set up address to recvfrom */
-	struct sockaddr_in addr;
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(CONFIG_UDP_PORT);
-	addr.sin_addr.s_addr = htonl(INADDR_ANY); /* senderInfo message from ANY */
-
-	/* create the socket */
-	int fd;
-	int ret;
-	fd = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP ); // Create a UDP socket.
-	LWIP_ASSERT("fd >= 0", fd >= 0);
-
-#if 0
-	/* set option */
-	int broadcast=1;
-	ret = lwip_setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof broadcast);
-	LWIP_ASSERT("ret >= 0", ret >= 0);
-#endif
-
-	/* bind socket */
-	ret = lwip_bind(fd, (struct sockaddr *)&addr, sizeof(addr));
-	LWIP_ASSERT("ret >= 0", ret >= 0);
+// Receive statistics
+UDP_STATS_t udpStats;
 
-	/* senderInfo data */
-	char buffer[128];
-	struct sockaddr_in senderInfo;
-	//socklen_t senderInfoLen = sizeof(senderInfo);
-	CMD_t cmdBuf;
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
+// Wanted message IDs. Each sender has its own parser context in source.c.
+// Only the receive path parses. That is the UDP task for the socket backend
+// and the tcpip task for the raw backend.
+static FRAMER_t framer;
 
-	mavlink_message_t _rxmsg;
-	mavlink_status_t  _rxstatus;
-	mavlink_message_t _message;
-	mavlink_status_t  _mav_status;
-	bzero(&_rxstatus, sizeof(mavlink_status_t));
+#if CONFIG_UDP_BACKEND_SOCKET
+// Datagram buffer. One byte larger than the largest payload to detect oversized datagrams.
+static uint8_t buffer[UDP_BUFFER_SIZE+1];
 
-	while(1) {
-		socklen_t senderInfoLen = sizeof(senderInfo);
-		memset(buffer, 0, sizeof(buffer));
-		ret = lwip_recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&senderInfo, &senderInfoLen);
-		LWIP_ASSERT("ret > 0", ret > 0);
-		ESP_LOGD(TAG,"lwip_recv ret=%d",ret);
-		if (ret == 0) continue;
-
-		buffer[ret] = 0;
-		//ESP_LOGI(TAG,"lwip_recv buffer=%s",buffer);
-		ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, ret, ESP_LOG_DEBUG);
-#if 0
-		char senderstr[16];
-		inet_ntop(AF_INET, &senderInfo.sin_addr, senderstr, sizeof(senderstr));
-		ESP_LOGD(TAG,"recvfrom : %s, port=%d", senderstr, ntohs(senderInfo.sin_port));
+// Bound socket. Requests to the autopilot leave from the port it sends to.
+static int fd = -1;
 #endif
 
 #if 0
@@ -108,44 +79,390 @@ typedef struct __mavlink_message {
 }) mavlink_message_t;
 #endif
 
-		for (int index=0; index<ret; index++) {
-			uint8_t result = buffer[index];
-			uint8_t msgReceived = mavlink_frame_char_buffer(&_rxmsg, &_rxstatus, result, &_message, &_mav_status);
-			ESP_LOGD(TAG,"msgReceived=%d", msgReceived);
-			if (msgReceived == 1) {
-				ESP_LOGD(TAG,"_message.msgid=%d _message.compid=%d", _message.msgid, _message.compid);
-
-				if (_message.compid != 1) {
-					ESP_LOGD(TAG,"sysid=%d compid=%d seq=%d msgid=%d",_message.sysid, _message.compid, _message.seq, _message.msgid);
-					continue;
-				}
-
-				if (_message.msgid ==  MAVLINK_MSG_ID_VFR_HUD) {
-					mavlink_vfr_hud_t param;
-					mavlink_msg_vfr_hud_decode(&_message, &param);
-					ESP_LOGI(TAG,"VFR_HUD:airspeed=%f groundspeed=%f alt=%f", param.airspeed, param.groundspeed, param.alt);
-					ESP_LOGI(TAG,"VFR_HUD:climb=%f heading=%d throttle=%d", param.climb, param.heading, param.throttle);
-					cmdBuf.command = CMD_MAVLINK;
-					cmdBuf.airspeed = param.airspeed;
-					cmdBuf.groundspeed = param.groundspeed;
-					cmdBuf.alt = param.alt;
-					cmdBuf.climb = param.climb;
-					cmdBuf.heading = param.heading;
-					cmdBuf.throttle = param.throttle;
-					xQueueSend(xQueueCmd, &cmdBuf, 0);
-				}
-
-			} else if (msgReceived == 2) {
+static void on_frame(const FRAME_t *frame, void *arg)
+{
+	SOURCE_t *src = arg;
+	ESP_LOGD(TAG,"msgid=%d sysid=%d compid=%d seq=%d", frame->msgid, frame->sysid, frame->compid, frame->seq);
+	if (!source_allowed(frame->sysid, frame->compid)) {
+		src->denied++;
+		return;
+	}
+#if CONFIG_MAVLINK_REQUEST_RATES
+	if (gcs_frame(src->addr, src->port, frame, vehicle_selected())) return;
+#endif
+	telemetry_frame(frame);
+}
+
+// Every frame with a good CRC and every skipped frame
+static void on_header(const FRAME_t *frame, void *arg)
+{
+	health_frame(frame, arg);
+#if CONFIG_MAVLINK_STOP_UNUSED
+	// The ground station also learns which messages the autopilot sends
+	gcs_header(frame);
+#endif
+#if CONFIG_RECORDER
+	recorder_frame(frame, arg);
+#endif
+}
+
+// Wanted frames that failed the CRC. They are not recorded: the framer scans
+// their bytes again, and a frame found in them is recorded by on_header.
+static void on_bad_crc(const FRAME_t *frame, void *arg)
+{
+	health_bad_crc(frame, arg);
+}
+
+// Framer counters of the sender at the start of the current datagram
+static FRAMER_STATS_t statsBefore;
+
+static SOURCE_t *datagram_begin(uint32_t addr, uint16_t port, int length)
+{
+	TRACE(TRACE_DATAGRAM_BEGIN, 0, length);
+	int64_t now = os_time_us();
+	SOURCE_t *src = source_lookup(addr, port, now);
+	health_time(now);
+	telemetry_received(now);
+	statsBefore = src->ctx.stats;
+	return src;
+}
+
+// Feed one contiguous piece of a datagram to the sender's parser context.
+// The context carries a partial frame over, so a frame may span pbufs.
+static void parse_chunk(SOURCE_t *src, const uint8_t *data, int length)
+{
 #if CONFIG_BAD_CRC
-				ESP_LOGW(TAG,"BAD CRC");
-				ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, ret, ESP_LOG_WARN);
+	uint32_t badCrc = src->ctx.stats.badCrc;
 #endif
-			}
+	framer_scan(&framer, &src->ctx, data, length, on_frame, src);
+#if CONFIG_BAD_CRC
+	if (src->ctx.stats.badCrc != badCrc) {
+		ESP_LOGW(TAG,"BAD CRC");
+		ESP_LOG_BUFFER_HEXDUMP(TAG, data, length, ESP_LOG_WARN);
+	}
+#endif
+}
+
+static void datagram_done(SOURCE_t *src, int length)
+{
+	src->datagrams++;
+	src->bytes += length;
+	udpStats.datagrams++;
+	udpStats.bytes += length;
+	udpStats.frames += src->ctx.stats.frames - statsBefore.frames;
+	udpStats.skipped += src->ctx.stats.skipped - statsBefore.skipped;
+	udpStats.badCrc += src->ctx.stats.badCrc - statsBefore.badCrc;
+	// PX4 sends whole frames. A datagram ending inside a frame was cut short.
+	if (framer_end(&src->ctx)) {
+		src->truncated++;
+		udpStats.truncated++;
+	}
+	TRACE(TRACE_DATAGRAM_END, 0, src->ctx.stats.frames - statsBefore.frames);
+}
+
+// Parse every MAVLink frame in one datagram from addr:port
+void receiver_parse(uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	SOURCE_t *src = datagram_begin(addr, port, length);
+	parse_chunk(src, data, length);
+	datagram_done(src, length);
+}
+
+#if CONFIG_UDP_BENCHMARK
+// Receive path CPU time. The tcpip task moves every datagram from WiFi to the
+// backend and the UDP task parses it (socket) or idles (raw), so both count.
+static const char *benchTasks[] = { "tiT", "UDP" };
+
+static uint32_t receiver_cpu(void)
+{
+	static TaskStatus_t status[32];
+	uint32_t total = 0;
+	UBaseType_t count = uxTaskGetSystemState(status, sizeof(status)/sizeof(status[0]), NULL);
+	for (int i=0; i<count; i++) {
+		for (int j=0; j<sizeof(benchTasks)/sizeof(benchTasks[0]); j++) {
+			if (strcmp(status[i].pcTaskName, benchTasks[j]) == 0) total += status[i].ulRunTimeCounter;
 		}
 	}
+	return total;
+}
+
+// Messages per second and CPU microseconds per message since the last report
+static void receiver_benchmark(int64_t elapsed)
+{
+	static uint32_t lastFrames = 0;
+	static uint32_t lastCpu = 0;
+	uint32_t cpu = receiver_cpu();
+	// Every message on the link costs receive time, used or not
+	uint32_t total = udpStats.frames + udpStats.skipped;
+	uint32_t frames = total - lastFrames;
+	uint32_t busy = cpu - lastCpu;
+	lastFrames = total;
+	lastCpu = cpu;
+	if (frames == 0) return;
+	ESP_LOGI(TAG, "benchmark backend=%s msgs/s=%"PRIu32" cpu/msg=%"PRIu32"us load=%"PRIu32"%%",
+		UDP_BACKEND_NAME, (uint32_t)((uint64_t)frames * 1000000 / elapsed), busy / frames,
+		(uint32_t)((uint64_t)busy * 100 / elapsed));
+}
+#endif
+
+static void receiver_stats(void)
+{
+	static int64_t lastReport = 0;
+	int64_t now = os_time_us();
+	if (now - lastReport < UDP_STATS_INTERVAL) return;
+#if CONFIG_UDP_BENCHMARK
+	if (lastReport != 0) receiver_benchmark(now - lastReport);
+#endif
+	lastReport = now;
+	ESP_LOGI(TAG, "datagrams=%u bytes=%u frames=%u skipped=%u bad_crc=%u truncated=%u oversized=%u",
+		udpStats.datagrams, udpStats.bytes, udpStats.frames, udpStats.skipped, udpStats.badCrc, udpStats.truncated, udpStats.oversized);
+	source_report(now);
+	vehicle_report(now);
+	health_report(now);
+#if CONFIG_MAVLINK_REQUEST_RATES
+	gcs_report();
+#endif
+#if CONFIG_RECORDER
+	recorder_report();
+#endif
+}
 
-	/* close socket. Don't reach here. */
-	ret = lwip_close(fd);
-	LWIP_ASSERT("ret == 0", ret == 0);
-	vTaskDelete( NULL );
+#if CONFIG_MAVLINK_REQUEST_RATES
+// HEARTBEAT and rate requests. Runs in the UDP task for both backends.
+static void receiver_poll(void)
+{
+	static int64_t lastPoll = 0;
+	int64_t now = os_time_us();
+	if (now - lastPoll < GCS_POLL_MS * 1000) return;
+	lastPoll = now;
+	gcs_poll(now);
+}
+#endif
+
+#if CONFIG_UDP_BACKEND_RAW
+// Runs in the tcpip task. The pbuf chain is parsed where lwIP stored it and freed here,
+// so there is no socket mailbox, no copy and no switch to the UDP task.
+static void raw_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+	SOURCE_t *src = datagram_begin(ip4_addr_get_u32(ip_2_ip4(addr)), port, p->tot_len);
+	for (struct pbuf *q = p; q != NULL; q = q->next) {
+		parse_chunk(src, q->payload, q->len);
+	}
+	datagram_done(src, p->tot_len);
+	pbuf_free(p);
+}
+
+static struct udp_pcb *pcb;
+
+#if CONFIG_MAVLINK_REQUEST_RATES
+typedef struct {
+	struct pbuf *p;
+	ip_addr_t addr;
+	u16_t port;
+	err_t err;
+	TaskHandle_t task;
+} RAW_SEND_t;
+
+static void raw_sendto(void *arg)
+{
+	RAW_SEND_t *send = arg;
+	send->err = udp_sendto(pcb, send->p, &send->addr, send->port);
+	pbuf_free(send->p);
+	xTaskNotifyGive(send->task);
+}
+
+// Called by the UDP task. The datagram is handed to the tcpip task and sent from the bound pcb.
+static int raw_send(uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	static RAW_SEND_t send;
+	send.p = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+	if (send.p == NULL) return -1;
+	memcpy(send.p->payload, data, length);
+	ip_addr_set_ip4_u32(&send.addr, addr);
+	send.port = port;
+	send.task = xTaskGetCurrentTaskHandle();
+	if (tcpip_callback(raw_sendto, &send) != ERR_OK) {
+		pbuf_free(send.p);
+		return -1;
+	}
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	return (send.err == ERR_OK) ? length : -1;
+}
+#endif
+
+// Raw API calls must be made from the tcpip task
+static void raw_bind(void *arg)
+{
+	pcb = udp_new();
+	LWIP_ASSERT("pcb != NULL", pcb != NULL);
+	err_t err = udp_bind(pcb, IP_ADDR_ANY, CONFIG_UDP_PORT);
+	LWIP_ASSERT("err == ERR_OK", err == ERR_OK);
+	udp_recv(pcb, raw_recv, NULL);
+	xTaskNotifyGive((TaskHandle_t)arg);
+}
+#elif CONFIG_UDP_BACKEND_REPLAY
+// Frames of the tlog partition arrive as datagrams from this sender
+#define REPLAY_ADDR		0x0100007F	// 127.0.0.1 in network order
+#define REPLAY_PORT		0
+// At full speed the UDP task gives the idle task of its core a tick this often
+#define REPLAY_YIELD_US		(100 * 1000)
+// Shorter waits are left to the next frame. One tick of the 100 Hz scheduler.
+#define REPLAY_SLEEP_US		(10 * 1000)
+
+static REPLAY_t replay;
+static uint8_t buffer[UDP_BUFFER_SIZE];
+static uint8_t frame[FRAMER_MAX_FRAME];
+
+static bool partition_read(void *ctx, uint32_t offset, void *out, uint32_t length)
+{
+	return esp_partition_read(ctx, offset, out, length) == ESP_OK;
+}
+
+// Feed the newest recording through receiver_parse() like live datagrams.
+// Frames that are due together are parsed as one datagram.
+static void replay_receive(void)
+{
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, RECORDER_SUBTYPE, RECORDER_LABEL);
+	if (partition == NULL || !replay_open(&replay, partition_read, (void *)partition, partition->size)) {
+		ESP_LOGE(TAG, "Nothing to replay in the %s partition", RECORDER_LABEL);
+		return;
+	}
+	replay.speed = CONFIG_REPLAY_SPEED;
+	replay_seek(&replay, (uint64_t)CONFIG_REPLAY_START * 1000000);
+
+	int length = 0;
+	uint32_t frames = 0;
+	int64_t start = os_time_us();
+	int64_t lastYield = start;
+	int64_t slept = 0;
+	while(1) {
+		uint64_t stamp;
+		int n = replay_next(&replay, frame, &stamp);
+		int64_t now = os_time_us();
+		int64_t wait = (n > 0) ? replay_wait(&replay, stamp, now) : 0;
+		if (length > 0 && (n == 0 || wait > 0 || length + n > UDP_BUFFER_SIZE)) {
+			receiver_parse(REPLAY_ADDR, REPLAY_PORT, buffer, length);
+			length = 0;
+		}
+
+		if (n == 0) {
+			// Throughput over the time spent parsing, without the pacing delays
+			int64_t busy = os_time_us() - start - slept;
+			ESP_LOGI(TAG, "replay done frames=%u busy=%lldms frames/s=%u", frames, busy / 1000,
+				(uint32_t)((uint64_t)frames * 1000000 / (busy ? busy : 1)));
+			receiver_stats();
+#if CONFIG_REPLAY_LOOP
+			replay_seek(&replay, (uint64_t)CONFIG_REPLAY_START * 1000000);
+			frames = 0;
+			slept = 0;
+			start = os_time_us();
+			continue;
+#else
+			return;
+#endif
+		}
+
+		if (wait >= REPLAY_SLEEP_US || now - lastYield >= REPLAY_YIELD_US) {
+			os_delay_ms(wait >= REPLAY_SLEEP_US ? wait / 1000 : 1);
+			lastYield = os_time_us();
+			slept += lastYield - now;
+		}
+		memcpy(&buffer[length], frame, n);
+		length += n;
+		frames++;
+		receiver_stats();
+	}
+}
+#elif CONFIG_MAVLINK_REQUEST_RATES
+// Called by the UDP task, which also receives on fd
+static int socket_send(uint32_t addr, uint16_t port, const uint8_t *data, int length)
+{
+	return os_udp_send(fd, addr, port, data, length);
+}
+#endif
+
+// Bradcast Receive Task
+void receiver(void *pvParameters)
+{
+#if CONFIG_UDP_BACKEND_REPLAY
+	// Replay does not need the network. Start when the screen can show the first frame.
+	boot_wait(BOOT_STAGE_DISPLAY, OS_WAIT_FOREVER);
+	ESP_LOGI(TAG, "Start. backend=%s speed=%d%%", UDP_BACKEND_NAME, CONFIG_REPLAY_SPEED);
+#else
+	// The socket layer is ready once WiFi has an address
+	boot_wait(BOOT_STAGE_IP, OS_WAIT_FOREVER);
+	ESP_LOGI(TAG, "Start. Wait for %d port backend=%s", CONFIG_UDP_PORT, UDP_BACKEND_NAME);
+#endif
+
+	framer_init(&framer);
+	framer.header = on_header;
+	framer.badCrc = on_bad_crc;
+	source_init();
+	dispatch_init(&framer);
+	telemetry_init();
+	dispatch_report();
+#if CONFIG_MAVLINK_REQUEST_RATES && CONFIG_UDP_BACKEND_RAW
+	gcs_init(&framer, raw_send);
+#elif CONFIG_MAVLINK_REQUEST_RATES
+	gcs_init(&framer, socket_send);
+#endif
+
+#if CONFIG_UDP_BACKEND_RAW
+	tcpip_callback(raw_bind, xTaskGetCurrentTaskHandle());
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+	// Datagrams are handled in the tcpip task. Only send and report here.
+	while(1) {
+#if CONFIG_MAVLINK_REQUEST_RATES
+		os_delay_ms(GCS_POLL_MS);
+		receiver_poll();
+#else
+		os_delay_ms(UDP_STATS_INTERVAL / 1000);
+#endif
+		receiver_stats();
+	}
+#elif CONFIG_UDP_BACKEND_REPLAY
+	replay_receive();
+	while(1) {
+		os_delay_ms(UDP_STATS_INTERVAL / 1000);
+		receiver_stats();
+	}
+#else
+#if CONFIG_MAVLINK_REQUEST_RATES
+	// Wake up for the HEARTBEAT while nothing arrives
+	fd = os_udp_open(CONFIG_UDP_PORT, GCS_POLL_MS);
+#else
+	fd = os_udp_open(CONFIG_UDP_PORT, 0);
+#endif
+	assert(fd >= 0);
+
+	while(1) {
+		uint32_t addr;
+		uint16_t port;
+		int ret = os_udp_receive(fd, buffer, sizeof(buffer), &addr, &port);
+		ESP_LOGD(TAG,"os_udp_receive ret=%d",ret);
+#if CONFIG_MAVLINK_REQUEST_RATES
+		receiver_poll();
+#endif
+		if (ret == OS_UDP_TIMEOUT) {
+			receiver_stats();
+			continue;
+		}
+		if (ret < 0) {
+			os_delay_ms(10);
+			continue;
+		}
+		if (ret == 0) continue;
+
+		// The socket silently drops the part that does not fit
+		if (ret > UDP_BUFFER_SIZE) {
+			udpStats.oversized++;
+			ret = UDP_BUFFER_SIZE;
+		}
+		ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, ret, ESP_LOG_DEBUG);
+
+		receiver_parse(addr, port, buffer, ret);
+		receiver_stats();
+	}
+#endif
 }
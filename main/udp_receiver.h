@@ -0,0 +1,33 @@
+#ifndef MAIN_UDP_RECEIVER_H_
+#define MAIN_UDP_RECEIVER_H_
+
+// Largest UDP payload in one 1500 byte WiFi frame (1500 - 20 IP - 8 UDP)
+#define UDP_BUFFER_SIZE		1472
+
+// Interval of the receive statistics log
+#define UDP_STATS_INTERVAL	(10*1000*1000)
+
+#if CONFIG_UDP_BACKEND_RAW
+#define UDP_BACKEND_NAME	"raw"
+#elif CONFIG_UDP_BACKEND_REPLAY
+#define UDP_BACKEND_NAME	"replay"
+#else
+#define UDP_BACKEND_NAME	"socket"
+#endif
+
+typedef struct {
+	uint32_t datagrams;
+	uint32_t bytes;
+	uint32_t frames;	// Wanted frames
+	uint32_t skipped;	// Frames of message IDs nobody uses
+	uint32_t badCrc;
+	uint32_t truncated;	// Datagram ended in the middle of a frame
+	uint32_t oversized;	// Datagram larger than UDP_BUFFER_SIZE (socket backend only)
+} UDP_STATS_t;
+
+extern UDP_STATS_t udpStats;
+
+void receiver_parse(uint32_t addr, uint16_t port, const uint8_t *data, int length);
+void receiver(void *pvParameters);
+
+#endif /* MAIN_UDP_RECEIVER_H_ */
@@ -0,0 +1,146 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "dispatch.h"
+#include "vehicle.h"
+
+static const char *TAG = "VEHICLE";
+
+//#define CONFIG_MAVLINK_VEHICLES	4
+
+// Vehicles and a sysid to vehicle map (0 = none, n = vehicles[n-1]).
+// The receive path adds vehicles and writes their state, the TFT task reads the
+// selected one. Both hold the dispatch lock, which also guards the state slots.
+static VEHICLE_t vehicles[CONFIG_MAVLINK_VEHICLES];
+static uint8_t vehicleIndex[256];
+static uint8_t selected = VEHICLE_NONE;
+
+// Vehicle for a sysid. A new vehicle takes a free entry, or replaces the least
+// recently seen one that is not selected. The first vehicle seen is selected.
+VEHICLE_t *vehicle_lookup(uint8_t sysid, int64_t now)
+{
+	dispatch_lock();
+	if (vehicleIndex[sysid] != 0) {
+		VEHICLE_t *v = &vehicles[vehicleIndex[sysid] - 1];
+		v->lastSeen = now;
+		dispatch_unlock();
+		return v;
+	}
+
+	int slot = -1;
+	for (int i=0; i<CONFIG_MAVLINK_VEHICLES; i++) {
+		if (!vehicles[i].used) {
+			slot = i;
+			break;
+		}
+		if (vehicles[i].sysid == selected) continue;
+		if (slot < 0 || vehicles[i].lastSeen < vehicles[slot].lastSeen) slot = i;
+	}
+	if (slot < 0) {
+		dispatch_unlock();
+		return NULL;
+	}
+	VEHICLE_t *v = &vehicles[slot];
+	uint8_t replaced = v->used ? v->sysid : VEHICLE_NONE;
+	if (v->used) vehicleIndex[v->sysid] = 0;
+	memset(v, 0, sizeof(VEHICLE_t));
+	v->used = true;
+	v->sysid = sysid;
+	v->firstSeen = now;
+	v->lastSeen = now;
+	v->rateTime = now;
+	vehicleIndex[sysid] = slot + 1;
+	if (selected == VEHICLE_NONE) selected = sysid;
+	dispatch_unlock();
+
+	ESP_LOGI(TAG, "New vehicle sysid=%d%s", sysid, selected == sysid ? " selected" : "");
+	if (replaced != VEHICLE_NONE) ESP_LOGW(TAG, "Table full. sysid=%d dropped", replaced);
+	return v;
+}
+
+// Count a frame for a slot and update the rates once per interval
+void vehicle_count(VEHICLE_t *v, int slot, int64_t now)
+{
+	dispatch_lock();
+	v->count[slot]++;
+	int64_t elapsed = now - v->rateTime;
+	if (elapsed >= VEHICLE_RATE_INTERVAL) {
+		for (int i=0; i<TELEMETRY_SLOTS; i++) {
+			v->rate[i] = (v->count[i] - v->rateCount[i]) * 1000000.0 / elapsed;
+			v->rateCount[i] = v->count[i];
+		}
+		v->rateTime = now;
+	}
+	dispatch_unlock();
+}
+
+bool vehicle_is_selected(const VEHICLE_t *v)
+{
+	return v->sysid == selected;
+}
+
+uint8_t vehicle_selected(void)
+{
+	return selected;
+}
+
+// Select the vehicle with the next higher sysid, wrapping around
+uint8_t vehicle_select_next(void)
+{
+	dispatch_lock();
+	int next = VEHICLE_NONE;
+	for (int i=1; i<256; i++) {
+		int sysid = (selected + i) & 0xff;
+		if (vehicleIndex[sysid] != 0) {
+			next = sysid;
+			break;
+		}
+	}
+	if (next != VEHICLE_NONE) selected = next;
+	dispatch_unlock();
+	ESP_LOGI(TAG, "Selected sysid=%d", selected);
+	return selected;
+}
+
+// Vehicle for a sysid, or NULL. The caller holds the dispatch lock.
+VEHICLE_t *vehicle_find(uint8_t sysid)
+{
+	if (vehicleIndex[sysid] == 0) return NULL;
+	return &vehicles[vehicleIndex[sysid] - 1];
+}
+
+// Consistent copy of one vehicle
+bool vehicle_get(uint8_t sysid, VEHICLE_t *out)
+{
+	bool found = false;
+	dispatch_lock();
+	if (vehicleIndex[sysid] != 0) {
+		memcpy(out, &vehicles[vehicleIndex[sysid] - 1], sizeof(VEHICLE_t));
+		found = true;
+	}
+	dispatch_unlock();
+	return found;
+}
+
+void vehicle_report(int64_t now)
+{
+	for (int i=0; i<CONFIG_MAVLINK_VEHICLES; i++) {
+		VEHICLE_t v;
+		dispatch_lock();
+		memcpy(&v, &vehicles[i], sizeof(VEHICLE_t));
+		dispatch_unlock();
+		if (!v.used) continue;
+		ESP_LOGI(TAG, "sysid=%d%s last_seen=%lldms rate vfr_hud=%.1f attitude=%.1f gps=%.1f sys_status=%.1f",
+			v.sysid, v.sysid == selected ? "*" : "", (now - v.lastSeen) / 1000,
+			v.rate[TELEMETRY_VFR_HUD], v.rate[TELEMETRY_ATTITUDE], v.rate[TELEMETRY_GPS_RAW_INT], v.rate[TELEMETRY_SYS_STATUS]);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef MAIN_VEHICLE_H_
+#define MAIN_VEHICLE_H_
+
+#include "telemetry.h"
+
+// sysid 0 is never sent by a vehicle
+#define VEHICLE_NONE	0
+
+// Interval of the per-message rate update
+#define VEHICLE_RATE_INTERVAL	(1000*1000)
+
+typedef struct {
+	bool used;
+	uint8_t sysid;
+	int64_t firstSeen;
+	int64_t lastSeen;
+	uint32_t count[TELEMETRY_SLOTS];	// Frames per slot since first seen
+	float rate[TELEMETRY_SLOTS];		// Frames per second over the last interval
+	uint32_t rateCount[TELEMETRY_SLOTS];
+	int64_t rateTime;
+	TELEMETRY_t state;					// Last known state
+} VEHICLE_t;
+
+VEHICLE_t *vehicle_lookup(uint8_t sysid, int64_t now);
+VEHICLE_t *vehicle_find(uint8_t sysid);
+void vehicle_count(VEHICLE_t *v, int slot, int64_t now);
+bool vehicle_is_selected(const VEHICLE_t *v);
+uint8_t vehicle_selected(void);
+uint8_t vehicle_select_next(void);
+bool vehicle_get(uint8_t sysid, VEHICLE_t *out);
+void vehicle_report(int64_t now);
+
+#endif /* MAIN_VEHICLE_H_ */
@@ -0,0 +1,263 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+#include "os.h"
+#include "cmd.h"
+#include "boot.h"
+#include "wifi.h"
+
+extern OS_QUEUE_t xQueueCmd;
+
+/* The examples use WiFi configuration that you can set via project configuration menu
+
+   If you'd rather not, just change the below entries to strings with
+   the config you want - ie #define ESP_WIFI_SSID "mywifissid"
+*/
+#define ESP_WIFI_SSID	   CONFIG_ESP_WIFI_SSID
+#define ESP_WIFI_PASS	   CONFIG_ESP_WIFI_PASSWORD
+#define ESP_MAXIMUM_RETRY  CONFIG_ESP_MAXIMUM_RETRY
+
+// Fast connect fails over to a full scan after this many attempts
+#define FAST_CONNECT_RETRY	2
+
+#define NVS_NAMESPACE	"wifi"
+#define NVS_KEY_AP		"ap"
+
+static const char *TAG = "WIFI";
+
+// Last AP we were associated with
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t channel;
+} AP_CACHE_t;
+
+static wifi_config_t s_wifi_config;
+static AP_CACHE_t s_ap_cache;
+static bool s_fast_connect = false;
+static esp_timer_handle_t s_retry_timer;
+static int s_retry_num = 0;
+static int s_link_state = LINK_DOWN;
+static int64_t s_link_lost = 0;
+static int64_t s_reconnect_time = 0;
+static int64_t s_reconnect_max = 0;
+
+static void link_state(int state) {
+	if (state == s_link_state) return;
+	s_link_state = state;
+	if (xQueueCmd == NULL) return;
+	CMD_t cmdBuf;
+	cmdBuf.command = CMD_STATUS;
+	cmdBuf.time = esp_timer_get_time();
+	cmdBuf.taskHandle = os_task_current();
+	os_queue_send(xQueueCmd, &cmdBuf, 0);
+}
+
+static bool ap_cache_load(AP_CACHE_t *cache) {
+#if CONFIG_WIFI_FAST_CONNECT
+	nvs_handle_t handle;
+	if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return false;
+	size_t length = sizeof(AP_CACHE_t);
+	esp_err_t ret = nvs_get_blob(handle, NVS_KEY_AP, cache, &length);
+	nvs_close(handle);
+	return (ret == ESP_OK && length == sizeof(AP_CACHE_t) && cache->channel != 0);
+#else
+	return false;
+#endif
+}
+
+static void ap_cache_save(const uint8_t *bssid, uint8_t channel) {
+#if CONFIG_WIFI_FAST_CONNECT
+	if (memcmp(s_ap_cache.bssid, bssid, 6) == 0 && s_ap_cache.channel == channel) return;
+	memcpy(s_ap_cache.bssid, bssid, 6);
+	s_ap_cache.channel = channel;
+	nvs_handle_t handle;
+	if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+	if (nvs_set_blob(handle, NVS_KEY_AP, &s_ap_cache, sizeof(AP_CACHE_t)) == ESP_OK) {
+		nvs_commit(handle);
+		ESP_LOGI(TAG, "cached bssid=%02x:%02x:%02x:%02x:%02x:%02x channel=%d",
+			bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5], channel);
+	}
+	nvs_close(handle);
+#endif
+}
+
+// Connect straight to the cached BSSID and channel, or scan all channels
+static void set_fast_connect(bool enable) {
+	s_fast_connect = enable;
+	if (enable) {
+		memcpy(s_wifi_config.sta.bssid, s_ap_cache.bssid, 6);
+		s_wifi_config.sta.bssid_set = true;
+		s_wifi_config.sta.channel = s_ap_cache.channel;
+		s_wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+	} else {
+		s_wifi_config.sta.bssid_set = false;
+		s_wifi_config.sta.channel = 0;
+		s_wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+	}
+	esp_wifi_set_config(ESP_IF_WIFI_STA, &s_wifi_config);
+}
+
+static void retry_callback(void *arg) {
+	link_state(LINK_CONNECTING);
+	esp_wifi_connect();
+}
+
+// Retry at once for the first ESP_MAXIMUM_RETRY attempts, then back off exponentially forever
+static void schedule_retry(void) {
+	s_retry_num++;
+	if (s_fast_connect && s_retry_num >= FAST_CONNECT_RETRY) {
+		ESP_LOGI(TAG, "cached AP not found. Scan all channels");
+		set_fast_connect(false);
+	}
+	if (s_retry_num <= ESP_MAXIMUM_RETRY) {
+		ESP_LOGI(TAG, "retry to connect to the AP");
+		link_state(LINK_CONNECTING);
+		esp_wifi_connect();
+		return;
+	}
+	if (s_retry_num == ESP_MAXIMUM_RETRY + 1) {
+		ESP_LOGE(TAG, "Failed to connect to SSID:%s. Keep retrying in background", ESP_WIFI_SSID);
+		boot_fail(BOOT_STAGE_WIFI);
+	}
+	int shift = s_retry_num - ESP_MAXIMUM_RETRY - 1;
+	if (shift > 16) shift = 16;
+	uint64_t delay = (uint64_t)CONFIG_WIFI_BACKOFF_MIN_MS << shift;
+	if (delay > CONFIG_WIFI_BACKOFF_MAX_MS) delay = CONFIG_WIFI_BACKOFF_MAX_MS;
+	ESP_LOGI(TAG, "retry %d in %llums", s_retry_num, delay);
+	esp_timer_start_once(s_retry_timer, delay * 1000);
+}
+
+static void event_handler(void* arg, esp_event_base_t event_base,
+								int32_t event_id, void* event_data)
+{
+	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+		link_state(LINK_CONNECTING);
+		esp_wifi_connect();
+	} else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+		wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+		ESP_LOGI(TAG, "connected channel=%d%s", event->channel, s_fast_connect ? " (fast connect)" : "");
+		ap_cache_save(event->bssid, event->channel);
+		boot_stage(BOOT_STAGE_WIFI);
+	} else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+		wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+		if (s_link_state == LINK_UP) {
+			ESP_LOGW(TAG, "link lost reason=%d", event->reason);
+			s_link_lost = esp_timer_get_time();
+			s_retry_num = 0;
+			// The AP is most likely still where it was
+			if (s_ap_cache.channel != 0) set_fast_connect(true);
+		}
+		ESP_LOGI(TAG,"connect to the AP fail");
+		link_state(LINK_DOWN);
+		schedule_retry();
+	} else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+		ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+		ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+		if (s_link_lost) {
+			s_reconnect_time = esp_timer_get_time() - s_link_lost;
+			if (s_reconnect_time > s_reconnect_max) s_reconnect_max = s_reconnect_time;
+			ESP_LOGI(TAG, "reconnected in %lldms after %d retries (max %lldms)",
+				s_reconnect_time / 1000, s_retry_num, s_reconnect_max / 1000);
+			s_link_lost = 0;
+		}
+		s_retry_num = 0;
+		link_state(LINK_UP);
+		boot_stage(BOOT_STAGE_IP);
+	}
+}
+
+// Start WiFi association and return at once.
+// Progress is reported through the boot stages and the link state by event_handler() (see above).
+esp_err_t wifi_init_sta(void)
+{
+	ESP_ERROR_CHECK(esp_netif_init());
+
+	ESP_ERROR_CHECK(esp_event_loop_create_default());
+	esp_netif_create_default_wifi_sta();
+
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+	esp_timer_create_args_t retry_args = {
+		.callback = retry_callback,
+		.name = "wifi_retry",
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&retry_args, &s_retry_timer));
+
+	ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+			ESP_EVENT_ANY_ID,
+			&event_handler,
+			NULL,
+			NULL));
+	ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+			IP_EVENT_STA_GOT_IP,
+			&event_handler,
+			NULL,
+			NULL));
+
+	wifi_config_t wifi_config = {
+		.sta = {
+			.ssid = ESP_WIFI_SSID,
+			.password = ESP_WIFI_PASS,
+			/* Setting a password implies station will connect to all security modes including WEP/WPA.
+			 * However these modes are deprecated and not advisable to be used. Incase your Access point
+			 * doesn't support WPA2, these mode can be enabled by commenting below line */
+		 .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+
+			.pmf_cfg = {
+				.capable = true,
+				.required = false
+			},
+		},
+	};
+	s_wifi_config = wifi_config;
+	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
+	if (ap_cache_load(&s_ap_cache)) {
+		ESP_LOGI(TAG, "fast connect to channel %d", s_ap_cache.channel);
+		set_fast_connect(true);
+	} else {
+		ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &s_wifi_config) );
+	}
+	ESP_ERROR_CHECK(esp_wifi_start() );
+
+	ESP_LOGI(TAG, "wifi_init_sta finished.");
+	return ESP_OK;
+}
+
+int wifi_link_state(void) {
+	return s_link_state;
+}
+
+// Time from the last link loss to getting an address again
+int64_t wifi_reconnect_time(void) {
+	return s_reconnect_time;
+}
+
+// Signal of the access point in dBm. 0 while not associated.
+int wifi_rssi(void) {
+	wifi_ap_record_t ap;
+	if (s_link_state == LINK_DOWN || esp_wifi_sta_get_ap_info(&ap) != ESP_OK) return 0;
+	return ap.rssi;
+}
+
+void wifi_mac(uint8_t mac[6]) {
+	if (esp_wifi_get_mac(WIFI_IF_STA, mac) != ESP_OK) memset(mac, 0, 6);
+}
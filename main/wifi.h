@@ -0,0 +1,14 @@
+#ifndef MAIN_WIFI_H_
+#define MAIN_WIFI_H_
+
+#define LINK_DOWN		0
+#define LINK_CONNECTING	1
+#define LINK_UP			2
+
+esp_err_t wifi_init_sta(void);
+int wifi_link_state(void);
+int64_t wifi_reconnect_time(void);
+int wifi_rssi(void);
+void wifi_mac(uint8_t mac[6]);
+
+#endif /* MAIN_WIFI_H_ */